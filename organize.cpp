@@ -24,6 +24,48 @@
 #include <filesystem>
 #include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <exception>
+#include <mutex>
+#include <random>
+#include <system_error>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <linux/perf_event.h>
+#include <malloc.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#endif
 
 // Use the filesystem namespace for convenience
 namespace fs = std::filesystem;
@@ -39,96 +81,8748 @@ const std::unordered_map<std::string, std::vector<std::string>> FOLDER_MAP = {
     {"Others", {}} // For unknown or uncategorized extensions
 };
 
-// --- Pre-computed map for faster lookups ---
-std::unordered_map<std::string, std::string> g_extension_to_folder_map;
+// --- Pre-computed tables for faster lookups ---
+// Categories are referred to by a one-byte id (their index in g_categories, sorted by name),
+// so the lookup tables hold no strings and a lookup never allocates.
+
+using CategoryId = std::uint8_t;
+constexpr CategoryId kNoCategory = 0xFF;
+// classify_names() result for a name whose extension is not in the table.
+constexpr CategoryId kUnknownExtension = 0xFE;
+
+std::vector<std::string> g_categories;
+CategoryId g_others_id = kNoCategory;
+
+/**
+ * @brief Returns the id of a FOLDER_MAP category, or kNoCategory if there is no such folder.
+ */
+CategoryId category_id(std::string_view name) {
+    auto it = std::lower_bound(g_categories.begin(), g_categories.end(), name);
+    if (it == g_categories.end() || *it != name) return kNoCategory;
+    return static_cast<CategoryId>(it - g_categories.begin());
+}
+
+/**
+ * @brief Flat open-addressing table from lowercased extension (with its dot) to category id.
+ * Keys live inline in 16-byte slots, so a lookup is one hash plus a short linear probe over
+ * adjacent cache lines. Extensions longer than kMaxKey bytes cannot be stored (none are real).
+ * A key is handled as two 64-bit words (see Key), so folding case, hashing and comparing take
+ * a fixed handful of word operations whatever the extension's length.
+ */
+class ExtensionTable {
+public:
+    static constexpr std::size_t kMaxKey = 14;
+
+    /**
+     * @brief A lookup key: the extension zero-padded to kMaxKey bytes, then its length and a
+     * zero byte, i.e. the first 16 bytes of a Slot with the category cleared.
+     */
+    struct Key {
+        std::uint64_t lo = 0;
+        std::uint64_t hi = 0;
+    };
+
+    /**
+     * @brief Loads an extension of 1 to kMaxKey bytes into a key, without folding its case.
+     */
+    static Key load_key(const char* ext, std::size_t len) {
+        unsigned char bytes[sizeof(Key)] = {};
+        std::memcpy(bytes, ext, len);
+        bytes[kMaxKey] = static_cast<unsigned char>(len);
+        Key key;
+        std::memcpy(&key.lo, bytes, sizeof(key.lo));
+        std::memcpy(&key.hi, bytes + sizeof(key.lo), sizeof(key.hi));
+        return key;
+    }
+
+    /**
+     * @brief Lowercases the ASCII letters of a key, eight bytes at a time (bytes >= 0x80 and
+     * the length byte are left as they are, like std::tolower in the "C" locale).
+     */
+    static Key fold_key(Key key) { return {fold_ascii(key.lo), fold_ascii(key.hi)}; }
+
+    static std::uint64_t hash(Key key) {
+        std::uint64_t h = (key.lo ^ (key.hi * 0x9E3779B97F4A7C15ull)) * 0xBF58476D1CE4E5B9ull;
+        return h ^ (h >> 31);
+    }
+
+    /**
+     * @brief Inserts an already lowercased extension; keeps an existing entry unless `replace`.
+     * @return false if the key is too long to be stored.
+     */
+    bool insert(std::string_view ext, CategoryId category, bool replace) {
+        if (ext.empty() || ext.size() > kMaxKey) return false;
+        if ((count_ + 1) * 2 > slots_.size()) grow();
+        Key key = load_key(ext.data(), ext.size());
+        Slot& slot = probe(key, hash(key));
+        if (slot.len == 0) {
+            std::memcpy(slot.key, ext.data(), ext.size());
+            slot.len = static_cast<std::uint8_t>(ext.size());
+            slot.category = category;
+            ++count_;
+        } else if (replace) {
+            slot.category = category;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Looks up an extension in any letter case.
+     */
+    CategoryId find(std::string_view ext) const {
+        if (ext.empty() || ext.size() > kMaxKey) return kNoCategory;
+        Key key = fold_key(load_key(ext.data(), ext.size()));
+        return find(key, hash(key));
+    }
+
+    /**
+     * @brief Looks up a folded key whose hash the caller already has.
+     */
+    CategoryId find(Key key, std::uint64_t h) const {
+        if (slots_.empty()) return kNoCategory;
+        const Slot& slot = probe(key, h);
+        return slot.len == 0 ? kNoCategory : slot.category;
+    }
+
+    std::size_t size() const { return count_; }
+
+    /**
+     * @brief Calls fn(extension, category) for every entry, in table order.
+     */
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (const Slot& slot : slots_) {
+            if (slot.len != 0) fn(std::string_view(slot.key, slot.len), slot.category);
+        }
+    }
+
+private:
+    struct Slot {
+        char key[kMaxKey];
+        std::uint8_t len = 0;
+        CategoryId category = kNoCategory;
+    };
+    static_assert(sizeof(Slot) == sizeof(Key), "a slot starts with its key");
+    static_assert(sizeof(Slot) == 16, "slots should pack four to a cache line");
+
+    static std::uint64_t fold_ascii(std::uint64_t x) {
+        constexpr std::uint64_t ones = 0x0101010101010101ull;
+        std::uint64_t low7 = x & (0x7F * ones);
+        std::uint64_t from_a = low7 + (0x80 - 'A') * ones;   // top bit set from 'A' up
+        std::uint64_t past_z = low7 + (0x7F - 'Z') * ones;   // top bit set past 'Z'
+        std::uint64_t upper = (from_a ^ past_z) & ~x & (0x80 * ones);
+        return x | (upper >> 2);
+    }
+
+    // Clears the category byte of a slot's second key word, whatever the byte order.
+    static inline const std::uint64_t kKeyMask = [] {
+        unsigned char bytes[sizeof(std::uint64_t)];
+        std::memset(bytes, 0xFF, sizeof(bytes));
+        bytes[sizeof(bytes) - 1] = 0;
+        std::uint64_t mask;
+        std::memcpy(&mask, bytes, sizeof(mask));
+        return mask;
+    }();
+
+    Slot& probe(Key key, std::uint64_t h) const {
+        std::size_t mask = slots_.size() - 1;
+        for (std::size_t i = h & mask;; i = (i + 1) & mask) {
+            const Slot& slot = slots_[i];
+            Key stored;
+            std::memcpy(&stored, static_cast<const void*>(&slot), sizeof(stored));
+            if (slot.len == 0 || (stored.lo == key.lo && (stored.hi & kKeyMask) == key.hi)) {
+                return const_cast<Slot&>(slot);
+            }
+        }
+    }
+
+    void grow() {
+        std::vector<Slot> old(std::max<std::size_t>(64, slots_.size() * 2));
+        old.swap(slots_);
+        for (const Slot& slot : old) {
+            if (slot.len != 0) {
+                Key key = load_key(slot.key, slot.len);
+                probe(key, hash(key)) = slot;
+            }
+        }
+    }
+
+    std::vector<Slot> slots_;
+    std::size_t count_ = 0;
+};
+
+ExtensionTable g_extension_table;
+
+/**
+ * @brief Populates the category ids and the extension table from the FOLDER_MAP constant.
+ */
+void build_extension_map() {
+    for (const auto& [folder, extensions] : FOLDER_MAP) {
+        g_categories.push_back(folder);
+    }
+    std::sort(g_categories.begin(), g_categories.end());
+    g_others_id = category_id("Others");
+    for (const auto& [folder, extensions] : FOLDER_MAP) {
+        for (const auto& ext : extensions) {
+            g_extension_table.insert(ext, category_id(folder), true);
+        }
+    }
+}
+
+/**
+ * @brief Determines the target folder for a given file extension using the pre-computed table.
+ * @param file_ext The file extension (e.g., ".txt", ".pdf").
+ * @return The name of the folder where the file should be moved. Returns "Others" if not found.
+ */
+std::string get_target_folder(std::string_view file_ext) {
+    CategoryId id = g_extension_table.find(file_ext);
+    return id == kNoCategory ? "Others" : g_categories[id];
+}
+
+/**
+ * @brief Finds the extension of a file name by the rules of fs::path::extension(): from the
+ * last dot, unless the name is "." or ".." or that dot is its first character.
+ * @return The offset of the dot, or `len` when the name has no extension.
+ */
+std::size_t extension_offset(const char* name, std::size_t len) {
+    if (len <= 2 && std::all_of(name, name + len, [](char c) { return c == '.'; })) return len;
+    for (std::size_t i = len; i-- > 1;) {
+        if (name[i] == '.') return i;
+    }
+    return len;
+}
+
+// Names classified side by side in each pass of classify_names().
+constexpr std::size_t kClassifyLanes = 8;
+
+/**
+ * @brief Classifies a batch of file names by extension alone.
+ * Name i is names[offsets[i], offsets[i + 1]), so `offsets` holds count + 1 entries. out[i]
+ * receives the category, kNoCategory for a name without an extension, or kUnknownExtension.
+ * Names go through in blocks of kClassifyLanes with one pass per step: find and load each
+ * extension, fold case, hash, then probe. The fold and hash passes are straight-line word
+ * arithmetic over a fixed number of lanes, which the compiler vectorizes, and the probes of a
+ * block are independent of each other, so their cache misses overlap.
+ */
+
+void classify_names(const char* names, const std::uint32_t* offsets, std::size_t count, CategoryId* out) {
+    using Key = ExtensionTable::Key;
+    for (std::size_t block = 0; block < count; block += kClassifyLanes) {
+        std::size_t lanes = std::min(kClassifyLanes, count - block);
+        Key keys[kClassifyLanes];
+        std::uint64_t hashes[kClassifyLanes];
+        bool searchable[kClassifyLanes] = {};
+
+        for (std::size_t l = 0; l < lanes; ++l) {
+            const char* name = names + offsets[block + l];
+            std::size_t len = offsets[block + l + 1] - offsets[block + l];
+            std::size_t dot = extension_offset(name, len);
+            std::size_t ext_len = len - dot;
+            out[block + l] = ext_len == 0 ? kNoCategory : kUnknownExtension;
+            searchable[l] = ext_len != 0 && ext_len <= ExtensionTable::kMaxKey;
+            if (searchable[l]) keys[l] = ExtensionTable::load_key(name + dot, ext_len);
+        }
+        for (std::size_t l = 0; l < kClassifyLanes; ++l) {
+            keys[l] = ExtensionTable::fold_key(keys[l]);
+        }
+        for (std::size_t l = 0; l < kClassifyLanes; ++l) {
+            hashes[l] = ExtensionTable::hash(keys[l]);
+        }
+        for (std::size_t l = 0; l < lanes; ++l) {
+            if (!searchable[l]) continue;
+            CategoryId id = g_extension_table.find(keys[l], hashes[l]);
+            if (id != kNoCategory) out[block + l] = id;
+        }
+    }
+}
+
+/**
+ * @brief One content signature compiled from shared-mime-info: every part must match.
+ */
+struct MagicRule {
+    struct Part {
+        std::uint32_t offset;
+        std::string bytes;
+    };
+    std::uint32_t priority;
+    CategoryId category;
+    std::vector<Part> parts;
+};
+
+// Magic rules may look at most this far into a file.
+constexpr std::uint32_t kMaxMagicHeader = 4096;
+
+/**
+ * @brief The magic rules compiled for matching: the bytes of every part live in one arena,
+ * and each rule is filed under one of its parts, its anchor, by (offset, first byte). A header
+ * is then checked against the few rules whose anchor byte it actually has, instead of all of
+ * them. Rules are numbered in priority order, so the lowest-numbered match wins.
+ */
+class MagicTable {
+public:
+    /**
+     * @brief Replaces the table with `rules`; among equal priorities, earlier rules win.
+     */
+    void build(std::vector<MagicRule> rules) {
+        *this = MagicTable();
+        std::stable_sort(rules.begin(), rules.end(),
+                         [](const MagicRule& a, const MagicRule& b) { return a.priority > b.priority; });
+        std::vector<std::uint32_t> anchor_of;  // per rule: index of its anchor part, or UINT32_MAX
+        for (const MagicRule& rule : rules) {
+            Rule compiled{rule.category, static_cast<std::uint32_t>(parts_.size()), static_cast<std::uint32_t>(rule.parts.size())};
+            std::uint32_t anchor = UINT32_MAX;
+            for (const MagicRule::Part& part : rule.parts) {
+                if (anchor == UINT32_MAX && !part.bytes.empty()) anchor = static_cast<std::uint32_t>(parts_.size());
+                parts_.push_back({part.offset, static_cast<std::uint32_t>(arena_.size()), static_cast<std::uint32_t>(part.bytes.size())});
+                arena_ += part.bytes;
+                header_ = std::max<std::size_t>(header_, part.offset + part.bytes.size());
+            }
+            if (anchor == UINT32_MAX) {
+                unanchored_.push_back(static_cast<std::uint32_t>(rules_.size()));
+            } else {
+                anchors_.push_back(parts_[anchor].offset);
+            }
+            anchor_of.push_back(anchor);
+            rules_.push_back(compiled);
+        }
+        std::sort(anchors_.begin(), anchors_.end());
+        anchors_.erase(std::unique(anchors_.begin(), anchors_.end()), anchors_.end());
+
+        // Group the rules by (anchor offset, first byte) with a counting sort, keeping them
+        // in priority order within each group.
+        auto slot_of = [&](std::uint32_t part) {
+            std::size_t k = static_cast<std::size_t>(std::lower_bound(anchors_.begin(), anchors_.end(), parts_[part].offset) - anchors_.begin());
+            return k * 256 + static_cast<unsigned char>(arena_[parts_[part].at]);
+        };
+        starts_.assign(anchors_.size() * 256 + 1, 0);
+        for (std::uint32_t anchor : anchor_of) {
+            if (anchor != UINT32_MAX) ++starts_[slot_of(anchor) + 1];
+        }
+        for (std::size_t i = 1; i < starts_.size(); ++i) starts_[i] += starts_[i - 1];
+        by_anchor_.resize(starts_.back());
+        std::vector<std::uint32_t> fill(starts_.begin(), starts_.end() - 1);
+        for (std::uint32_t r = 0; r < anchor_of.size(); ++r) {
+            if (anchor_of[r] != UINT32_MAX) by_anchor_[fill[slot_of(anchor_of[r])]++] = r;
+        }
+    }
+
+    bool empty() const { return rules_.empty(); }
+
+    // Bytes of the file header that cover every rule.
+    std::size_t header_size() const { return header_; }
+
+    /**
+     * @return The category of the highest-priority rule matching the header, or kNoCategory.
+     */
+    CategoryId match(const unsigned char* header, std::size_t size) const {
+        std::uint32_t best = static_cast<std::uint32_t>(rules_.size());
+        for (std::uint32_t r : unanchored_) {
+            if (r >= best) break;
+            if (matches(rules_[r], header, size)) {
+                best = r;
+                break;
+            }
+        }
+        for (std::size_t k = 0; k < anchors_.size() && anchors_[k] < size; ++k) {
+            std::size_t slot = k * 256 + header[anchors_[k]];
+            for (std::uint32_t i = starts_[slot]; i < starts_[slot + 1]; ++i) {
+                std::uint32_t r = by_anchor_[i];
+                if (r >= best) break;
+                if (matches(rules_[r], header, size)) {
+                    best = r;
+                    break;
+                }
+            }
+        }
+        return best < rules_.size() ? rules_[best].category : kNoCategory;
+    }
+
+private:
+    struct Part {
+        std::uint32_t offset;  // in the file
+        std::uint32_t at;      // in arena_
+        std::uint32_t length;
+    };
+    struct Rule {
+        CategoryId category;
+        std::uint32_t first_part;
+        std::uint32_t part_count;
+    };
+
+    bool matches(const Rule& rule, const unsigned char* header, std::size_t size) const {
+        for (std::uint32_t p = rule.first_part; p < rule.first_part + rule.part_count; ++p) {
+            const Part& part = parts_[p];
+            if (part.offset + std::size_t{part.length} > size ||
+                std::memcmp(header + part.offset, arena_.data() + part.at, part.length) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string arena_;
+    std::vector<Part> parts_;
+    std::vector<Rule> rules_;                // highest priority first
+    std::vector<std::uint32_t> anchors_;     // distinct anchor offsets, ascending
+    std::vector<std::uint32_t> starts_;      // per (anchor offset index, byte): start in by_anchor_
+    std::vector<std::uint32_t> by_anchor_;   // rule numbers grouped by anchor, ascending in each group
+    std::vector<std::uint32_t> unanchored_;  // rules whose parts are all empty
+    std::size_t header_ = 0;
+};
+
+// Empty unless a MIME database was loaded with --mime-db.
+MagicTable g_magic_table;
+
+/**
+ * @brief Sniffs the start of a file against the magic rules, reading the header into a stack
+ * buffer.
+ * @return The category of the first (highest-priority) matching rule, or kNoCategory.
+ */
+CategoryId classify_magic(const fs::path& file) {
+    unsigned char header[kMaxMagicHeader];
+    std::size_t want = std::min<std::size_t>(g_magic_table.header_size(), sizeof(header));
+    std::size_t size = 0;
+#ifndef _WIN32
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return kNoCategory;
+    while (size < want) {
+        ssize_t got = ::pread(fd, header + size, want - size, static_cast<off_t>(size));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        size += static_cast<std::size_t>(got);
+    }
+    ::close(fd);
+#else
+    std::ifstream in(file, std::ios::binary);
+    if (!in) return kNoCategory;
+    in.read(reinterpret_cast<char*>(header), static_cast<std::streamsize>(want));
+    size = static_cast<std::size_t>(in.gcount());
+#endif
+    return g_magic_table.match(header, size);
+}
+
+// --- Move plans: decide first, act later (possibly on another host) ---
+
+// Serialises console output from worker threads.
+std::mutex g_console_mutex;
+
+// Suppresses the per-file messages (used by --quiet and the stress runner).
+bool g_quiet = false;
+
+/**
+ * @brief Identity and version of a file, used to detect plan entries that went stale.
+ */
+struct FileStamp {
+    std::uint64_t inode = 0;
+    std::uint64_t size = 0;
+    std::int64_t mtime_ns = 0;
+};
+
+/**
+ * @brief A single planned move from a source file to its category folder.
+ */
+struct PlanEntry {
+    fs::path source;
+    fs::path destination;
+    FileStamp stamp;
+    CategoryId category = kNoCategory;  // the destination's category, when known
+};
+
+/**
+ * @brief Counters returned by execute_plan().
+ */
+struct ExecuteReport {
+    std::size_t moved = 0;
+    std::size_t skipped = 0;
+    std::size_t stale = 0;
+    std::size_t failed = 0;
+};
+
+#ifndef _WIN32
+/**
+ * @brief Takes inode, size and modification time from a stat result.
+ */
+void stamp_from_stat(const struct stat& st, FileStamp& stamp) {
+    stamp.inode = static_cast<std::uint64_t>(st.st_ino);
+    stamp.size = static_cast<std::uint64_t>(st.st_size);
+#if defined(__APPLE__)
+    stamp.mtime_ns = static_cast<std::int64_t>(st.st_mtimespec.tv_sec) * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime_ns = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+}
+#endif
+
+/**
+ * @brief Reads inode, size and modification time of a regular file with a single stat call.
+ * @param path The file to inspect.
+ * @param stamp Receives the observed values.
+ * @param ec Receives the error when false is returned.
+ * @return false if the file could not be stat'ed or is not a regular file.
+ */
+bool read_file_stamp(const fs::path& path, FileStamp& stamp, std::error_code& ec) {
+    ec.clear();
+#ifndef _WIN32
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        ec.assign(errno, std::generic_category());
+        return false;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        ec = std::make_error_code(S_ISDIR(st.st_mode) ? std::errc::is_a_directory : std::errc::invalid_argument);
+        return false;
+    }
+    stamp_from_stat(st, stamp);
+    return true;
+#else
+    // Windows has no stable inode through std::filesystem; leave it zero so it is not checked.
+    stamp.inode = 0;
+    stamp.size = fs::file_size(path, ec);
+    if (ec) {
+        return false;
+    }
+    auto mtime = fs::last_write_time(path, ec);
+    if (ec) {
+        return false;
+    }
+    stamp.mtime_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+    return true;
+#endif
+}
+
+enum class MoveStatus { Moved, Exists, Failed };
+
+/**
+ * @brief Renames a file without ever replacing an existing destination.
+ * Uses renameat2(RENAME_NOREPLACE) on Linux and renamex_np(RENAME_EXCL) on macOS, where the
+ * check and the rename are atomic. Filesystems or kernels that lack them get link() then
+ * unlink(), where link() fails with EEXIST just as atomically. Where link() is refused too
+ * (FAT, exFAT and some network or FUSE filesystems have no hard links), the destination name
+ * is claimed with an O_EXCL placeholder that the rename then replaces, so the only file the
+ * rename can replace is the placeholder.
+ * @param from The file to move.
+ * @param to The destination path.
+ * @param ec Receives the error when Failed is returned.
+ */
+MoveStatus move_no_clobber(const fs::path& from, const fs::path& to, std::error_code& ec) {
+    ec.clear();
+#if defined(__linux__) && defined(RENAME_NOREPLACE)
+    if (::renameat2(AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(), RENAME_NOREPLACE) == 0) {
+        return MoveStatus::Moved;
+    }
+    if (errno == EEXIST) {
+        return MoveStatus::Exists;
+    }
+    if (errno != EINVAL && errno != ENOSYS) {
+        ec.assign(errno, std::generic_category());
+        return MoveStatus::Failed;
+    }
+#endif
+#if defined(__APPLE__) && defined(RENAME_EXCL)
+    if (::renamex_np(from.c_str(), to.c_str(), RENAME_EXCL) == 0) {
+        return MoveStatus::Moved;
+    }
+    if (errno == EEXIST) {
+        return MoveStatus::Exists;
+    }
+    if (errno != ENOTSUP && errno != EINVAL) {
+        ec.assign(errno, std::generic_category());
+        return MoveStatus::Failed;
+    }
+#endif
+#ifndef _WIN32
+    if (::link(from.c_str(), to.c_str()) != 0) {
+        if (errno == EEXIST) {
+            return MoveStatus::Exists;
+        }
+        if (errno != EPERM && errno != ENOTSUP && errno != EOPNOTSUPP && errno != EXDEV) {
+            ec.assign(errno, std::generic_category());
+            return MoveStatus::Failed;
+        }
+        int fd = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            if (errno == EEXIST) {
+                return MoveStatus::Exists;
+            }
+            ec.assign(errno, std::generic_category());
+            return MoveStatus::Failed;
+        }
+        struct stat placeholder {};
+        ::fstat(fd, &placeholder);
+        ::close(fd);
+        if (::rename(from.c_str(), to.c_str()) != 0) {
+            ec.assign(errno, std::generic_category());
+            struct stat now {};
+            if (::lstat(to.c_str(), &now) == 0 && now.st_ino == placeholder.st_ino && now.st_dev == placeholder.st_dev) {
+                ::unlink(to.c_str()); // only our own placeholder, never a file that took its place
+            }
+            return MoveStatus::Failed;
+        }
+        return MoveStatus::Moved;
+    }
+    if (::unlink(from.c_str()) != 0) {
+        ec.assign(errno, std::generic_category());
+        ::unlink(to.c_str()); // leave the file where it was rather than in both places
+        return MoveStatus::Failed;
+    }
+    return MoveStatus::Moved;
+#else
+    if (fs::exists(to, ec)) {
+        return MoveStatus::Exists;
+    }
+    if (ec) {
+        return MoveStatus::Failed;
+    }
+    fs::rename(from, to, ec);
+    return ec ? MoveStatus::Failed : MoveStatus::Moved;
+#endif
+}
+
+// Copies whose extended attributes, ACLs or timestamps could not all be carried over.
+std::atomic<std::size_t> g_metadata_losses{0};
+
+#ifndef _WIN32
+/**
+ * @brief Carries a file's metadata over to its copy: the exact permission bits (the O_CREAT
+ * mode went through the umask), extended attributes, which include POSIX ACLs
+ * (system.posix_acl_*), and last the nanosecond access and modification times, so nothing
+ * touches them afterwards. One flistxattr() into a reused buffer both probes and lists the
+ * attributes, so a file without any costs a single call; values go through a buffer that
+ * is reused across files. Attributes outside user.* that need privileges we lack are skipped.
+ * @return false if anything that should have been preserved was lost.
+ */
+bool copy_metadata(int in, int out, const struct stat& st) {
+    bool complete = ::fchmod(out, st.st_mode & 07777) == 0;
+#ifdef __linux__
+    thread_local std::vector<char> names(1024);
+    thread_local std::vector<char> value(4096);
+    ssize_t listed = ::flistxattr(in, names.data(), names.size());
+    while (listed < 0 && errno == ERANGE) {
+        ssize_t needed = ::flistxattr(in, nullptr, 0);
+        names.resize(std::max(names.size() * 2, static_cast<std::size_t>(std::max<ssize_t>(needed, 0))));
+        listed = ::flistxattr(in, names.data(), names.size());
+    }
+    if (listed < 0 && errno != ENOTSUP) {
+        complete = false;
+    }
+    for (ssize_t at = 0; at < listed; at += static_cast<ssize_t>(std::strlen(names.data() + at)) + 1) {
+        const char* name = names.data() + at;
+        ssize_t size = ::fgetxattr(in, name, value.data(), value.size());
+        while (size < 0 && errno == ERANGE) {
+            ssize_t needed = ::fgetxattr(in, name, nullptr, 0);
+            value.resize(std::max(value.size() * 2, static_cast<std::size_t>(std::max<ssize_t>(needed, 0))));
+            size = ::fgetxattr(in, name, value.data(), value.size());
+        }
+        if (size < 0 || ::fsetxattr(out, name, value.data(), static_cast<std::size_t>(size), 0) != 0) {
+            bool privileged = errno == EPERM && std::strncmp(name, "user.", 5) != 0;
+            complete = complete && privileged;
+        }
+    }
+#endif
+#if defined(__APPLE__)
+    const struct timespec times[2] = {st.st_atimespec, st.st_mtimespec};
+#else
+    const struct timespec times[2] = {st.st_atim, st.st_mtim};
+#endif
+    if (::futimens(out, times) != 0) {
+        complete = false;
+    }
+    return complete;
+}
+#endif
+
+#ifndef _WIN32
+// Copies of files at least kCopyPipelineMin bytes are pipelined in kCopyChunk pieces, with up
+// to kCopyDepth chunks read ahead of the writers and as many written behind them.
+constexpr std::size_t kCopyChunk = 1 << 20;
+constexpr std::size_t kCopyDepth = 4;
+constexpr std::uint64_t kCopyPipelineMin = 2 * kCopyChunk;
+
+/**
+ * @brief Copies the rest of `in` to every descriptor in `outs`, reading it only once. Small
+ * files go through one buffer on the calling thread. Larger ones are pipelined so that the
+ * source and the destination devices are busy at the same time: a reader thread stays up to
+ * kCopyDepth chunks ahead of the slowest writer; the first output is written on the calling
+ * thread and every other one on a thread of its own. Each writer starts writeback of a chunk
+ * as soon as it is written and waits only for the chunk kCopyDepth behind, which also bounds
+ * the page cache one copy fills (Linux). An output that fails is dropped while the others
+ * carry on.
+ * @param size The expected length; it only chooses between the two ways of copying.
+ * @param errors Receives, per output, 0 or the errno of its first failure; a read error is
+ *               reported for every output.
+ */
+void tee_contents(int in, const std::vector<int>& outs, std::vector<int>& errors, std::uint64_t size) {
+    errors.assign(outs.size(), 0);
+    auto read_full = [in](char* data, std::size_t length, std::size_t& got) {
+        got = 0;
+        while (got < length) {
+            ssize_t n = ::read(in, data + got, length - got);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+            if (n == 0) break;
+            got += static_cast<std::size_t>(n);
+        }
+        return 0;
+    };
+    auto write_all = [](int out, const char* data, std::size_t length) {
+        while (length > 0) {
+            ssize_t w = ::write(out, data, length);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+            data += w;
+            length -= static_cast<std::size_t>(w);
+        }
+        return 0;
+    };
+
+    if (size < kCopyPipelineMin) {
+        std::vector<char> buffer(1 << 17);
+        for (std::size_t got = 1; got > 0;) {
+            if (int err = read_full(buffer.data(), buffer.size(), got)) {
+                for (int& error : errors) {
+                    if (error == 0) error = err;
+                }
+                return;
+            }
+            for (std::size_t j = 0; j < outs.size(); ++j) {
+                if (errors[j] == 0) errors[j] = write_all(outs[j], buffer.data(), got);
+            }
+        }
+        return;
+    }
+
+#ifdef __linux__
+    ::posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    struct Chunk {
+        std::vector<char> data = std::vector<char>(kCopyChunk);
+        std::size_t length = 0;
+    };
+    std::vector<Chunk> ring(kCopyDepth);
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::size_t read = 0;                            // chunks
+    std::vector<std::size_t> written(outs.size(), 0);
+    std::size_t failed = 0;
+    bool end = false;
+    int read_error = 0;
+
+    std::thread reader([&] {
+        for (std::size_t k = 0;; ++k) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return end || k - *std::min_element(written.begin(), written.end()) < kCopyDepth; });
+                if (end) return;
+            }
+            Chunk& chunk = ring[k % kCopyDepth];
+            int err = read_full(chunk.data.data(), kCopyChunk, chunk.length);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (err != 0 || chunk.length == 0) {
+                read_error = err;
+                end = true;
+            } else {
+                ++read;
+            }
+            cv.notify_all();
+            if (end) return;
+        }
+    });
+
+    auto writer = [&](std::size_t j) {
+        int out = outs[j];
+        for (std::size_t k = 0;; ++k) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return read > k || end; });
+                if (read <= k) {
+                    if (errors[j] == 0) errors[j] = read_error;
+                    return;
+                }
+            }
+            // A failed output keeps taking chunks, only so it never holds the others up.
+            if (errors[j] == 0) {
+                const Chunk& chunk = ring[k % kCopyDepth];
+                errors[j] = write_all(out, chunk.data.data(), chunk.length);
+#ifdef __linux__
+                if (errors[j] == 0) {
+                    ::sync_file_range(out, static_cast<off_t>(k * kCopyChunk), static_cast<off_t>(chunk.length),
+                                      SYNC_FILE_RANGE_WRITE);
+                    if (k >= kCopyDepth) {
+                        auto behind = static_cast<off_t>((k - kCopyDepth) * kCopyChunk);
+                        ::sync_file_range(out, behind, kCopyChunk,
+                                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+                        ::posix_fadvise(out, behind, kCopyChunk, POSIX_FADV_DONTNEED);
+                    }
+                }
+#endif
+                if (errors[j] != 0) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (++failed == outs.size()) end = true;  // nobody left to read for
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            ++written[j];
+            cv.notify_all();
+        }
+    };
+    std::vector<std::thread> writers;
+    for (std::size_t j = 1; j < outs.size(); ++j) {
+        writers.emplace_back(writer, j);
+    }
+    writer(0);
+    for (auto& thread : writers) {
+        thread.join();
+    }
+    reader.join();
+}
+
+/**
+ * @brief True if the file at `path` holds exactly the `size` bytes of the open file `in`.
+ * `in` is read with pread, so its offset is left where it was.
+ */
+bool same_contents(int in, const fs::path& path, std::uint64_t size) {
+    int other = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (other < 0) {
+        return false;
+    }
+    struct stat st;
+    bool same = ::fstat(other, &st) == 0 && static_cast<std::uint64_t>(st.st_size) == size;
+    std::vector<char> a(1 << 16), b(1 << 16);
+    for (std::uint64_t offset = 0; same && offset < size;) {
+        std::size_t want = static_cast<std::size_t>(std::min<std::uint64_t>(a.size(), size - offset));
+        ssize_t x = ::pread(in, a.data(), want, static_cast<off_t>(offset));
+        ssize_t y = ::pread(other, b.data(), want, static_cast<off_t>(offset));
+        if (x < 0 && errno == EINTR) continue;
+        same = x > 0 && x == y && std::memcmp(a.data(), b.data(), static_cast<std::size_t>(x)) == 0;
+        offset += static_cast<std::uint64_t>(std::max<ssize_t>(x, 0));
+    }
+    ::close(other);
+    return same;
+}
+
+/**
+ * @brief Copies the rest of `in` to `out`; see tee_contents().
+ * @return 0, or the errno of the first read or write that failed.
+ */
+int copy_contents(int in, int out, std::uint64_t size) {
+    std::vector<int> errors;
+    tee_contents(in, {out}, errors, size);
+    return errors[0];
+}
+
+/**
+ * @brief Flushes a directory, so entries created or renamed in it survive a crash.
+ * @return 0, or the errno of the open or fsync that failed.
+ */
+int fsync_directory(const fs::path& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+    int err = ::fsync(fd) == 0 ? 0 : errno;
+    ::close(fd);
+    return err;
+}
+
+/**
+ * @brief Flushes a file written through a stream, which offers no fsync of its own.
+ * @return 0, or the errno of the open or fsync that failed.
+ */
+int fsync_file(const fs::path& file) {
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+    int err = ::fsync(fd) == 0 ? 0 : errno;
+    ::close(fd);
+    return err;
+}
+
+// Numbers the temporary files copies are written to.
+std::atomic<std::uint64_t> g_copy_serial{0};
+
+/**
+ * @brief A fresh name in `dir` for a copy to be written to before it is moved into place.
+ */
+fs::path copy_temp_path(const fs::path& dir) {
+    return dir / (".organize-copy-" + std::to_string(::getpid()) + "-" +
+                  std::to_string(g_copy_serial.fetch_add(1, std::memory_order_relaxed)));
+}
+#endif
+
+/**
+ * @brief Copies a file's contents and metadata to a destination that must not exist yet.
+ * The copy is written to a temporary file next to the destination, fsync'ed, and then moved
+ * into place with move_no_clobber(), so a concurrent writer is never overwritten and the
+ * destination name only ever holds a complete, durable copy; the directory is flushed too,
+ * so a caller may remove the source once Moved is returned. A partial copy is unlinked again
+ * on failure. Contents go through copy_contents(), which pipelines large files. Metadata is
+ * carried over by copy_metadata(); what the destination cannot take is counted in
+ * g_metadata_losses.
+ * @param from The file to copy.
+ * @param to The destination path.
+ * @param ec Receives the error when Failed is returned.
+ * @return Moved once the copy is complete, Exists if the destination was already there.
+ */
+MoveStatus copy_no_clobber(const fs::path& from, const fs::path& to, std::error_code& ec) {
+    ec.clear();
+#ifndef _WIN32
+    int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        ec.assign(errno, std::generic_category());
+        return MoveStatus::Failed;
+    }
+    struct stat st;
+    if (::fstat(in, &st) != 0) {
+        ec.assign(errno, std::generic_category());
+        ::close(in);
+        return MoveStatus::Failed;
+    }
+    // Taken names are found before anything is copied; the final move still never clobbers.
+    struct stat existing;
+    if (::lstat(to.c_str(), &existing) == 0) {
+        ::close(in);
+        return MoveStatus::Exists;
+    }
+    fs::path temp = copy_temp_path(to.parent_path());
+    int out = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+    if (out < 0) {
+        ec.assign(errno, std::generic_category());
+        ::close(in);
+        return MoveStatus::Failed;
+    }
+
+    int err = copy_contents(in, out, static_cast<std::uint64_t>(st.st_size));
+    if (err == 0 && !copy_metadata(in, out, st)) {
+        ++g_metadata_losses;
+    }
+    if (err == 0 && ::fsync(out) != 0) {
+        err = errno;
+    }
+    if (::close(out) != 0 && err == 0) {
+        err = errno;
+    }
+    ::close(in);
+    if (err != 0) {
+        ::unlink(temp.c_str());
+        ec.assign(err, std::generic_category());
+        return MoveStatus::Failed;
+    }
+    MoveStatus status = move_no_clobber(temp, to, ec);
+    if (status != MoveStatus::Moved) {
+        ::unlink(temp.c_str());
+        return status;
+    }
+    if ((err = fsync_directory(to.parent_path())) != 0) {
+        // The copy is complete but its name may not be durable yet: keep the source.
+        ::unlink(to.c_str());
+        ec.assign(err, std::generic_category());
+        return MoveStatus::Failed;
+    }
+    return MoveStatus::Moved;
+#else
+    if (fs::exists(to, ec)) {
+        return MoveStatus::Exists;
+    }
+    if (ec) {
+        return MoveStatus::Failed;
+    }
+    if (!fs::copy_file(from, to, fs::copy_options::none, ec)) {
+        std::error_code ignored;
+        fs::remove(to, ignored);
+        return MoveStatus::Failed;
+    }
+    return MoveStatus::Moved;
+#endif
+}
+
+// --- Filesystem backends ---
+// Every filesystem operation the engine issues goes through an FsBackend, so alternative
+// implementations (tracing, replay, fault injection) can be layered without touching the engine.
+
+class FsBackend {
+public:
+    virtual ~FsBackend() = default;
+    virtual bool make_directory(const fs::path& path, std::error_code& ec) = 0;
+    virtual bool list_directory(const fs::path& path, std::vector<fs::directory_entry>& entries, std::error_code& ec) = 0;
+    virtual bool stat(const fs::path& path, FileStamp& stamp, std::error_code& ec) = 0;
+    virtual MoveStatus rename(const fs::path& from, const fs::path& to, std::error_code& ec) = 0;
+    virtual MoveStatus copy(const fs::path& from, const fs::path& to, std::error_code& ec) = 0;
+    virtual bool remove(const fs::path& path, std::error_code& ec) = 0;
+};
+
+/**
+ * @brief Backend that issues the operations directly against the local filesystem.
+ */
+class SyncBackend final : public FsBackend {
+public:
+    bool make_directory(const fs::path& path, std::error_code& ec) override {
+        fs::create_directory(path, ec);
+        return !ec;
+    }
+
+    bool list_directory(const fs::path& path, std::vector<fs::directory_entry>& entries, std::error_code& ec) override {
+        entries.clear();
+        for (fs::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+            entries.push_back(*it);
+        }
+        return !ec;
+    }
+
+    bool stat(const fs::path& path, FileStamp& stamp, std::error_code& ec) override {
+        return read_file_stamp(path, stamp, ec);
+    }
+
+    MoveStatus rename(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        return move_no_clobber(from, to, ec);
+    }
+
+    MoveStatus copy(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        return copy_no_clobber(from, to, ec);
+    }
+
+    bool remove(const fs::path& path, std::error_code& ec) override {
+        return fs::remove(path, ec);
+    }
+};
+
+/**
+ * @brief Ensures that all required destination folders exist in the base path.
+ * If they don't exist, they are created. This function handles potential errors
+ * during directory creation.
+ * @param backend The filesystem backend to issue the operations through.
+ * @param base_path The root directory where folders should be created.
+ */
+void ensure_folders(FsBackend& backend, const fs::path& base_path) {
+    for (const auto& [folder_name, _] : FOLDER_MAP) {
+        fs::path folder_path = base_path / folder_name;
+        std::error_code ec;
+        if (!backend.make_directory(folder_path, ec)) {
+            // Throw a runtime_error to be caught by the calling function
+            throw std::runtime_error("Error creating directory " + folder_path.string() + ": " + ec.message());
+        }
+    }
+}
+
+// How often an operation interrupted by a signal (EINTR) is retried before giving up.
+constexpr int kMaxInterruptRetries = 8;
+
+/**
+ * @brief Moves a file into place without clobbering, the way the engine does for every entry.
+ * Interrupted operations are retried. When the rename crosses filesystems (EXDEV) the file is
+ * copied and the source removed only once the copy is durable (see copy_no_clobber()); if the
+ * source cannot be removed the copy is rolled back, so the file always ends up in exactly one
+ * place.
+ * @param backend The filesystem backend to issue the operations through.
+ * @param from The file to move.
+ * @param to The destination path.
+ * @param ec Receives the error when Failed is returned.
+ */
+template <typename Backend>
+MoveStatus relocate_file(Backend& backend, const fs::path& from, const fs::path& to, std::error_code& ec) {
+    MoveStatus status = MoveStatus::Failed;
+    for (int attempt = 0; attempt <= kMaxInterruptRetries; ++attempt) {
+        status = backend.rename(from, to, ec);
+        if (status != MoveStatus::Failed || ec != std::errc::interrupted) {
+            break;
+        }
+    }
+    if (status != MoveStatus::Failed || ec != std::errc::cross_device_link) {
+        return status;
+    }
+
+    for (int attempt = 0; attempt <= kMaxInterruptRetries; ++attempt) {
+        status = backend.copy(from, to, ec);
+        if (status != MoveStatus::Failed || ec != std::errc::interrupted) {
+            break;
+        }
+    }
+    if (status != MoveStatus::Moved) {
+        return status;
+    }
+
+    for (int attempt = 0; attempt <= kMaxInterruptRetries; ++attempt) {
+        if (backend.remove(from, ec)) {
+            return MoveStatus::Moved;
+        }
+        if (ec != std::errc::interrupted) {
+            break;
+        }
+    }
+    // The source is still there (or we cannot tell): keep it and drop the copy instead.
+    FileStamp probe_stamp;
+    std::error_code probe;
+    if (!backend.stat(from, probe_stamp, probe) && probe == std::errc::no_such_file_or_directory) {
+        ec.clear();
+        return MoveStatus::Moved;
+    }
+    // Rolling back is what keeps the file from existing twice, so retry it on any error.
+    for (int attempt = 0; attempt <= kMaxInterruptRetries; ++attempt) {
+        std::error_code cleanup;
+        if (backend.remove(to, cleanup) || cleanup == std::errc::no_such_file_or_directory) {
+            return MoveStatus::Failed;
+        }
+    }
+    std::lock_guard<std::mutex> lock(g_console_mutex);
+    std::cerr << "Error: could not roll back copy '" << to.string() << "'; the file now exists twice." << std::endl;
+    return MoveStatus::Failed;
+}
+
+// Which of the current pool's workers the calling thread is; 0 for the thread that started it.
+thread_local unsigned t_worker_slot = 0;
+
+/**
+ * @brief Runs fn(i) for every i in [0, count) on up to `jobs` threads.
+ */
+template <typename Fn>
+void parallel_for(std::size_t count, unsigned jobs, Fn&& fn) {
+    if (jobs <= 1 || count < 2) {
+        for (std::size_t i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return;
+    }
+    std::atomic<std::size_t> next{0};
+    auto worker = [&](unsigned slot) {
+        t_worker_slot = slot;
+        for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+            fn(i);
+        }
+    };
+    std::vector<std::thread> pool;
+    unsigned workers = static_cast<unsigned>(std::min<std::size_t>(jobs, count));
+    for (unsigned t = 1; t < workers; ++t) {
+        pool.emplace_back(worker, t);
+    }
+    unsigned caller_slot = t_worker_slot;
+    worker(0);
+    t_worker_slot = caller_slot;
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
+
+/**
+ * @brief Byte and file counts for one directory or category.
+ */
+struct UsageTotals {
+    std::uint64_t bytes = 0;
+    std::uint64_t files = 0;
+};
+
+/**
+ * @brief du-style accounting gathered while scanning, so capacity reports need no second walk.
+ * Directory totals are for files directly inside each directory until finalize() rolls them
+ * up into their ancestors.
+ */
+struct DiskUsage {
+    std::unordered_map<std::string, UsageTotals> directories;
+    std::unordered_map<std::string, UsageTotals> categories;
+
+    void add(const fs::path& directory, const std::string& category, std::uint64_t bytes) {
+        UsageTotals& dir = directories[directory.string()];
+        dir.bytes += bytes;
+        ++dir.files;
+        UsageTotals& cat = categories[category];
+        cat.bytes += bytes;
+        ++cat.files;
+    }
+
+    void merge(const DiskUsage& other) {
+        for (const auto& [dir, totals] : other.directories) {
+            directories[dir].bytes += totals.bytes;
+            directories[dir].files += totals.files;
+        }
+        for (const auto& [cat, totals] : other.categories) {
+            categories[cat].bytes += totals.bytes;
+            categories[cat].files += totals.files;
+        }
+    }
+
+    /**
+     * @brief Adds every directory's totals into all of its ancestors up to `root`, deepest first.
+     */
+    void finalize(const fs::path& root) {
+        std::vector<std::pair<fs::path, UsageTotals>> dirs;
+        for (const auto& [dir, totals] : directories) {
+            dirs.emplace_back(fs::path(dir), totals);
+        }
+        directories.clear();
+        for (const auto& [dir, totals] : dirs) {
+            for (fs::path p = dir;; p = p.parent_path()) {
+                UsageTotals& t = directories[p.string()];
+                t.bytes += totals.bytes;
+                t.files += totals.files;
+                if (p == root || p == p.parent_path()) break;
+            }
+        }
+    }
+};
+
+/**
+ * @brief Formats a byte count with a binary unit suffix, e.g. "1.5 GiB".
+ */
+std::string format_bytes(std::uint64_t bytes) {
+    static const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB", "PiB"};
+    double value = static_cast<double>(bytes);
+    int unit = 0;
+    while (value >= 1024.0 && unit < 5) {
+        value /= 1024.0;
+        ++unit;
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+    return text;
+}
+
+/**
+ * @brief Prints categories and directories sorted by size, largest first.
+ */
+void print_disk_usage(std::ostream& out, const DiskUsage& usage) {
+    auto sorted = [](const std::unordered_map<std::string, UsageTotals>& map) {
+        std::vector<std::pair<std::string, UsageTotals>> rows(map.begin(), map.end());
+        std::sort(rows.begin(), rows.end(), [](const auto& x, const auto& y) {
+            return x.second.bytes != y.second.bytes ? x.second.bytes > y.second.bytes : x.first < y.first;
+        });
+        return rows;
+    };
+    out << "Usage by category:" << std::endl;
+    for (const auto& [name, totals] : sorted(usage.categories)) {
+        out << "  " << format_bytes(totals.bytes) << "\t" << totals.files << " files\t" << name << std::endl;
+    }
+    out << "Usage by directory (including subdirectories):" << std::endl;
+    for (const auto& [name, totals] : sorted(usage.directories)) {
+        out << "  " << format_bytes(totals.bytes) << "\t" << totals.files << " files\t" << name << std::endl;
+    }
+}
+
+/**
+ * @brief Controls how the scan walks the tree.
+ */
+struct ScanOptions {
+    bool recursive = false;      // also plan files found in subdirectories
+    unsigned jobs = 1;           // directories are scanned in parallel when recursive
+    DiskUsage* usage = nullptr;  // when set, also account every file the scan sees
+    std::vector<fs::path>* placed = nullptr; // when set, receives the destination of every file moved
+    std::istream* list = nullptr; // NUL-delimited paths for ListScanner
+    std::size_t series_threshold = 0; // group name series at least this long into subfolders (0: off)
+    unsigned stat_helpers = 0;   // threads that stat files ahead of the scanner (0: stat inline)
+    fs::path dest;               // where the category folders live (empty: the base path itself)
+};
+
+/**
+ * @brief The directory holding the category folders: `options.dest`, or else the base path.
+ */
+const fs::path& library_root(const fs::path& base_path, const ScanOptions& options) {
+    return options.dest.empty() ? base_path : options.dest;
+}
+
+/**
+ * @brief Tells whether a directory entry is the running executable.
+ * The scanned directories are canonical and symlinked directories are not followed, so only
+ * symlinks need resolving; everything else compares as-is, without a realpath per file.
+ */
+bool is_self(const fs::directory_entry& entry, const fs::path& self_path) {
+    std::error_code ec;
+    if (entry.is_symlink(ec)) {
+        // Use weakly_canonical to resolve paths for comparison
+        return fs::weakly_canonical(entry.path(), ec) == self_path;
+    }
+    return entry.path() == self_path;
+}
+
+// --- Compact scan tree: recursive scans of millions of files without a path per entry ---
+
+using PathView = std::basic_string_view<fs::path::value_type>;
+
+/**
+ * @brief The last component of a path, as a view into it (fs::path::filename() allocates).
+ */
+PathView leaf_name(const fs::path& path) {
+    PathView native = path.native();
+    return native.substr(native.find_last_of(fs::path::preferred_separator) + 1);
+}
+
+/**
+ * @brief Scanned files stored as a tree instead of as full paths. Directories refer to their
+ * parent; files hold a packed reference to their name in a string slab, their directory id,
+ * category and stat fields. Parent prefixes are stored once, and a full path only exists
+ * while a syscall needs it (see dir_path() and file_path()).
+ */
+class CompactTree {
+public:
+    static constexpr std::uint32_t kRoot = 0;
+
+    struct File {
+        std::uint64_t inode;
+        std::uint64_t size;
+        std::int64_t mtime_ns;
+        std::uint64_t name; // slab offset (40 bits) | length (16 bits) | category (8 bits)
+        std::uint32_t dir;
+    };
+
+    /**
+     * @brief Files found by one scan worker, merged into the tree with adopt().
+     */
+    struct FileList {
+        std::vector<File> files;
+        fs::path::string_type names;
+
+        void add(std::uint32_t dir, PathView name, CategoryId category, const FileStamp& stamp) {
+            files.push_back({stamp.inode, stamp.size, stamp.mtime_ns, pack(names, name, category), dir});
+        }
+    };
+
+    explicit CompactTree(fs::path root) : root_(std::move(root)) { dirs_.push_back({0, kRoot}); }
+
+    /**
+     * @brief Adds a directory below `parent` and returns its id. Not thread-safe.
+     */
+    std::uint32_t add_dir(std::uint32_t parent, PathView name) {
+        if (dirs_.size() >= UINT32_MAX) {
+            throw std::runtime_error("Too many directories for the scan tree");
+        }
+        dirs_.push_back({pack(dir_names_, name, kNoCategory), parent});
+        return static_cast<std::uint32_t>(dirs_.size() - 1);
+    }
+
+    /**
+     * @brief Moves a worker's files into the tree, rebasing their names onto the shared slab.
+     */
+    void adopt(FileList&& list) {
+        std::uint64_t shift = names_.size();
+        if (shift + list.names.size() >= kMaxOffset) {
+            throw std::runtime_error("Too many file names for the scan tree");
+        }
+        names_.append(list.names);
+        files_.reserve(files_.size() + list.files.size());
+        for (File& file : list.files) {
+            file.name += shift << kOffsetShift;
+            files_.push_back(file);
+        }
+        list = FileList();
+    }
+
+    const std::vector<File>& files() const { return files_; }
+    std::size_t dir_count() const { return dirs_.size(); }
+
+    PathView name(const File& file) const { return unpack(names_, file.name); }
+    CategoryId category(const File& file) const { return static_cast<CategoryId>(file.name & 0xFF); }
+    FileStamp stamp(const File& file) const { return FileStamp{file.inode, file.size, file.mtime_ns}; }
+
+    /**
+     * @brief Writes the full path of a directory into `out`, reusing its capacity.
+     */
+    void dir_path(std::uint32_t dir, fs::path::string_type& out) const {
+        if (dir == kRoot) {
+            out.assign(root_.native());
+            return;
+        }
+        dir_path(dirs_[dir].parent, out);
+        out += fs::path::preferred_separator;
+        out.append(unpack(dir_names_, dirs_[dir].name));
+    }
+
+    /**
+     * @brief Writes the full path of a file into `out`, reusing its capacity.
+     */
+    void file_path(const File& file, fs::path::string_type& out) const {
+        dir_path(file.dir, out);
+        out += fs::path::preferred_separator;
+        out.append(name(file));
+    }
+
+    /**
+     * @brief Expands the tree into plan entries heading for `base_path`'s category folders.
+     */
+    std::vector<PlanEntry> to_plan(const fs::path& base_path) const {
+        std::vector<PlanEntry> plan(files_.size());
+        fs::path::string_type scratch;
+        for (std::size_t i = 0; i < files_.size(); ++i) {
+            file_path(files_[i], scratch);
+            plan[i].source = scratch;
+            plan[i].destination = base_path / g_categories[category(files_[i])] / name(files_[i]);
+            plan[i].stamp = stamp(files_[i]);
+            plan[i].category = category(files_[i]);
+        }
+        return plan;
+    }
+
+    /**
+     * @brief Bytes held by the tree's arrays and slabs.
+     */
+    std::size_t memory_bytes() const {
+        return files_.capacity() * sizeof(File) + dirs_.capacity() * sizeof(Dir) +
+               (names_.capacity() + dir_names_.capacity()) * sizeof(fs::path::value_type);
+    }
+
+private:
+    struct Dir {
+        std::uint64_t name;
+        std::uint32_t parent;
+    };
+
+    static constexpr int kOffsetShift = 24;
+    static constexpr std::uint64_t kMaxOffset = 1ull << 40;
+
+    static std::uint64_t pack(fs::path::string_type& slab, PathView name, CategoryId category) {
+        if (name.size() > 0xFFFF) {
+            throw std::runtime_error("File name too long for the scan tree");
+        }
+        std::uint64_t packed = (static_cast<std::uint64_t>(slab.size()) << kOffsetShift) |
+                               (static_cast<std::uint64_t>(name.size()) << 8) | category;
+        slab.append(name);
+        return packed;
+    }
+
+    static PathView unpack(const fs::path::string_type& slab, std::uint64_t packed) {
+        return PathView(slab).substr(packed >> kOffsetShift, (packed >> 8) & 0xFFFF);
+    }
+
+    fs::path root_;
+    std::vector<Dir> dirs_;
+    std::vector<File> files_;
+    fs::path::string_type dir_names_;
+    fs::path::string_type names_;
+};
+
+// --- Stat prefetch: overlap the per-file stat with the rest of the scan ---
+
+/**
+ * @brief Stats a batch of files (typically one directory's) on a few helper threads while
+ * the scanner classifies them, so on a cold cache several inode reads are in flight at once
+ * and a file's metadata is usually ready by the time the scanner asks for it. The scanner
+ * takes results in order with get(); a file no helper has claimed yet is stat'ed right there,
+ * so the scanner never queues behind the helpers. With no helpers, get() is a plain stat.
+ * `files` must stay valid until the next start() or the prefetcher's destruction.
+ */
+template <typename Backend>
+class StatPrefetcher {
+public:
+    struct Result {
+        FileStamp stamp;
+        std::error_code ec;
+        bool ok = false;
+    };
+
+    StatPrefetcher(Backend& backend, unsigned helpers) : backend_(backend) {
+        for (unsigned t = 0; t < helpers; ++t) {
+            threads_.emplace_back([this] { help(); });
+        }
+    }
+
+    ~StatPrefetcher() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cursor_ = count_; // unclaimed files are not needed any more
+        cv_.wait(lock, [&] { return busy_ == 0; });
+        stopping_ = true;
+        lock.unlock();
+        cv_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void start(const fs::path* const* files, std::size_t count) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cursor_ = count_;
+        cv_.wait(lock, [&] { return busy_ == 0; });
+        files_ = files;
+        count_ = count;
+        results_.assign(count, Result());
+        if (states_size_ < count) {
+            states_ = std::make_unique<std::atomic<std::uint8_t>[]>(count);
+            states_size_ = count;
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            states_[i].store(kPending, std::memory_order_relaxed);
+        }
+        cursor_ = 0;
+        if (!threads_.empty()) {
+            busy_ = threads_.size();
+            ++generation_;
+            lock.unlock();
+            cv_.notify_all();
+        }
+    }
+
+    const Result& get(std::size_t i) {
+        std::uint8_t state = kPending;
+        if (states_[i].compare_exchange_strong(state, kClaimed)) {
+            stat(i);
+        } else if (state != kReady) {
+            waiting_ = i;
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [&] { return states_[i].load() == kReady; });
+            waiting_ = kNobody;
+        }
+        return results_[i];
+    }
+
+private:
+    static constexpr std::uint8_t kPending = 0, kClaimed = 1, kReady = 2;
+    static constexpr std::size_t kNobody = SIZE_MAX;
+
+    void stat(std::size_t i) {
+        Result& result = results_[i];
+        result.ok = backend_.stat(*files_[i], result.stamp, result.ec);
+        states_[i].store(kReady);
+        // Pairs with get(): either it sees the result is ready or we see it waiting.
+        if (waiting_ == i) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cv_.notify_all();
+        }
+    }
+
+    void help() {
+        std::uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+            if (stopping_) return;
+            seen = generation_;
+            lock.unlock();
+            for (std::size_t i; (i = cursor_.fetch_add(1)) < count_;) {
+                std::uint8_t state = kPending;
+                if (states_[i].compare_exchange_strong(state, kClaimed)) {
+                    stat(i);
+                }
+            }
+            lock.lock();
+            if (--busy_ == 0) cv_.notify_all();
+        }
+    }
+
+    Backend& backend_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    std::uint64_t generation_ = 0;
+    std::size_t busy_ = 0;             // helpers still working on the current batch
+    const fs::path* const* files_ = nullptr;
+    std::size_t count_ = 0;
+    std::vector<Result> results_;
+    std::unique_ptr<std::atomic<std::uint8_t>[]> states_;
+    std::size_t states_size_ = 0;
+    std::atomic<std::size_t> cursor_{0};
+    std::atomic<std::size_t> waiting_{kNobody};
+};
+
+// --- Latency histograms ---
+
+/**
+ * @brief HDR-style latency histogram: log-linear buckets with 2^kSubBits sub-buckets per power
+ * of two (about 3% relative precision), lock-free to record from any thread.
+ */
+class LatencyHistogram {
+public:
+    static constexpr int kSubBits = 5;
+    static constexpr std::uint64_t kSubCount = 1ull << kSubBits;
+    static constexpr std::size_t kBuckets = (64 - kSubBits + 1) * kSubCount;
+
+    void record(std::uint64_t value_ns) {
+        counts_[bucket_of(value_ns)].fetch_add(1, std::memory_order_relaxed);
+        total_.fetch_add(1, std::memory_order_relaxed);
+        std::uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value_ns > max && !max_.compare_exchange_weak(max, value_ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::uint64_t count() const { return total_.load(std::memory_order_relaxed); }
+    std::uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns an upper bound of the q-quantile (0..1) in nanoseconds.
+     */
+    std::uint64_t quantile(double q) const {
+        std::uint64_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        std::uint64_t rank = static_cast<std::uint64_t>(q * static_cast<double>(total - 1)) + 1;
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < kBuckets; ++i) {
+            seen += counts_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return std::min(upper_bound_of(i), max());
+            }
+        }
+        return max();
+    }
+
+private:
+    static std::size_t bucket_of(std::uint64_t v) {
+        if (v < kSubCount) {
+            return static_cast<std::size_t>(v);
+        }
+        int msb = 63;
+        while (!(v >> msb)) --msb;
+        int shift = msb - kSubBits;
+        return static_cast<std::size_t>((shift + 1) * kSubCount + ((v >> shift) & (kSubCount - 1)));
+    }
+
+    static std::uint64_t upper_bound_of(std::size_t bucket) {
+        if (bucket < kSubCount) {
+            return bucket;
+        }
+        int shift = static_cast<int>(bucket / kSubCount) - 1;
+        std::uint64_t base = (kSubCount | (bucket % kSubCount)) << shift;
+        return base + ((1ull << shift) - 1);
+    }
+
+    std::atomic<std::uint64_t> counts_[kBuckets] = {};
+    std::atomic<std::uint64_t> total_{0};
+    std::atomic<std::uint64_t> max_{0};
+};
+
+/**
+ * @brief Prints "name: n=..., p50=..., p99=..., p999=..., max=..." with millisecond values.
+ */
+void print_latency(std::ostream& out, std::string_view name, const LatencyHistogram& histogram) {
+    auto ms = [](std::uint64_t ns) { return static_cast<double>(ns) / 1e6; };
+    out << "  " << name << ": n=" << histogram.count() << ", p50=" << ms(histogram.quantile(0.5))
+        << " ms, p99=" << ms(histogram.quantile(0.99)) << " ms, p999=" << ms(histogram.quantile(0.999))
+        << " ms, max=" << ms(histogram.max()) << " ms" << std::endl;
+}
+
+// --- Live stats: what a running organize is doing, for `organize top` ---
+// The engine only bumps relaxed atomics in LiveCounters; a LivePublisher thread copies them into
+// a shared memory segment a few times a second, so watching a run costs it nothing more.
+
+enum class WorkerState : std::uint8_t { Idle, Scanning, Moving };
+
+/**
+ * @brief Counters kept while live stats are on. What is counted per file sits in each worker's
+ * own block, identified by t_worker_slot: a block has a single writer, so it is bumped with a
+ * plain load and store instead of a locked add, and LivePublisher sums the blocks. Threads
+ * past kMaxWorkers share the overflow block, which does use locked adds. Only one move in
+ * kLatencySample is timed, which keeps clock reads and the histogram out of most iterations.
+ */
+struct LiveCounters {
+    static constexpr unsigned kMaxWorkers = 64;
+    static constexpr unsigned kLatencySample = 64;
+
+    struct alignas(64) Worker {
+        std::atomic<WorkerState> state{WorkerState::Idle};
+        std::atomic<std::uint64_t> moved{0};
+        std::atomic<std::uint64_t> skipped{0};
+        std::atomic<std::uint64_t> failed{0};
+        std::atomic<std::uint64_t> bytes{0};
+        std::atomic<std::uint64_t> category_moved[256] = {};
+
+        void add(std::atomic<std::uint64_t>& counter, std::uint64_t n, bool shared) {
+            if (shared) {
+                counter.fetch_add(n, std::memory_order_relaxed);
+            } else {
+                counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    std::atomic<std::uint64_t> planned{0};
+    std::atomic<std::uint64_t> stale{0};
+    std::atomic<std::uint64_t> events{0};
+    std::atomic<std::uint64_t> dirs_scanned{0};
+    std::atomic<std::uint64_t> dirs_queued{0};
+    std::atomic<unsigned> worker_count{1};
+    Worker workers[kMaxWorkers];
+    Worker overflow;
+    LatencyHistogram move_latency;
+
+    void set_state(WorkerState state) {
+        unsigned slot = t_worker_slot % kMaxWorkers;
+        workers[slot].state.store(state, std::memory_order_relaxed);
+        unsigned count = worker_count.load(std::memory_order_relaxed);
+        while (slot >= count && !worker_count.compare_exchange_weak(count, slot + 1, std::memory_order_relaxed)) {
+        }
+    }
+
+    /**
+     * @brief Marks every worker idle once a pool has finished.
+     */
+    void set_idle() {
+        for (Worker& worker : workers) worker.state.store(WorkerState::Idle, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Marks the calling worker as moving; returns the move's start time if this move is
+     * one of the timed ones, else a zero time point.
+     */
+    std::chrono::steady_clock::time_point move_started() {
+        if (t_worker_slot >= kMaxWorkers ||
+            workers[t_worker_slot].state.load(std::memory_order_relaxed) != WorkerState::Moving) {
+            set_state(WorkerState::Moving);
+        }
+        thread_local unsigned until_sample = 0;
+        if (until_sample-- != 0) return {};
+        until_sample = kLatencySample - 1;
+        return std::chrono::steady_clock::now();
+    }
+
+    void record(MoveStatus status, CategoryId category, std::uint64_t size,
+                std::chrono::steady_clock::time_point started) {
+        if (started != std::chrono::steady_clock::time_point()) {
+            auto elapsed = std::chrono::steady_clock::now() - started;
+            move_latency.record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        }
+        bool shared = t_worker_slot >= kMaxWorkers;
+        Worker& worker = shared ? overflow : workers[t_worker_slot];
+        switch (status) {
+        case MoveStatus::Moved:
+            worker.add(worker.moved, 1, shared);
+            worker.add(worker.bytes, size, shared);
+            if (category != kNoCategory) worker.add(worker.category_moved[category], 1, shared);
+            break;
+        case MoveStatus::Exists:
+            worker.add(worker.skipped, 1, shared);
+            break;
+        case MoveStatus::Failed:
+            worker.add(worker.failed, 1, shared);
+            break;
+        }
+    }
+};
+
+// Counters of the running organize while live stats are published; null when they are not.
+// The engine gets them through LiveInstrumentation instead; this is for the other loops.
+LiveCounters* g_live = nullptr;
+
+/**
+ * @brief LiveCounters::move_started(), if live stats are on.
+ */
+inline std::chrono::steady_clock::time_point live_move_started() {
+    return g_live ? g_live->move_started() : std::chrono::steady_clock::time_point();
+}
+
+inline void live_move_done(MoveStatus status, CategoryId category, std::uint64_t size,
+                           std::chrono::steady_clock::time_point started) {
+    if (g_live) g_live->record(status, category, size, started);
+}
+
+// --- Engine policies ---
+// The engine is assembled from compile-time policies (scanner, classifier, conflict policy,
+// mover and instrumentation), so the default "move by extension" loop carries no checks for
+// features that are switched off. main() picks one pre-instantiated specialization per run.
+
+/**
+ * @brief File names packed back to back for classify_names(): name i is
+ * text[offsets[i], offsets[i + 1]).
+ */
+struct NameBatch {
+    std::string text;
+    std::vector<std::uint32_t> offsets{0};
+
+    void clear() {
+        text.clear();
+        offsets.assign(1, 0);
+    }
+
+    void add(const fs::path& file) {
+#ifdef _WIN32
+        text += file.filename().string();
+#else
+        text.append(leaf_name(file));
+#endif
+        offsets.push_back(static_cast<std::uint32_t>(text.size()));
+    }
+
+    std::size_t size() const { return offsets.size() - 1; }
+};
+
+/**
+ * @brief Classifier policy: category folder by file extension, "" for files to leave alone.
+ * With a MIME database loaded, files whose extension is missing or unknown are sniffed against
+ * its magic rules before falling back to Others (or to being left alone).
+ */
+struct ExtensionClassifier {
+    static std::string classify(const fs::path& file) {
+        std::string ext = file.extension().string();
+        CategoryId id = g_extension_table.find(ext);
+        if (id == kNoCategory && !g_magic_table.empty()) {
+            id = classify_magic(file);
+        }
+        if (id != kNoCategory) return g_categories[id];
+        return ext.empty() ? std::string() : g_categories[g_others_id];
+    }
+
+    /**
+     * @brief Classifies `count` files at once into category ids, kNoCategory for files to
+     * leave alone. Same answers as classify(), without a string per file.
+     */
+    static void classify_batch(const fs::path* const* files, std::size_t count, CategoryId* out) {
+        thread_local NameBatch names;
+        names.clear();
+        for (std::size_t i = 0; i < count; ++i) {
+            names.add(*files[i]);
+        }
+        classify_names(names.text.data(), names.offsets.data(), count, out);
+        for (std::size_t i = 0; i < count; ++i) {
+            if (out[i] < kUnknownExtension) continue;
+            CategoryId sniffed = g_magic_table.empty() ? kNoCategory : classify_magic(*files[i]);
+            if (sniffed != kNoCategory) {
+                out[i] = sniffed;
+            } else if (out[i] == kUnknownExtension) {
+                out[i] = g_others_id;
+            }
+        }
+    }
+};
+
+/**
+ * @brief Conflict policy: never replace an existing file; the entry is skipped instead.
+ */
+struct SkipExisting {
+    template <typename Mover>
+    static MoveStatus place(Mover& mover, const fs::path& from, const fs::path& to, std::error_code& ec) {
+        return relocate_file(mover, from, to, ec);
+    }
+};
+
+/**
+ * @brief How often each file name collided with an existing destination, across runs: a
+ * count-min sketch (kDepth rows of kWidth counters, any name's estimate is the minimum of
+ * its cells) plus the kHeavy names with the highest estimates seen so far. Estimates never
+ * undercount, and overcount by at most about total() / kWidth: one spurious collision per
+ * 2048 recorded, far below the count of a name that collides on every run. 32 KiB on disk
+ * (--conflict-stats) however many names there are; thread-safe.
+ */
+class ConflictSketch {
+public:
+    static constexpr std::size_t kDepth = 4;
+    static constexpr std::size_t kWidth = 2048;
+    static constexpr std::size_t kHeavy = 32;
+
+    struct Heavy {
+        std::string name;
+        std::uint32_t count;
+    };
+
+    ConflictSketch() : counters_(kDepth * kWidth, 0) {}
+
+    /**
+     * @brief Reads the sketch saved by save(); a missing file leaves it empty.
+     * @throws std::runtime_error if the file is not a conflict statistics file.
+     */
+    void load(const fs::path& file) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) return;
+        auto corrupt = [&]() { return std::runtime_error("Corrupt conflict statistics: '" + file.string() + "'"); };
+        auto read = [&](int bytes) {
+            unsigned char buffer[8];
+            if (!in.read(reinterpret_cast<char*>(buffer), bytes)) throw corrupt();
+            std::uint64_t value = 0;
+            for (int i = bytes - 1; i >= 0; --i) value = (value << 8) | buffer[i];
+            return value;
+        };
+        char magic[sizeof(kMagic) - 1];
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(magic)) != 0) throw corrupt();
+        runs_ = read(8);
+        total_ = read(8);
+        for (std::uint32_t& counter : counters_) counter = static_cast<std::uint32_t>(read(4));
+        std::uint64_t heavy = read(4);
+        if (heavy > kHeavy) throw corrupt();
+        heavy_.resize(static_cast<std::size_t>(heavy));
+        for (Heavy& entry : heavy_) {
+            entry.count = static_cast<std::uint32_t>(read(4));
+            entry.name.resize(static_cast<std::size_t>(read(2)));
+            if (!in.read(entry.name.data(), static_cast<std::streamsize>(entry.name.size()))) throw corrupt();
+        }
+    }
+
+    /**
+     * @brief Writes the sketch through a temporary file, so a crash keeps the previous one.
+     */
+    void save(const fs::path& file) const {
+        std::string out(kMagic, sizeof(kMagic) - 1);
+        auto write = [&](std::uint64_t value, int bytes) {
+            for (int i = 0; i < bytes; ++i) out += static_cast<char>((value >> (8 * i)) & 0xFF);
+        };
+        write(runs_, 8);
+        write(total_, 8);
+        for (std::uint32_t counter : counters_) write(counter, 4);
+        write(heavy_.size(), 4);
+        for (const Heavy& entry : heavy_) {
+            write(entry.count, 4);
+            write(entry.name.size(), 2);
+            out += entry.name;
+        }
+        fs::path temp = file;
+        temp += ".tmp";
+        {
+            std::ofstream stream(temp, std::ios::binary | std::ios::trunc);
+            if (!stream.write(out.data(), static_cast<std::streamsize>(out.size())) || !stream.flush()) {
+                throw std::runtime_error("Cannot write conflict statistics: '" + temp.string() + "'");
+            }
+        }
+        fs::rename(temp, file);
+    }
+
+    void begin_run() { ++runs_; }
+
+    /**
+     * @brief Counts one conflict of `name`. Only the cells at the current minimum are raised
+     * (conservative update), so names sharing a cell inflate each other as little as possible.
+     * @return The name's estimated conflict count, this one included.
+     */
+    std::uint32_t add(std::string_view name) {
+        std::size_t cells[kDepth];
+        locate(name, cells);
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::uint32_t estimate = UINT32_MAX;
+        for (std::size_t cell : cells) estimate = std::min(estimate, counters_[cell]);
+        if (estimate < UINT32_MAX) ++estimate;
+        for (std::size_t cell : cells) counters_[cell] = std::max(counters_[cell], estimate);
+        ++total_;
+        ++this_run_;
+        track(name, estimate);
+        return estimate;
+    }
+
+    std::uint32_t estimate(std::string_view name) const {
+        std::size_t cells[kDepth];
+        locate(name, cells);
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::uint32_t estimate = UINT32_MAX;
+        for (std::size_t cell : cells) estimate = std::min(estimate, counters_[cell]);
+        return estimate;
+    }
+
+    void note_renamed() { ++renamed_; }
+
+    /**
+     * @brief The tracked names, most frequent first.
+     */
+    std::vector<Heavy> heavy() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Heavy> sorted = heavy_;
+        std::sort(sorted.begin(), sorted.end(), [](const Heavy& a, const Heavy& b) {
+            return a.count != b.count ? a.count > b.count : a.name < b.name;
+        });
+        return sorted;
+    }
+
+    std::uint64_t runs() const { return runs_; }
+    std::uint64_t total() const { return total_; }
+    std::uint64_t this_run() const { return this_run_; }
+    std::uint64_t renamed() const { return renamed_.load(); }
+
+private:
+    static constexpr char kMagic[] = "ORGCMS01";
+
+    static void locate(std::string_view name, std::size_t (&cells)[kDepth]) {
+        std::uint64_t h = 14695981039346656037ull; // FNV-1a
+        for (unsigned char c : name) h = (h ^ c) * 1099511628211ull;
+        // Each row remixes the name's hash with its own seed, so names that share a cell in
+        // one row are unlikely to share one in the others.
+        for (std::size_t row = 0; row < kDepth; ++row) {
+            std::uint64_t x = h + (row + 1) * 0x9E3779B97F4A7C15ull; // splitmix64 finalizer
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+            cells[row] = row * kWidth + (x ^ (x >> 31)) % kWidth;
+        }
+    }
+
+    // Keeps the kHeavy names with the highest estimates; the caller holds the lock.
+    void track(std::string_view name, std::uint32_t estimate) {
+        auto it = std::find_if(heavy_.begin(), heavy_.end(), [&](const Heavy& entry) { return entry.name == name; });
+        if (it != heavy_.end()) {
+            it->count = estimate;
+            return;
+        }
+        if (name.size() > 0xFFFF) return;
+        if (heavy_.size() < kHeavy) {
+            heavy_.push_back({std::string(name), estimate});
+            return;
+        }
+        auto lowest = std::min_element(heavy_.begin(), heavy_.end(),
+                                       [](const Heavy& a, const Heavy& b) { return a.count < b.count; });
+        if (lowest->count < estimate) *lowest = {std::string(name), estimate};
+    }
+
+    std::vector<std::uint32_t> counters_;
+    std::vector<Heavy> heavy_;
+    std::uint64_t runs_ = 0;
+    std::uint64_t total_ = 0;
+    std::uint64_t this_run_ = 0;
+    std::atomic<std::uint64_t> renamed_{0};
+    mutable std::mutex mutex_;
+};
+
+// Conflict counts kept across runs (--conflict-stats); null when they are not kept.
+ConflictSketch* g_conflict_sketch = nullptr;
+// Names with at least this many recorded conflicts are moved under a numbered name instead
+// of being skipped (--suffix-hot); 0 never renames.
+std::uint32_t g_suffix_hot = 0;
+
+/**
+ * @brief Conflict policy: like SkipExisting, but every collision is counted in
+ * g_conflict_sketch, and names that keep colliding (g_suffix_hot) are moved in as
+ * "name (2).ext", "name (3).ext", ... so they stop piling up in the folder being organized.
+ */
+struct SuffixHotNames {
+    static constexpr int kMaxSuffix = 1000;
+
+    template <typename Mover>
+    static MoveStatus place(Mover& mover, const fs::path& from, const fs::path& to, std::error_code& ec) {
+        MoveStatus status = relocate_file(mover, from, to, ec);
+        if (status != MoveStatus::Exists || !g_conflict_sketch) {
+            return status;
+        }
+        std::uint32_t conflicts = g_conflict_sketch->add(to.filename().string());
+        if (g_suffix_hot == 0 || conflicts < g_suffix_hot) {
+            return status;
+        }
+        std::string stem = to.stem().string();
+        std::string ext = to.extension().string();
+        for (int n = 2; n <= kMaxSuffix && status == MoveStatus::Exists; ++n) {
+            status = relocate_file(mover, from, to.parent_path() / (stem + " (" + std::to_string(n) + ")" + ext), ec);
+        }
+        if (status == MoveStatus::Moved) {
+            g_conflict_sketch->note_renamed();
+        }
+        return status;
+    }
+};
+
+/**
+ * @brief Prints the conflict totals and the names that collide most often.
+ */
+void print_conflict_stats(std::ostream& out, const ConflictSketch& sketch, std::size_t top = 10) {
+    out << "Conflicts: " << sketch.this_run() << " this run";
+    if (sketch.renamed() > 0) out << " (" << sketch.renamed() << " renamed)";
+    out << ", " << sketch.total() << " in " << sketch.runs() << " runs." << std::endl;
+    std::vector<ConflictSketch::Heavy> heavy = sketch.heavy();
+    std::size_t shown = 0;
+    for (const ConflictSketch::Heavy& entry : heavy) {
+        if (shown == top || entry.count < 2) break;
+        if (shown++ == 0) out << "Most frequent conflicts:" << std::endl;
+        out << "  " << entry.name << ": ~" << entry.count << std::endl;
+    }
+}
+
+/**
+ * @brief Instrumentation policy that records nothing.
+ */
+struct NoInstrumentation {
+    static constexpr bool kEnabled = false;
+    static constexpr bool kLive = false;
+    void prepare(std::size_t) {}
+    void record(std::size_t, MoveStatus) {}
+};
+
+/**
+ * @brief Instrumentation policy that keeps each entry's outcome, for disk usage accounting.
+ */
+struct OutcomeInstrumentation {
+    static constexpr bool kEnabled = true;
+    static constexpr bool kLive = false;
+    std::vector<MoveStatus> outcomes;
+    void prepare(std::size_t count) { outcomes.assign(count, MoveStatus::Failed); }
+    void record(std::size_t i, MoveStatus status) { outcomes[i] = status; }
+};
+
+/**
+ * @brief Instrumentation policy that adds live stats for `organize top` to what `Inner`
+ * records. Runs without them use `Inner` alone, so their loop has no live-stats checks.
+ */
+template <typename Inner>
+struct LiveInstrumentation : Inner {
+    static constexpr bool kLive = true;
+    LiveCounters& live;
+    explicit LiveInstrumentation(LiveCounters& counters) : live(counters) {}
+};
+
+/**
+ * @brief Scanner policy: lists the base directory only, on the calling thread.
+ */
+struct FlatScanner {
+    static constexpr bool kCompact = false;
+
+    template <typename Classifier, typename Backend>
+    static std::vector<PlanEntry> scan(Backend& backend, const fs::path& base_path, const fs::path& self_path,
+                                       const ScanOptions& options) {
+        std::vector<PlanEntry> plan;
+        std::vector<fs::directory_entry> entries;
+        std::error_code ec;
+        if (g_live) g_live->set_state(WorkerState::Scanning);
+        if (!backend.list_directory(base_path, entries, ec)) {
+            throw fs::filesystem_error("cannot list directory", base_path, ec);
+        }
+        if (g_live) ++g_live->dirs_scanned;
+        std::vector<const fs::path*> files;
+        files.reserve(entries.size());
+        for (const auto& entry : entries) {
+            // We only want to move files, not directories or the program itself
+            if (entry.is_regular_file(ec) && !is_self(entry, self_path)) {
+                files.push_back(&entry.path());
+            }
+        }
+        StatPrefetcher<Backend> prefetch(backend, options.stat_helpers);
+        prefetch.start(files.data(), files.size());
+        std::vector<CategoryId> categories(files.size());
+        Classifier::classify_batch(files.data(), files.size(), categories.data());
+
+        const fs::path& root = library_root(base_path, options);
+        plan.reserve(files.size());
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            // Skip files with no extension
+            if (categories[i] == kNoCategory) {
+                continue;
+            }
+            const fs::path& item_path = *files[i];
+            const auto& stat = prefetch.get(i);
+            if (!stat.ok) {
+                continue;
+            }
+            PlanEntry planned;
+            planned.stamp = stat.stamp;
+            planned.source = item_path;
+            planned.destination = root / g_categories[categories[i]] / item_path.filename();
+            planned.category = categories[i];
+            plan.push_back(std::move(planned));
+        }
+        return plan;
+    }
+};
+
+/**
+ * @brief Scanner policy: walks directories from a shared work queue on several threads.
+ * In recursive mode, subdirectories other than the category folders are walked as well and
+ * their files planned into the base path's categories. When disk usage is requested, the
+ * category folders are walked too (for accounting only). The walk fills a CompactTree: the
+ * directory table is shared (ids are handed out under the queue lock), while each worker
+ * collects files and usage on its own and merges them once the walk is done. Planned files
+ * are not accounted here, since where they end up depends on the outcome of the move. A
+ * subdirectory that cannot be listed is reported and left out, and the walk goes on; only
+ * an unreadable base path fails the scan.
+ */
+struct TreeScanner {
+    static constexpr bool kCompact = true;
+
+    template <typename Classifier, typename Backend>
+    static CompactTree scan_tree(Backend& backend, const fs::path& base_path, const fs::path& self_path,
+                                 const ScanOptions& options) {
+        struct Pending {
+            fs::path dir;
+            std::uint32_t id;
+            bool plan_files;   // false below the category folders, which are only accounted
+            std::string category;
+        };
+        CompactTree tree(base_path);
+        std::vector<Pending> queue{{base_path, CompactTree::kRoot, true, std::string()}};
+        std::size_t active = 0;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::exception_ptr failure;
+        std::size_t unlisted = 0;
+        unsigned workers = (options.recursive || options.usage) ? std::max(1u, options.jobs) : 1u;
+        // Each worker prefetches its own directories; together they use about stat_helpers threads.
+        unsigned helpers = (options.stat_helpers + workers - 1) / workers;
+
+        auto worker = [&](unsigned slot) {
+            t_worker_slot = slot;
+            CompactTree::FileList local_files;
+            DiskUsage local_usage;
+            std::vector<fs::directory_entry> entries;
+            std::vector<const fs::path*> files;
+            std::vector<CategoryId> categories;
+            StatPrefetcher<Backend> prefetch(backend, helpers);
+            std::error_code ec;
+            while (true) {
+                Pending job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&] { return !queue.empty() || active == 0 || failure; });
+                    if (queue.empty() || failure) break;
+                    job = std::move(queue.back());
+                    queue.pop_back();
+                    ++active;
+                    if (g_live) {
+                        g_live->dirs_queued.store(queue.size(), std::memory_order_relaxed);
+                        g_live->set_state(WorkerState::Scanning);
+                    }
+                }
+
+                std::vector<Pending> subdirs;
+                bool listed = true;
+                try {
+                    listed = backend.list_directory(job.dir, entries, ec);
+                    if (!listed && job.dir == base_path) {
+                        throw fs::filesystem_error("cannot list directory", job.dir, ec);
+                    }
+                    if (!listed) {
+                        std::lock_guard<std::mutex> lock(g_console_mutex);
+                        std::cerr << "Error listing '" << job.dir.string() << "': " << ec.message()
+                                  << "; leaving its files where they are." << std::endl;
+                        entries.clear();
+                    }
+                    files.clear();
+                    for (const auto& entry : entries) {
+                        const fs::path& item_path = entry.path();
+                        if (entry.is_directory(ec) && !entry.is_symlink(ec)) {
+                            if (item_path == options.dest) {
+                                continue;  // a destination root inside the base path is not scanned
+                            }
+                            bool is_category = job.dir == base_path && FOLDER_MAP.count(item_path.filename().string());
+                            if (is_category && options.usage) {
+                                subdirs.push_back({item_path, 0, false, item_path.filename().string()});
+                            } else if (!is_category && (options.recursive || options.usage)) {
+                                subdirs.push_back({item_path, 0, job.plan_files && options.recursive, job.category});
+                            }
+                            continue;
+                        }
+                        // We only want to move files, not directories or the program itself
+                        if (entry.is_regular_file(ec) && !is_self(entry, self_path)) {
+                            files.push_back(&item_path);
+                        }
+                    }
+                    prefetch.start(files.data(), files.size());
+                    categories.resize(files.size());
+                    Classifier::classify_batch(files.data(), files.size(), categories.data());
+
+                    for (std::size_t i = 0; i < files.size(); ++i) {
+                        const fs::path& item_path = *files[i];
+                        CategoryId category = categories[i];
+                        // Files the classifier leaves alone (no extension) stay where they are
+                        if (job.plan_files && category != kNoCategory) {
+                            const auto& stat = prefetch.get(i);
+                            if (!stat.ok) {
+                                continue;
+                            }
+                            local_files.add(job.id, leaf_name(item_path), category, stat.stamp);
+                        } else if (options.usage) {
+                            const auto& stat = prefetch.get(i);
+                            if (stat.ok) {
+                                local_usage.add(job.dir, !job.category.empty() ? job.category
+                                                : g_categories[category == kNoCategory ? g_others_id : category],
+                                                stat.stamp.size);
+                            }
+                        }
+                    }
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!failure) failure = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                --active;
+                if (!listed) ++unlisted;
+                for (auto& sub : subdirs) {
+                    // Only planned directories need a place in the tree.
+                    if (sub.plan_files) {
+                        sub.id = tree.add_dir(job.id, leaf_name(sub.dir));
+                    }
+                    queue.push_back(std::move(sub));
+                }
+                if (g_live) {
+                    g_live->dirs_queued.store(queue.size(), std::memory_order_relaxed);
+                    ++g_live->dirs_scanned;
+                    g_live->set_state(WorkerState::Idle);
+                }
+                cv.notify_all();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            tree.adopt(std::move(local_files));
+            if (options.usage) {
+                options.usage->merge(local_usage);
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < workers; ++t) {
+            pool.emplace_back(worker, t);
+        }
+        worker(0);
+        for (auto& thread : pool) {
+            thread.join();
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+        if (unlisted > 0) {
+            std::lock_guard<std::mutex> lock(g_console_mutex);
+            std::cerr << "Could not list " << unlisted << (unlisted == 1 ? " directory" : " directories")
+                      << "; the rest of '" << base_path.string() << "' was scanned." << std::endl;
+        }
+        return tree;
+    }
+
+    template <typename Classifier, typename Backend>
+    static std::vector<PlanEntry> scan(Backend& backend, const fs::path& base_path, const fs::path& self_path,
+                                       const ScanOptions& options) {
+        return scan_tree<Classifier>(backend, base_path, self_path, options).to_plan(library_root(base_path, options));
+    }
+};
+
+/**
+ * @brief Scanner policy: plans exactly the files named in a NUL-delimited list instead of
+ * reading the directory, so the work is proportional to the list.
+ * Relative paths are taken relative to the base path. Entries outside the base path, inside a
+ * category folder, repeated, not regular files, or the program itself are skipped.
+ */
+struct ListScanner {
+    static constexpr bool kCompact = false;
+
+    template <typename Classifier, typename Backend>
+    static std::vector<PlanEntry> scan(Backend& backend, const fs::path& base_path, const fs::path& self_path,
+                                       const ScanOptions& options) {
+        std::vector<PlanEntry> plan;
+        if (!options.list) {
+            return plan;
+        }
+        std::unordered_map<std::string, bool> seen;
+        std::string item;
+        std::error_code ec;
+
+        // Listed files are classified kListBatch at a time.
+        constexpr std::size_t kListBatch = 4096;
+        std::vector<std::string> items;
+        std::vector<fs::path> paths;
+        std::vector<const fs::path*> files;
+        std::vector<CategoryId> categories;
+        StatPrefetcher<Backend> prefetch(backend, options.stat_helpers);
+        const fs::path& root = library_root(base_path, options);
+        if (g_live) g_live->set_state(WorkerState::Scanning);
+        auto flush = [&]() {
+            files.clear();
+            for (const fs::path& path : paths) {
+                files.push_back(&path);
+            }
+            prefetch.start(files.data(), files.size());
+            categories.resize(files.size());
+            Classifier::classify_batch(files.data(), files.size(), categories.data());
+            for (std::size_t i = 0; i < paths.size(); ++i) {
+                // Skip files with no extension
+                if (categories[i] == kNoCategory) {
+                    continue;
+                }
+                const auto& stat = prefetch.get(i);
+                if (!stat.ok) {
+                    if (!g_quiet && stat.ec != std::errc::is_a_directory) {
+                        std::cerr << "Skipping '" << items[i] << "': " << stat.ec.message() << std::endl;
+                    }
+                    continue;
+                }
+                PlanEntry planned;
+                planned.stamp = stat.stamp;
+                planned.source = std::move(paths[i]);
+                planned.destination = root / g_categories[categories[i]] / planned.source.filename();
+                planned.category = categories[i];
+                plan.push_back(std::move(planned));
+            }
+            items.clear();
+            paths.clear();
+        };
+
+        while (std::getline(*options.list, item, '\0')) {
+            if (item.empty()) {
+                continue;
+            }
+            fs::path item_path = fs::path(item);
+            if (item_path.is_relative()) {
+                item_path = base_path / item_path;
+            }
+            item_path = item_path.lexically_normal();
+            fs::path relative = item_path.lexically_relative(base_path);
+            if (relative.empty() || *relative.begin() == ".." || *relative.begin() == ".") {
+                if (!g_quiet) {
+                    std::cerr << "Skipping '" << item << "': not inside '" << base_path.string() << "'." << std::endl;
+                }
+                continue;
+            }
+            auto first = relative.begin();
+            if (std::next(first) != relative.end() && FOLDER_MAP.count(first->string())) {
+                continue;  // already organized
+            }
+            if (!options.dest.empty()) {
+                fs::path in_dest = item_path.lexically_relative(options.dest);
+                if (!in_dest.empty() && *in_dest.begin() != "..") {
+                    continue;  // inside a destination root below the base path
+                }
+            }
+            if (!seen.emplace(item_path.string(), true).second) {
+                continue;
+            }
+            // Use weakly_canonical to resolve paths for comparison
+            if (fs::weakly_canonical(item_path, ec) == self_path) {
+                continue;
+            }
+            items.push_back(item);
+            paths.push_back(std::move(item_path));
+            if (paths.size() == kListBatch) {
+                flush();
+            }
+        }
+        flush();
+        return plan;
+    }
+};
+
+/**
+ * @brief Returns the category folder name a plan entry is headed for.
+ */
+std::string plan_category(const fs::path& base_path, const PlanEntry& planned) {
+    fs::path folder = planned.destination.parent_path();
+    if (folder.parent_path() != base_path) {
+        folder = folder.parent_path(); // grouped into a series subfolder
+    }
+    return folder.filename().string();
+}
+
+/**
+ * @brief Tells whether a plan entry starts out in a category folder, as the series members
+ * seed_series() adds do. Those are library content, which only the scan accounts.
+ */
+bool starts_in_library(const fs::path& base_path, const PlanEntry& planned) {
+    return planned.source.parent_path().parent_path() == base_path;
+}
+
+/**
+ * @brief Adds the files of an executed plan to a usage report: moved files at their
+ * destination, everything else where it stayed.
+ */
+void account_plan(DiskUsage& usage, const fs::path& base_path, const std::vector<PlanEntry>& plan,
+                  const std::vector<MoveStatus>& outcomes) {
+    for (std::size_t i = 0; i < plan.size(); ++i) {
+        const PlanEntry& planned = plan[i];
+        if (starts_in_library(base_path, planned)) continue;
+        const fs::path& where = outcomes[i] == MoveStatus::Moved ? planned.destination : planned.source;
+        usage.add(where.parent_path(), plan_category(base_path, planned), planned.stamp.size);
+    }
+}
+
+/**
+ * @brief account_plan() for a plan kept as a scan tree.
+ */
+void account_tree(DiskUsage& usage, const fs::path& base_path, const CompactTree& tree,
+                  const std::vector<MoveStatus>& outcomes) {
+    fs::path::string_type dir;
+    for (std::size_t i = 0; i < tree.files().size(); ++i) {
+        const CompactTree::File& file = tree.files()[i];
+        const std::string& category = g_categories[tree.category(file)];
+        if (outcomes[i] == MoveStatus::Moved) {
+            usage.add(base_path / category, category, file.size);
+        } else {
+            tree.dir_path(file.dir, dir);
+            usage.add(fs::path(dir), category, file.size);
+        }
+    }
+}
+
+// --- Name series: group runs such as IMG_2024_0001..IMG_2024_0950 into subfolders ---
+
+/**
+ * @brief Returns the series a file name belongs to: its stem without a trailing number and the
+ * separators before it ("IMG_2024_0001.jpg" -> "IMG_2024", "report_v7.pdf" -> "report",
+ * "scan (12).png" -> "scan"), or an empty view if the stem does not end in a number.
+ */
+PathView series_key(PathView name) {
+    auto is_digit = [](fs::path::value_type c) { return c >= '0' && c <= '9'; };
+    auto is_separator = [](fs::path::value_type c) { return c == '_' || c == '-' || c == ' ' || c == '.' || c == '('; };
+
+    std::size_t dot = name.find_last_of('.');
+    PathView stem = dot == PathView::npos || dot == 0 ? name : name.substr(0, dot);
+    if (!stem.empty() && stem.back() == ')') stem.remove_suffix(1);
+    std::size_t end = stem.size();
+    while (end > 0 && is_digit(stem[end - 1])) --end;
+    if (end == stem.size()) return PathView();
+    while (end > 0 && is_separator(stem[end - 1])) --end;
+    // A version marker: "report_v7", "draft-V2".
+    if (end > 1 && (stem[end - 1] == 'v' || stem[end - 1] == 'V') && is_separator(stem[end - 2])) {
+        --end;
+        while (end > 0 && is_separator(stem[end - 1])) --end;
+    }
+    return stem.substr(0, end);
+}
+
+/**
+ * @brief What the destination folders of a plan already hold, for group_series(): the plan
+ * entries from `first` on are files already in place (source == destination), and `folders`
+ * are the subfolders already there, which may be series folders of earlier runs.
+ */
+struct SeriesSeed {
+    std::size_t first = 0;
+    std::unordered_map<fs::path::string_type, bool> folders;
+};
+
+/**
+ * @brief Moves every name series with at least `threshold` members in one category into a
+ * subfolder named after the series. Entries are sorted by (folder, series, name) so each
+ * series is one contiguous run, found in a single linear pass: O(n log n) overall.
+ * With a seed, files already in the folder count as members and move along with the series,
+ * and a series whose subfolder already exists takes its new members at any count. Seeded
+ * files that stay where they are are dropped from the plan.
+ * @return The number of series folders the plan now targets.
+ */
+std::size_t group_series(std::vector<PlanEntry>& plan, std::size_t threshold, const SeriesSeed* seed = nullptr) {
+    struct Item {
+        std::uint32_t folder;   // interned destination folder
+        std::uint64_t prefix;   // first key characters packed big-endian, so most comparisons stay in the array
+        PathView key;
+        std::size_t index;
+    };
+    std::vector<PathView> folders;
+    std::unordered_map<PathView, std::uint32_t> folder_ids;
+    std::vector<Item> items;
+    items.reserve(plan.size());
+    for (std::size_t i = 0; i < plan.size(); ++i) {
+        PathView destination = plan[i].destination.native();
+        std::size_t slash = destination.find_last_of(fs::path::preferred_separator);
+        if (slash == PathView::npos) continue;
+        PathView key = series_key(destination.substr(slash + 1));
+        if (key.empty()) continue;
+        auto [it, inserted] = folder_ids.emplace(destination.substr(0, slash), static_cast<std::uint32_t>(folders.size()));
+        if (inserted) folders.push_back(it->first);
+        std::uint64_t prefix = 0;
+        for (std::size_t k = 0; k < 8; ++k) {
+            prefix = (prefix << 8) | (k < key.size() ? static_cast<std::uint8_t>(key[k]) : 0);
+        }
+        items.push_back({it->second, prefix, key, i});
+    }
+    std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+        if (a.folder != b.folder) return a.folder < b.folder;
+        if (a.prefix != b.prefix) return a.prefix < b.prefix;
+        return a.key < b.key;
+    });
+
+    // Rewriting a destination would invalidate the views into it, so build the new paths first.
+    std::size_t series = 0;
+    std::vector<std::pair<std::size_t, fs::path::string_type>> rewrites;
+    fs::path::string_type existing;
+    for (std::size_t begin = 0, end; begin < items.size(); begin = end) {
+        end = begin + 1;
+        while (end < items.size() && items[end].folder == items[begin].folder && items[end].key == items[begin].key) {
+            ++end;
+        }
+        if (end - begin < threshold) {
+            if (!seed) continue;
+            existing.assign(folders[items[begin].folder]).append(1, fs::path::preferred_separator).append(items[begin].key);
+            if (!seed->folders.count(existing)) continue;
+        }
+        ++series;
+        for (std::size_t k = begin; k < end; ++k) {
+            PathView destination = plan[items[k].index].destination.native();
+            PathView folder = folders[items[k].folder];
+            fs::path::string_type path;
+            path.reserve(destination.size() + items[k].key.size() + 1);
+            path.append(folder).append(1, fs::path::preferred_separator).append(items[k].key);
+            path.append(destination.substr(folder.size()));
+            rewrites.emplace_back(items[k].index, std::move(path));
+        }
+    }
+    for (auto& [index, destination] : rewrites) {
+        plan[index].destination = fs::path(std::move(destination));
+    }
+    if (seed) {
+        plan.erase(std::remove_if(plan.begin() + static_cast<std::ptrdiff_t>(seed->first), plan.end(),
+                                  [](const PlanEntry& entry) { return entry.source == entry.destination; }),
+                   plan.end());
+    }
+    return series;
+}
+
+/**
+ * @brief Appends the files already in the plan's destination folders that belong to a series,
+ * as entries that stay in place, and notes the subfolders there; see group_series(). A folder
+ * that cannot be listed seeds nothing.
+ */
+template <typename Backend>
+SeriesSeed seed_series(Backend& backend, std::vector<PlanEntry>& plan) {
+    SeriesSeed seed;
+    seed.first = plan.size();
+    std::unordered_map<fs::path::string_type, CategoryId> targets;
+    for (std::size_t i = 0; i < seed.first; ++i) {
+        targets.emplace(plan[i].destination.parent_path().native(), plan[i].category);
+    }
+    std::vector<fs::directory_entry> entries;
+    std::error_code ec;
+    for (const auto& [folder, category] : targets) {
+        if (!backend.list_directory(fs::path(folder), entries, ec)) continue;
+        for (const fs::directory_entry& entry : entries) {
+            if (entry.is_directory(ec) && !entry.is_symlink(ec)) {
+                seed.folders.emplace(entry.path().native(), true);
+                continue;
+            }
+            if (!entry.is_regular_file(ec) || series_key(leaf_name(entry.path())).empty()) continue;
+            PlanEntry placed;
+            if (!backend.stat(entry.path(), placed.stamp, ec)) continue;
+            placed.source = entry.path();
+            placed.destination = entry.path();
+            placed.category = category;
+            plan.push_back(std::move(placed));
+        }
+    }
+    return seed;
+}
+
+/**
+ * @brief Creates any destination folders of a plan that are not category folders, such as
+ * series subfolders; category folders come from ensure_folders(). A folder that cannot be
+ * created, say because a file already has its name, is reported and its entries go to the
+ * category folder above it instead.
+ */
+void ensure_plan_folders(FsBackend& backend, const fs::path& base_path, std::vector<PlanEntry>& plan) {
+    std::vector<fs::path> folders;
+    for (const PlanEntry& planned : plan) {
+        fs::path folder = planned.destination.parent_path();
+        if (folder.parent_path() != base_path) folders.push_back(std::move(folder));
+    }
+    std::sort(folders.begin(), folders.end());
+    folders.erase(std::unique(folders.begin(), folders.end()), folders.end());
+    std::vector<fs::path> failed;
+    for (const fs::path& folder : folders) {
+        std::error_code ec;
+        if (!backend.make_directory(folder, ec)) {
+            std::cerr << "Error creating directory " << folder.string() << ": " << ec.message() << "; using '"
+                      << folder.parent_path().filename().string() << "' instead." << std::endl;
+            failed.push_back(folder);
+        }
+    }
+    if (failed.empty()) return;
+    for (PlanEntry& planned : plan) {
+        fs::path folder = planned.destination.parent_path();
+        if (std::binary_search(failed.begin(), failed.end(), folder)) {
+            planned.destination = folder.parent_path() / planned.destination.filename();
+        }
+    }
+}
+
+// --- Run limits: bounded runs that handle the most important files first ---
+
+enum class PriorityOrder { Oldest, Largest, Category };
+
+/**
+ * @brief Limits for one organize run, and what was left when they were reached.
+ */
+struct RunLimits {
+    std::chrono::nanoseconds time_budget{0};  // counted from the start of the scan; 0: unlimited
+    std::size_t max_ops = 0;                  // most files to move; 0: unlimited
+    PriorityOrder order = PriorityOrder::Oldest;
+    std::vector<std::string> category_order;  // PriorityOrder::Category: earlier names first, then oldest
+    std::vector<PlanEntry> remaining;         // filled by the run: entries that were not attempted
+
+    bool active() const { return time_budget.count() > 0 || max_ops > 0; }
+};
+
+/**
+ * @brief Puts a plan into priority order and keeps at most `limits.max_ops` entries. The
+ * winners are chosen with a heap bounded to that size, so a large backlog with a small
+ * limit costs O(n log k); the rest go to `limits.remaining`.
+ */
+std::vector<PlanEntry> prioritize_plan(std::vector<PlanEntry> plan, const fs::path& base_path, RunLimits& limits) {
+    struct Ranked {
+        std::uint64_t primary;
+        std::uint64_t secondary;
+        std::size_t index;
+        bool operator<(const Ranked& other) const {
+            if (primary != other.primary) return primary < other.primary;
+            if (secondary != other.secondary) return secondary < other.secondary;
+            return index < other.index;
+        }
+    };
+    // Signed nanoseconds mapped onto unsigned order.
+    auto age = [](const PlanEntry& e) { return static_cast<std::uint64_t>(e.stamp.mtime_ns) ^ (1ull << 63); };
+
+    std::vector<std::uint64_t> category_rank(g_categories.size(), limits.category_order.size());
+    for (std::size_t i = 0; i < limits.category_order.size(); ++i) {
+        CategoryId id = category_id(limits.category_order[i]);
+        if (id != kNoCategory) category_rank[id] = std::min<std::uint64_t>(category_rank[id], i);
+    }
+
+    std::size_t keep = limits.max_ops > 0 ? std::min(limits.max_ops, plan.size()) : plan.size();
+    std::vector<Ranked> heap; // max-heap: the front is the least important entry kept so far
+    heap.reserve(keep);
+    for (std::size_t i = 0; i < plan.size() && keep > 0; ++i) {
+        const PlanEntry& entry = plan[i];
+        Ranked ranked{0, age(entry), i};
+        switch (limits.order) {
+        case PriorityOrder::Oldest:
+            ranked.primary = age(entry);
+            break;
+        case PriorityOrder::Largest:
+            ranked.primary = ~entry.stamp.size;
+            break;
+        case PriorityOrder::Category: {
+            CategoryId id = category_id(plan_category(base_path, entry));
+            ranked.primary = id == kNoCategory ? limits.category_order.size() : category_rank[id];
+            break;
+        }
+        }
+        if (heap.size() < keep) {
+            heap.push_back(ranked);
+            std::push_heap(heap.begin(), heap.end());
+        } else if (ranked < heap.front()) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = ranked;
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+    std::sort_heap(heap.begin(), heap.end());
+
+    std::vector<std::uint8_t> chosen(plan.size(), 0);
+    std::vector<PlanEntry> ordered;
+    ordered.reserve(heap.size());
+    for (const Ranked& ranked : heap) {
+        chosen[ranked.index] = 1;
+        ordered.push_back(std::move(plan[ranked.index]));
+    }
+    for (std::size_t i = 0; i < plan.size(); ++i) {
+        if (!chosen[i]) limits.remaining.push_back(std::move(plan[i]));
+    }
+    return ordered;
+}
+
+/**
+ * @brief Prints how many files a limited run left behind, per category.
+ */
+void print_remaining(std::ostream& out, const fs::path& base_path, const std::vector<PlanEntry>& remaining) {
+    std::vector<UsageTotals> per_category(g_categories.size());
+    UsageTotals total;
+    for (const PlanEntry& entry : remaining) {
+        CategoryId id = category_id(plan_category(base_path, entry));
+        UsageTotals& totals = per_category[id == kNoCategory ? g_others_id : id];
+        totals.bytes += entry.stamp.size;
+        ++totals.files;
+        total.bytes += entry.stamp.size;
+        ++total.files;
+    }
+    if (total.files == 0) {
+        out << "All planned files were handled within the run limits." << std::endl;
+        return;
+    }
+    out << "Run limit reached: " << total.files << " files (" << format_bytes(total.bytes) << ") remain:" << std::endl;
+    for (std::size_t id = 0; id < per_category.size(); ++id) {
+        if (per_category[id].files == 0) continue;
+        out << "  " << format_bytes(per_category[id].bytes) << "\t" << per_category[id].files << " files\t"
+            << g_categories[id] << std::endl;
+    }
+}
+
+/**
+ * @brief The organize engine, assembled from compile-time policies.
+ * @tparam Scanner Produces the plan (FlatScanner, TreeScanner).
+ * @tparam Classifier Maps a file to its category folder (ExtensionClassifier).
+ * @tparam Conflict Decides what happens when the destination exists (SkipExisting, SuffixHotNames).
+ * @tparam Mover The backend the operations go through; a final class such as SyncBackend
+ *               lets every call be resolved at compile time.
+ * @tparam Instrumentation Observes each entry's outcome (NoInstrumentation, OutcomeInstrumentation).
+ */
+template <typename Scanner, typename Classifier, typename Conflict, typename Mover, typename Instrumentation>
+class Engine {
+public:
+    using instrumentation_type = Instrumentation;
+
+    // The same engine with another conflict policy, mover or instrumentation.
+    template <typename OtherConflict>
+    using with_conflict = Engine<Scanner, Classifier, OtherConflict, Mover, Instrumentation>;
+    template <typename OtherMover>
+    using with_mover = Engine<Scanner, Classifier, Conflict, OtherMover, Instrumentation>;
+    template <typename OtherInstrumentation>
+    using with_instrumentation = Engine<Scanner, Classifier, Conflict, Mover, OtherInstrumentation>;
+
+    Engine(Mover& mover, Instrumentation& instrumentation) : mover_(mover), instrumentation_(instrumentation) {}
+
+    /**
+     * @brief Has the following runs append the destination of every file they move to `placed`.
+     */
+    void collect_placed(std::vector<fs::path>* placed) { placed_ = placed; }
+
+    /**
+     * @brief Scans the base path and decides where each file should go, without touching anything.
+     */
+    std::vector<PlanEntry> plan(const fs::path& base_path, const fs::path& self_path, const ScanOptions& options) {
+        std::vector<PlanEntry> plan = Scanner::template scan<Classifier>(mover_, base_path, self_path, options);
+        if (options.series_threshold > 0) {
+            SeriesSeed seed = seed_series(mover_, plan);
+            group_series(plan, options.series_threshold, &seed);
+        }
+        return plan;
+    }
+
+    /**
+     * @brief Applies a plan using the parallel no-clobber engine.
+     * @tparam Validate When true, each source is re-stat'ed and skipped as stale if its
+     *                  inode, size or mtime differ from the planned values.
+     * @tparam Budgeted When true, entries not started by `deadline` are left alone and
+     *                  appended to `remaining`.
+     */
+    template <bool Validate, bool Budgeted = false>
+    ExecuteReport execute(const std::vector<PlanEntry>& plan, unsigned jobs,
+                          std::chrono::steady_clock::time_point deadline = {},
+                          std::vector<PlanEntry>* remaining = nullptr) {
+        Counters counters;
+        counters.placed = placed_;
+        instrumentation_.prepare(plan.size());
+        std::vector<std::uint8_t> out_of_time;
+        if constexpr (Budgeted) {
+            out_of_time.assign(plan.size(), 0);
+        }
+        if constexpr (Instrumentation::kLive) {
+            instrumentation_.live.planned += plan.size();
+        }
+
+        parallel_for(plan.size(), jobs, [&](std::size_t i) {
+            const PlanEntry& planned = plan[i];
+            std::error_code ec;
+            if constexpr (Budgeted) {
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    out_of_time[i] = 1;
+                    return;
+                }
+            }
+            if constexpr (Validate) {
+                FileStamp live;
+                const char* reason = nullptr;
+                if (!mover_.stat(planned.source, live, ec)) {
+                    reason = "source no longer exists";
+                } else if (planned.stamp.inode != 0 && live.inode != planned.stamp.inode) {
+                    reason = "inode changed";
+                } else if (live.size != planned.stamp.size || live.mtime_ns != planned.stamp.mtime_ns) {
+                    reason = "size or modification time changed";
+                }
+                if (reason) {
+                    ++counters.stale;
+                    if constexpr (Instrumentation::kLive) {
+                        ++instrumentation_.live.stale;
+                    }
+                    if (g_quiet) return;
+                    std::lock_guard<std::mutex> lock(g_console_mutex);
+                    std::cout << "Stale plan entry '" << planned.source.string() << "': " << reason << "." << std::endl;
+                    return;
+                }
+            }
+
+            std::chrono::steady_clock::time_point started;
+            if constexpr (Instrumentation::kLive) {
+                started = instrumentation_.live.move_started();
+            }
+            MoveStatus status = Conflict::place(mover_, planned.source, planned.destination, ec);
+            if constexpr (Instrumentation::kLive) {
+                instrumentation_.live.record(status, planned.category, planned.stamp.size, started);
+            }
+            if constexpr (Instrumentation::kEnabled) {
+                instrumentation_.record(i, status);
+            }
+            counters.count(status, planned.source, planned.destination, ec);
+        });
+        if constexpr (Instrumentation::kLive) {
+            instrumentation_.live.set_idle();
+        }
+
+        if constexpr (Budgeted) {
+            std::size_t left = 0;
+            for (std::size_t i = 0; i < plan.size(); ++i) {
+                if (out_of_time[i]) {
+                    remaining->push_back(plan[i]);
+                    ++left;
+                }
+            }
+            if constexpr (Instrumentation::kLive) {
+                instrumentation_.live.planned -= left;
+            }
+        }
+        return counters.report();
+    }
+
+    /**
+     * @brief Applies a scan tree directly, without expanding it into plan entries: workers take
+     * chunks of files and build each source and destination path in reusable scratch strings,
+     * so only the paths of the files in flight exist at any time.
+     */
+    ExecuteReport execute_tree(const CompactTree& tree, const fs::path& base_path, unsigned jobs) {
+        constexpr std::size_t kChunk = 256;
+        const auto& files = tree.files();
+        std::vector<fs::path::string_type> folders;
+        for (const std::string& category : g_categories) {
+            folders.push_back((base_path / category).native());
+        }
+        Counters counters;
+        counters.placed = placed_;
+        instrumentation_.prepare(files.size());
+        if constexpr (Instrumentation::kLive) {
+            instrumentation_.live.planned += files.size();
+        }
+
+        parallel_for((files.size() + kChunk - 1) / kChunk, jobs, [&](std::size_t chunk) {
+            fs::path::string_type dir;
+            fs::path::string_type scratch;
+            std::uint32_t cached_dir = UINT32_MAX;
+            std::size_t end = std::min(files.size(), (chunk + 1) * kChunk);
+            for (std::size_t i = chunk * kChunk; i < end; ++i) {
+                const CompactTree::File& file = files[i];
+                if (file.dir != cached_dir) { // files of one directory are adjacent
+                    tree.dir_path(file.dir, dir);
+                    cached_dir = file.dir;
+                }
+                scratch.assign(dir).append(1, fs::path::preferred_separator).append(tree.name(file));
+                fs::path source(scratch);
+                scratch.assign(folders[tree.category(file)]).append(1, fs::path::preferred_separator).append(tree.name(file));
+                fs::path destination(scratch);
+
+                std::error_code ec;
+                std::chrono::steady_clock::time_point started;
+                if constexpr (Instrumentation::kLive) {
+                    started = instrumentation_.live.move_started();
+                }
+                MoveStatus status = Conflict::place(mover_, source, destination, ec);
+                if constexpr (Instrumentation::kLive) {
+                    instrumentation_.live.record(status, tree.category(file), file.size, started);
+                }
+                if constexpr (Instrumentation::kEnabled) {
+                    instrumentation_.record(i, status);
+                }
+                counters.count(status, source, destination, ec);
+            }
+        });
+        if constexpr (Instrumentation::kLive) {
+            instrumentation_.live.set_idle();
+        }
+        return counters.report();
+    }
+
+    /**
+     * @brief Organizes all files in the given base path: ensures the category folders, plans
+     * and executes. Disk usage is only accounted by instrumented engines.
+     * @param limits When active, the plan is put in priority order and the run stops at the
+     *               time budget or operation limit; what was not attempted ends up in
+     *               limits->remaining.
+     */
+    ExecuteReport organize(const fs::path& base_path, const fs::path& self_path, unsigned jobs, ScanOptions scan,
+                           RunLimits* limits = nullptr) {
+        auto started = std::chrono::steady_clock::now();
+        const fs::path& root = library_root(base_path, scan);
+        ensure_folders(mover_, root);
+        scan.jobs = jobs;
+        collect_placed(scan.placed);
+        if constexpr (Scanner::kCompact) {
+            // Series grouping and run limits rewrite or reorder the plan, so they need entries.
+            if (scan.series_threshold == 0 && !(limits && limits->active())) {
+                CompactTree tree = Scanner::template scan_tree<Classifier>(mover_, base_path, self_path, scan);
+                ExecuteReport report = execute_tree(tree, root, jobs);
+                if constexpr (Instrumentation::kEnabled) {
+                    if (scan.usage) {
+                        account_tree(*scan.usage, root, tree, instrumentation_.outcomes);
+                        scan.usage->finalize(base_path);
+                    }
+                }
+                return report;
+            }
+        }
+        std::vector<PlanEntry> plan = this->plan(base_path, self_path, scan);
+        if (scan.series_threshold > 0) {
+            ensure_plan_folders(mover_, root, plan);
+        }
+        ExecuteReport report;
+        std::size_t cut = 0;
+        if (limits && limits->active()) {
+            plan = prioritize_plan(std::move(plan), root, *limits);
+            cut = limits->remaining.size();
+            auto deadline = limits->time_budget.count() > 0 ? started + limits->time_budget
+                                                            : std::chrono::steady_clock::time_point::max();
+            report = execute<false, true>(plan, jobs, deadline, &limits->remaining);
+        } else {
+            report = execute<false>(plan, jobs);
+        }
+        if constexpr (Instrumentation::kEnabled) {
+            if (scan.usage) {
+                account_plan(*scan.usage, root, plan, instrumentation_.outcomes);
+                for (std::size_t i = 0; i < cut; ++i) {
+                    const PlanEntry& left = limits->remaining[i];
+                    if (starts_in_library(root, left)) continue;
+                    scan.usage->add(left.source.parent_path(), plan_category(root, left), left.stamp.size);
+                }
+                scan.usage->finalize(base_path);
+            }
+        }
+        return report;
+    }
+
+private:
+    /**
+     * @brief Outcome counters shared by the execute loops; also prints the per-file messages.
+     */
+    struct Counters {
+        std::atomic<std::size_t> moved{0}, skipped{0}, stale{0}, failed{0};
+        std::vector<fs::path>* placed = nullptr;
+        std::mutex placed_mutex;
+
+        void count(MoveStatus status, const fs::path& source, const fs::path& destination, const std::error_code& ec) {
+            switch (status) {
+            case MoveStatus::Moved:
+                ++moved;
+                if (placed) {
+                    std::lock_guard<std::mutex> lock(placed_mutex);
+                    placed->push_back(destination);
+                }
+                break;
+            case MoveStatus::Exists: {
+                ++skipped;
+                if (g_quiet) break;
+                std::lock_guard<std::mutex> lock(g_console_mutex);
+                std::cout << "Skipping '" << source.filename().string() << "': file already exists in '"
+                          << destination.parent_path().filename().string() << "' folder." << std::endl;
+                break;
+            }
+            case MoveStatus::Failed: {
+                // Report error for the specific file and continue with others
+                ++failed;
+                if (g_quiet) break;
+                std::lock_guard<std::mutex> lock(g_console_mutex);
+                std::cerr << "Error moving file '" << source.filename().string() << "': " << ec.message() << std::endl;
+                break;
+            }
+            }
+        }
+
+        ExecuteReport report() const { return ExecuteReport{moved.load(), skipped.load(), stale.load(), failed.load()}; }
+    };
+
+    Mover& mover_;
+    Instrumentation& instrumentation_;
+    std::vector<fs::path>* placed_ = nullptr;
+};
+
+// The plain "move by extension" run: one directory, direct syscalls, nothing recorded.
+using FastEngine = Engine<FlatScanner, ExtensionClassifier, SkipExisting, SyncBackend, NoInstrumentation>;
+// Everything switchable at runtime: any backend (tracing, faults), recursion, usage accounting.
+using GenericEngine = Engine<TreeScanner, ExtensionClassifier, SkipExisting, FsBackend, OutcomeInstrumentation>;
+
+// Upstream already knows which files arrived: plan from a list instead of a scan.
+using ListEngine = Engine<ListScanner, ExtensionClassifier, SkipExisting, FsBackend, OutcomeInstrumentation>;
+
+// The same runs while live stats are published, which is the default.
+using LiveFastEngine = FastEngine::with_instrumentation<LiveInstrumentation<NoInstrumentation>>;
+using LiveGenericEngine = GenericEngine::with_instrumentation<LiveInstrumentation<OutcomeInstrumentation>>;
+
+template class Engine<FlatScanner, ExtensionClassifier, SkipExisting, SyncBackend, NoInstrumentation>;
+template class Engine<TreeScanner, ExtensionClassifier, SkipExisting, FsBackend, OutcomeInstrumentation>;
+template class Engine<ListScanner, ExtensionClassifier, SkipExisting, FsBackend, OutcomeInstrumentation>;
+template class Engine<FlatScanner, ExtensionClassifier, SkipExisting, SyncBackend, LiveInstrumentation<NoInstrumentation>>;
+template class Engine<TreeScanner, ExtensionClassifier, SkipExisting, FsBackend, LiveInstrumentation<OutcomeInstrumentation>>;
+
+/**
+ * @brief Calls `body` with `EngineType` as this run needs it: with LiveInstrumentation when
+ * live stats are published (g_live), and under SuffixHotNames when conflicts are counted
+ * (--conflict-stats). The choice is made once per run, so the engines' per-file loops carry
+ * no checks for either feature.
+ */
+template <typename EngineType, typename Mover, typename Body>
+ExecuteReport with_run_engine(Mover& mover, Body&& body) {
+    using Instrumentation = typename EngineType::instrumentation_type;
+    if (g_live) {
+        using LiveEngine = typename EngineType::template with_instrumentation<LiveInstrumentation<Instrumentation>>;
+        LiveInstrumentation<Instrumentation> instrumentation(*g_live);
+        if (g_conflict_sketch) {
+            typename LiveEngine::template with_conflict<SuffixHotNames> engine(mover, instrumentation);
+            return body(engine);
+        }
+        LiveEngine engine(mover, instrumentation);
+        return body(engine);
+    }
+    Instrumentation instrumentation;
+    if (g_conflict_sketch) {
+        typename EngineType::template with_conflict<SuffixHotNames> engine(mover, instrumentation);
+        return body(engine);
+    }
+    EngineType engine(mover, instrumentation);
+    return body(engine);
+}
+
+/**
+ * @brief Organizes with `EngineType` as configured for this run; see with_run_engine().
+ */
+template <typename EngineType, typename Mover, typename... Args>
+ExecuteReport organize_with(Mover& mover, Args&&... args) {
+    return with_run_engine<EngineType>(mover, [&](auto& engine) { return engine.organize(std::forward<Args>(args)...); });
+}
+
+/**
+ * @brief Scans the base path with the generic engine; see TreeScanner.
+ */
+std::vector<PlanEntry> build_plan(FsBackend& backend, const fs::path& base_path, const fs::path& self_path,
+                                  const ScanOptions& options = {}) {
+    OutcomeInstrumentation instrumentation;
+    return GenericEngine(backend, instrumentation).plan(base_path, self_path, options);
+}
+
+/**
+ * @brief Applies a plan with the generic engine.
+ * @param validate When true, entries whose source changed since planning are reported as stale.
+ * @param placed When set, receives the destination of every file moved.
+ */
+ExecuteReport execute_plan(FsBackend& backend, const std::vector<PlanEntry>& plan, unsigned jobs, bool validate,
+                           std::vector<fs::path>* placed = nullptr) {
+    return with_run_engine<GenericEngine>(backend, [&](auto& engine) {
+        engine.collect_placed(placed);
+        return validate ? engine.template execute<true>(plan, jobs) : engine.template execute<false>(plan, jobs);
+    });
+}
+
+/**
+ * @brief Organizes all files in the given base path.
+ * It iterates through each item, and if it's a file, moves it to the appropriate subfolder.
+ * @param base_path The directory whose files need to be organized.
+ * @param self_path The full path to the executable to avoid moving itself.
+ * @param backend The filesystem backend to issue the operations through.
+ * @param jobs Number of worker threads used for the scan and the moves.
+ * @param scan Recursion and accounting options; scan.jobs is overridden by `jobs`.
+ */
+void organize_files(const fs::path& base_path, const fs::path& self_path, FsBackend& backend, unsigned jobs,
+                    ScanOptions scan = {}) {
+    organize_with<GenericEngine>(backend, base_path, self_path, jobs, scan);
+}
+
+// --- Hardware performance counters per phase (Linux perf_event_open) ---
+
+enum class Phase { Scan, Classify, Rename };
+constexpr int kPhaseCount = 3;
+constexpr int kPerfCounterCount = 4;
+const char* const PHASE_NAMES[kPhaseCount] = {"scan", "classify", "rename"};
+const char* const PERF_COUNTER_NAMES[kPerfCounterCount] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+
+/**
+ * @brief Per-phase wall time and counter totals, summed over all worker threads.
+ * Counters that could not be opened stay unavailable and only wall time is reported.
+ */
+class PerfProfile {
+public:
+    void enable() { enabled_ = true; }
+    bool enabled() const { return enabled_; }
+
+    void add(Phase phase, std::uint64_t ns, const std::uint64_t* counters, const bool* valid) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Totals& t = totals_[static_cast<int>(phase)];
+        ++t.calls;
+        t.ns += ns;
+        for (int c = 0; c < kPerfCounterCount; ++c) {
+            if (valid[c]) {
+                t.counters[c] += counters[c];
+                t.valid[c] = true;
+            }
+        }
+    }
+
+    void counters_unavailable(const std::string& reason) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (unavailable_reason_.empty()) unavailable_reason_ = reason;
+    }
+
+    void print(std::ostream& out, std::size_t files) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        double per_file = files ? 1.0 / static_cast<double>(files) : 0.0;
+        out << "Performance counters (" << files << " files):" << std::endl;
+        if (!unavailable_reason_.empty()) {
+            out << "  hardware counters unavailable (" << unavailable_reason_ << "); wall time only" << std::endl;
+        }
+        for (int p = 0; p < kPhaseCount; ++p) {
+            const Totals& t = totals_[p];
+            out << "  " << PHASE_NAMES[p] << ": " << t.calls << " calls, " << static_cast<double>(t.ns) * per_file
+                << " ns/file";
+            for (int c = 0; c < kPerfCounterCount; ++c) {
+                if (t.valid[c]) {
+                    out << ", " << static_cast<double>(t.counters[c]) * per_file << " " << PERF_COUNTER_NAMES[c] << "/file";
+                }
+            }
+            if (t.valid[0] && t.valid[1] && t.counters[0]) {
+                out << ", IPC " << static_cast<double>(t.counters[1]) / static_cast<double>(t.counters[0]);
+            }
+            out << std::endl;
+        }
+    }
+
+private:
+    struct Totals {
+        std::uint64_t calls = 0;
+        std::uint64_t ns = 0;
+        std::uint64_t counters[kPerfCounterCount] = {};
+        bool valid[kPerfCounterCount] = {};
+    };
+    bool enabled_ = false;
+    std::mutex mutex_;
+    Totals totals_[kPhaseCount];
+    std::string unavailable_reason_;
+};
+
+PerfProfile g_perf;
+
+/**
+ * @brief The calling thread's counter group: cycles as leader with the other counters
+ * attached, read with a single read() call. Counters the kernel refuses are left out.
+ */
+class ThreadCounters {
+public:
+    ThreadCounters() {
+#ifdef __linux__
+        static const std::uint64_t configs[kPerfCounterCount] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (int c = 0; c < kPerfCounterCount; ++c) {
+            struct perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[c];
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.exclude_hv = 1;
+            attr.disabled = leader_ < 0 ? 1 : 0;
+            // pid 0 / cpu -1: this thread, on whatever CPU it runs.
+            int fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0));
+            if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+                // perf_event_paranoid may still allow user-space-only counting.
+                attr.exclude_kernel = 1;
+                fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0));
+            }
+            if (fd < 0) {
+                if (c == 0) {
+                    g_perf.counters_unavailable(std::string("perf_event_open: ") + std::strerror(errno));
+                    return;
+                }
+                continue;
+            }
+            if (leader_ < 0) leader_ = fd;
+            fds_[c] = fd;
+            slot_[c] = opened_++;
+        }
+        ::ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    ~ThreadCounters() {
+#ifndef _WIN32
+        for (int fd : fds_) {
+            if (fd >= 0) ::close(fd);
+        }
+#endif
+    }
+
+    /**
+     * @brief Reads the current counter values; valid[c] tells which ones are real.
+     */
+    void read(std::uint64_t* values, bool* valid) const {
+        for (int c = 0; c < kPerfCounterCount; ++c) {
+            values[c] = 0;
+            valid[c] = false;
+        }
+#ifdef __linux__
+        if (leader_ < 0) {
+            return;
+        }
+        std::uint64_t buffer[1 + kPerfCounterCount];
+        if (::read(leader_, buffer, sizeof(buffer)) <= 0) {
+            return;
+        }
+        for (int c = 0; c < kPerfCounterCount; ++c) {
+            if (slot_[c] >= 0 && static_cast<std::uint64_t>(slot_[c]) < buffer[0]) {
+                values[c] = buffer[1 + slot_[c]];
+                valid[c] = true;
+            }
+        }
+#endif
+    }
+
+private:
+    int leader_ = -1;
+    int opened_ = 0;
+    int fds_[kPerfCounterCount] = {-1, -1, -1, -1};
+    int slot_[kPerfCounterCount] = {-1, -1, -1, -1};
+};
+
+/**
+ * @brief Attributes the wall time and counters spent in its lifetime to a phase.
+ * Scopes nest per thread; a scope's own totals exclude those of scopes opened inside it.
+ */
+class PhaseScope {
+public:
+    explicit PhaseScope(Phase phase) : phase_(phase), parent_(current_) {
+        current_ = this;
+        counters().read(start_counts_, valid_);
+        start_ = std::chrono::steady_clock::now();
+    }
+
+    ~PhaseScope() {
+        auto end = std::chrono::steady_clock::now();
+        std::uint64_t end_counts[kPerfCounterCount];
+        bool valid[kPerfCounterCount];
+        counters().read(end_counts, valid);
+        std::uint64_t ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start_).count());
+        std::uint64_t delta[kPerfCounterCount];
+        for (int c = 0; c < kPerfCounterCount; ++c) {
+            delta[c] = end_counts[c] - start_counts_[c];
+            valid[c] = valid[c] && valid_[c];
+        }
+        std::uint64_t own[kPerfCounterCount];
+        for (int c = 0; c < kPerfCounterCount; ++c) own[c] = delta[c] - child_counts_[c];
+        g_perf.add(phase_, ns - child_ns_, own, valid);
+
+        current_ = parent_;
+        if (parent_) {
+            parent_->child_ns_ += ns;
+            for (int c = 0; c < kPerfCounterCount; ++c) parent_->child_counts_[c] += delta[c];
+        }
+    }
+
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope& operator=(const PhaseScope&) = delete;
+
+private:
+    static ThreadCounters& counters() {
+        thread_local ThreadCounters thread_counters;
+        return thread_counters;
+    }
+
+    Phase phase_;
+    PhaseScope* parent_;
+    std::chrono::steady_clock::time_point start_;
+    std::uint64_t start_counts_[kPerfCounterCount];
+    bool valid_[kPerfCounterCount];
+    std::uint64_t child_ns_ = 0;
+    std::uint64_t child_counts_[kPerfCounterCount] = {};
+    static thread_local PhaseScope* current_;
+};
+
+thread_local PhaseScope* PhaseScope::current_ = nullptr;
+
+/**
+ * @brief Classifier policy that attributes classification to the classify phase.
+ */
+template <typename Inner>
+struct ProfiledClassifier {
+    static std::string classify(const fs::path& file) {
+        PhaseScope scope(Phase::Classify);
+        return Inner::classify(file);
+    }
+
+    static void classify_batch(const fs::path* const* files, std::size_t count, CategoryId* out) {
+        PhaseScope scope(Phase::Classify);
+        Inner::classify_batch(files, count, out);
+    }
+};
+
+/**
+ * @brief Mover policy that attributes directory listing and stat calls to the scan phase and
+ * rename, copy and remove to the rename phase.
+ */
+template <typename Inner>
+class ProfiledBackend final : public FsBackend {
+public:
+    explicit ProfiledBackend(Inner& inner) : inner_(inner) {}
+
+    bool make_directory(const fs::path& path, std::error_code& ec) override { return inner_.make_directory(path, ec); }
+
+    bool list_directory(const fs::path& path, std::vector<fs::directory_entry>& entries, std::error_code& ec) override {
+        PhaseScope scope(Phase::Scan);
+        return inner_.list_directory(path, entries, ec);
+    }
+
+    bool stat(const fs::path& path, FileStamp& stamp, std::error_code& ec) override {
+        PhaseScope scope(Phase::Scan);
+        return inner_.stat(path, stamp, ec);
+    }
+
+    MoveStatus rename(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        PhaseScope scope(Phase::Rename);
+        return inner_.rename(from, to, ec);
+    }
+
+    MoveStatus copy(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        PhaseScope scope(Phase::Rename);
+        return inner_.copy(from, to, ec);
+    }
+
+    bool remove(const fs::path& path, std::error_code& ec) override {
+        PhaseScope scope(Phase::Rename);
+        return inner_.remove(path, ec);
+    }
+
+private:
+    Inner& inner_;
+};
+
+// --perf runs: counters around every scan, classify and rename call, on any backend.
+using ProfiledEngine = Engine<TreeScanner, ProfiledClassifier<ExtensionClassifier>, SkipExisting,
+                              ProfiledBackend<FsBackend>, OutcomeInstrumentation>;
+using ProfiledFastEngine = Engine<TreeScanner, ProfiledClassifier<ExtensionClassifier>, SkipExisting,
+                                  ProfiledBackend<SyncBackend>, OutcomeInstrumentation>;
+
+/**
+ * @brief Backend that performs no I/O and reports success, used to time the engine itself.
+ */
+class NullBackend final : public FsBackend {
+public:
+    bool make_directory(const fs::path&, std::error_code& ec) override { ec.clear(); return true; }
+    bool list_directory(const fs::path&, std::vector<fs::directory_entry>& entries, std::error_code& ec) override {
+        entries.clear();
+        ec.clear();
+        return true;
+    }
+    bool stat(const fs::path&, FileStamp& stamp, std::error_code& ec) override { stamp = {}; ec.clear(); return true; }
+    MoveStatus rename(const fs::path&, const fs::path&, std::error_code& ec) override { ec.clear(); return MoveStatus::Moved; }
+    MoveStatus copy(const fs::path&, const fs::path&, std::error_code& ec) override { ec.clear(); return MoveStatus::Moved; }
+    bool remove(const fs::path&, std::error_code& ec) override { ec.clear(); return true; }
+};
+
+/**
+ * @brief Creates `count` empty files with assorted extensions in `dir`.
+ */
+void create_bench_files(const fs::path& dir, std::size_t count) {
+    static const char* exts[] = {".pdf", ".jpg", ".mp3", ".zip", ".mkv", ".txt", ".exe", ".weird"};
+    for (std::size_t i = 0; i < count; ++i) {
+        std::ofstream(dir / ("file" + std::to_string(i) + exts[i % 8]));
+    }
+}
+
+/**
+ * @brief Moves every file from the category folders back into `dir`, undoing an organize run.
+ */
+void unorganize_bench_files(const fs::path& dir) {
+    for (const auto& [folder, _] : FOLDER_MAP) {
+        std::error_code ec;
+        for (fs::directory_iterator it(dir / folder, ec), end; !ec && it != end; it.increment(ec)) {
+            fs::rename(it->path(), dir / it->path().filename());
+        }
+    }
+}
+
+/**
+ * @brief Compares the shipped FastEngine with GenericEngine as a default run uses them, with
+ * live stats on: a real organize of `files` files in `dir`, and the execute loop alone over
+ * a null backend. The loop without live stats (--no-live-stats) is shown as well.
+ * @return False when FastEngine's loop is not at least kEngineLoopMargin times faster.
+ */
+bool bench_engine(const fs::path& dir, std::size_t files, unsigned jobs) {
+    // rename(2) dominates a real run, so the margin is held against the loop alone.
+    constexpr double kEngineLoopMargin = 1.5;
+    using clock = std::chrono::steady_clock;
+    auto per = [](clock::duration d, std::size_t n) {
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()) / static_cast<double>(n);
+    };
+    const int rounds = 3;
+    SyncBackend sync_backend;
+    LiveCounters live;
+    create_bench_files(dir, files);
+
+    double fast_best = 1e300, generic_best = 1e300;
+    auto run_fast = [&] {
+        LiveInstrumentation<NoInstrumentation> instrumentation(live);
+        auto start = clock::now();
+        LiveFastEngine(sync_backend, instrumentation).organize(dir, fs::path(), jobs, {});
+        fast_best = std::min(fast_best, per(clock::now() - start, files));
+        unorganize_bench_files(dir);
+    };
+    auto run_generic = [&] {
+        LiveInstrumentation<OutcomeInstrumentation> instrumentation(live);
+        FsBackend& dynamic_backend = sync_backend;
+        auto start = clock::now();
+        LiveGenericEngine(dynamic_backend, instrumentation).organize(dir, fs::path(), jobs, {});
+        generic_best = std::min(generic_best, per(clock::now() - start, files));
+        unorganize_bench_files(dir);
+    };
+    for (int round = 0; round < rounds; ++round) {
+        // Alternate which engine goes first so neither always meets a cold directory.
+        if (round % 2 == 0) {
+            run_fast();
+            run_generic();
+        } else {
+            run_generic();
+            run_fast();
+        }
+    }
+
+    // The per-file loop alone, with I/O taken out of the picture. The plan is small enough to
+    // stay in cache and is executed repeatedly, so what is timed is the loop and not how fast
+    // the entries stream in from memory.
+    const std::size_t entries = 4096;
+    const std::size_t passes = 256;
+    std::vector<PlanEntry> plan(entries);
+    for (std::size_t i = 0; i < entries; ++i) {
+        plan[i].source = dir / ("file" + std::to_string(i) + ".pdf");
+        plan[i].destination = dir / "Documents" / plan[i].source.filename();
+    }
+    NullBackend null_backend;
+    double fast_loop = 1e300, generic_loop = 1e300, quiet_loop = 1e300;
+    for (int round = 0; round < rounds; ++round) {
+        LiveInstrumentation<NoInstrumentation> instrumentation(live);
+        auto start = clock::now();
+        for (std::size_t pass = 0; pass < passes; ++pass) {
+            LiveFastEngine::with_mover<NullBackend>(null_backend, instrumentation).execute<false>(plan, 1);
+        }
+        fast_loop = std::min(fast_loop, per(clock::now() - start, entries * passes));
+
+        LiveInstrumentation<OutcomeInstrumentation> outcomes(live);
+        FsBackend& dynamic_backend = null_backend;
+        start = clock::now();
+        for (std::size_t pass = 0; pass < passes; ++pass) {
+            LiveGenericEngine(dynamic_backend, outcomes).execute<false>(plan, 1);
+        }
+        generic_loop = std::min(generic_loop, per(clock::now() - start, entries * passes));
+
+        NoInstrumentation none;
+        start = clock::now();
+        for (std::size_t pass = 0; pass < passes; ++pass) {
+            FastEngine::with_mover<NullBackend>(null_backend, none).execute<false>(plan, 1);
+        }
+        quiet_loop = std::min(quiet_loop, per(clock::now() - start, entries * passes));
+    }
+
+    std::cout << "Engine benchmark (best of " << rounds << "):" << std::endl;
+    std::cout << "  organize " << files << " files, specialized: " << fast_best << " ns/file" << std::endl;
+    std::cout << "  organize " << files << " files, generic:     " << generic_best << " ns/file" << std::endl;
+    std::cout << "  execute loop, null I/O, specialized: " << fast_loop << " ns/entry" << std::endl;
+    std::cout << "  execute loop, null I/O, generic:     " << generic_loop << " ns/entry" << std::endl;
+    std::cout << "  execute loop, null I/O, specialized without live stats: " << quiet_loop << " ns/entry" << std::endl;
+
+    double speedup = generic_loop / fast_loop;
+    if (speedup < kEngineLoopMargin) {
+        std::cerr << "Error: The specialized loop is only " << speedup << "x the generic one, below the required "
+                  << kEngineLoopMargin << "x." << std::endl;
+        return false;
+    }
+    std::cout << "  specialized loop speedup: " << speedup << "x (required " << kEngineLoopMargin << "x)" << std::endl;
+    return true;
+}
+
+/**
+ * @brief Bytes currently allocated on the heap, or 0 where the C library cannot tell.
+ */
+std::size_t heap_in_use() {
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd; // small chunks plus mmapped large ones
+#endif
+#endif
+    return 0;
+}
+
+/**
+ * @brief Compares the memory a recursive scan of `files` entries takes as a CompactTree and
+ * as plan entries, and times materializing paths from the tree. The synthetic layout is a
+ * camera archive (<dir>/cameraN/YYYY-MM/dayD/IMG_NNNNNNN.jpg, 100 files per folder); no
+ * files are created.
+ */
+void bench_tree(const fs::path& dir, std::size_t files) {
+    using clock = std::chrono::steady_clock;
+    std::size_t before = heap_in_use();
+    CompactTree tree(dir);
+    {
+        CompactTree::FileList list;
+        CategoryId images = category_id("Images");
+        std::uint32_t camera = 0, month = 0, day = 0;
+        for (std::size_t i = 0; i < files; ++i) {
+            std::size_t d = i / 100;
+            if (i % 100 == 0) {
+                if (d % 3000 == 0) camera = tree.add_dir(CompactTree::kRoot, fs::path("camera" + std::to_string(d / 3000)).native());
+                if (d % 30 == 0) {
+                    std::size_t m = d / 30;
+                    month = tree.add_dir(camera, fs::path(std::to_string(2000 + m / 12) + "-" + std::to_string(1 + m % 12)).native());
+                }
+                day = tree.add_dir(month, fs::path("day" + std::to_string(d % 30 + 1)).native());
+            }
+            FileStamp stamp{1000000 + i, 3000000 + i % 4096, 1700000000000000000 + static_cast<std::int64_t>(i) * 1000};
+            list.add(day, fs::path("IMG_" + std::to_string(1000000 + i) + ".jpg").native(), images, stamp);
+        }
+        tree.adopt(std::move(list));
+    }
+    std::size_t tree_heap = heap_in_use() - before;
+
+    fs::path::string_type scratch;
+    std::size_t total_length = 0;
+    auto start = clock::now();
+    for (const CompactTree::File& file : tree.files()) {
+        tree.file_path(file, scratch);
+        total_length += scratch.size();
+    }
+    double materialize = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+
+    before = heap_in_use();
+    std::size_t plan_heap;
+    {
+        std::vector<PlanEntry> plan = tree.to_plan(dir);
+        plan_heap = heap_in_use() - before;
+    }
+
+    auto per = [&](std::size_t bytes) { return static_cast<double>(bytes) / static_cast<double>(files); };
+    std::cout << "Scan tree benchmark (" << files << " files in " << tree.dir_count() << " folders, average path "
+              << per(total_length) << " characters):" << std::endl;
+    std::cout << "  compact tree:  " << per(tree.memory_bytes()) << " bytes/entry";
+    if (tree_heap > 0) std::cout << " (" << per(tree_heap) << " on the heap)";
+    std::cout << std::endl;
+    if (plan_heap > 0) {
+        std::cout << "  plan entries:  " << per(plan_heap) << " bytes/entry on the heap" << std::endl;
+    } else {
+        std::cout << "  plan entries:  at least " << sizeof(PlanEntry) + 2 * per(total_length) << " bytes/entry" << std::endl;
+    }
+    std::cout << "  path from tree: " << materialize / static_cast<double>(files) << " ns/file" << std::endl;
+}
+
+/**
+ * @brief Times group_series() on a synthetic plan of `names` entries: camera runs, versioned
+ * reports and unrelated names spread over the category folders. Touches no files.
+ */
+void bench_series(const fs::path& dir, std::size_t names) {
+    using clock = std::chrono::steady_clock;
+    const char* const folders[] = {"Images", "Documents", "Video", "Others"};
+    std::mt19937_64 rng(42);
+    std::vector<PlanEntry> base(names);
+    for (std::size_t i = 0; i < names; ++i) {
+        std::string name;
+        switch (rng() % 4) {
+        case 0: name = "IMG_" + std::to_string(2000 + rng() % 25) + "_" + std::to_string(rng() % 100000) + ".jpg"; break;
+        case 1: name = "report_" + std::to_string(rng() % 5000) + "_v" + std::to_string(rng() % 20) + ".pdf"; break;
+        case 2: name = "clip-" + std::to_string(rng() % 1000000) + ".mp4"; break;
+        default: name = "notes" + std::to_string(rng()) + "x.txt"; break;
+        }
+        base[i].destination = dir / folders[rng() % 4] / name;
+    }
+
+    const int rounds = 3;
+    double best = 1e300;
+    std::size_t series = 0;
+    for (int round = 0; round < rounds; ++round) {
+        std::vector<PlanEntry> plan = base;
+        auto start = clock::now();
+        series = group_series(plan, 20);
+        best = std::min(best, std::chrono::duration<double>(clock::now() - start).count());
+    }
+    std::cout << "Series grouping benchmark (best of " << rounds << "):" << std::endl;
+    std::cout << "  " << names << " names, " << series << " series: " << best << " s ("
+              << best * 1e9 / static_cast<double>(names) << " ns/name)" << std::endl;
+}
+
+/**
+ * @brief Measures classification throughput: classify() one path at a time, then
+ * classify_names() at batch sizes from 1 to 4096, on `names` synthetic file names mixing
+ * known, upper-case, unknown and missing extensions. Touches no files.
+ */
+void bench_classify(const fs::path& dir, std::size_t names) {
+    using clock = std::chrono::steady_clock;
+    const char* const extensions[] = {".jpg", ".JPG", ".pdf", ".mp4", ".tar.gz", ".docx", ".flac", ".unknown", "", ".x"};
+    std::mt19937_64 rng(42);
+    NameBatch batch;
+    std::vector<fs::path> paths(names);
+    for (std::size_t i = 0; i < names; ++i) {
+        paths[i] = dir / ("file_" + std::to_string(rng() % 1000000) + extensions[rng() % std::size(extensions)]);
+        batch.add(paths[i]);
+    }
+    std::vector<CategoryId> out(names);
+    std::size_t checksum = 0;
+    auto rate = [&](double seconds) { return static_cast<double>(names) / seconds / 1e6; };
+
+    std::cout << "Classify benchmark (" << names << " names, best of 3):" << std::endl;
+    double best = 1e300;
+    for (int round = 0; round < 3; ++round) {
+        auto start = clock::now();
+        for (const fs::path& path : paths) {
+            checksum += ExtensionClassifier::classify(path).size();
+        }
+        best = std::min(best, std::chrono::duration<double>(clock::now() - start).count());
+    }
+    std::cout << "  per path: " << rate(best) << " M names/s" << std::endl;
+
+    for (std::size_t size = 1; size <= 4096; size *= 2) {
+        best = 1e300;
+        for (int round = 0; round < 3; ++round) {
+            auto start = clock::now();
+            for (std::size_t i = 0; i < names; i += size) {
+                classify_names(batch.text.data(), batch.offsets.data() + i, std::min(size, names - i), out.data() + i);
+            }
+            best = std::min(best, std::chrono::duration<double>(clock::now() - start).count());
+        }
+        checksum += out[names / 2];
+        std::cout << "  batch of " << size << ": " << rate(best) << " M names/s" << std::endl;
+    }
+    if (checksum == 0) std::cout << std::endl; // keeps the loops from being optimized away
+}
+
+/**
+ * @brief Drops the page, dentry and inode caches so the next scan has to read from disk.
+ * @return false where that is not possible (not Linux, or not root).
+ */
+bool drop_caches() {
+#ifdef __linux__
+    ::sync();
+    std::ofstream control("/proc/sys/vm/drop_caches");
+    return static_cast<bool>(control << "3" << std::endl);
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Times planning a folder of `files` files with 0 to 16 stat prefetch helpers, on a
+ * warm cache and, where the caches can be dropped, on a cold one. A third column stats the
+ * first 2000 files through a backend that adds 100 us to every stat, like a network
+ * filesystem or a busy disk, where the overlap matters most.
+ */
+void bench_prefetch(const fs::path& dir, std::size_t files) {
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    struct SlowStat {
+        bool stat(const fs::path& path, FileStamp& stamp, std::error_code& ec) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            return read_file_stamp(path, stamp, ec);
+        }
+    };
+    create_bench_files(dir, files);
+    SyncBackend sync_backend;
+    std::vector<fs::directory_entry> entries;
+    std::error_code ec;
+    sync_backend.list_directory(dir, entries, ec);
+    std::vector<const fs::path*> slow_files;
+    for (std::size_t i = 0; i < std::min<std::size_t>(entries.size(), 2000); ++i) {
+        slow_files.push_back(&entries[i].path());
+    }
+    bool cold = drop_caches();
+    std::cout << "Stat prefetch benchmark (plan " << files << " files"
+              << (cold ? ", cold cache after dropping caches" : "; caches cannot be dropped here, warm only") << "):"
+              << std::endl;
+    for (unsigned helpers : {0u, 1u, 2u, 4u, 8u, 16u}) {
+        ScanOptions scan;
+        scan.stat_helpers = helpers;
+        NoInstrumentation none;
+        FastEngine engine(sync_backend, none);
+        std::cout << "  " << helpers << " helpers:";
+        if (cold) {
+            drop_caches();
+            auto start = clock::now();
+            engine.plan(dir, fs::path(), scan);
+            std::cout << " cold " << ms(clock::now() - start) << " ms,";
+        }
+        double warm = 1e300;
+        for (int round = 0; round < 3; ++round) {
+            auto start = clock::now();
+            engine.plan(dir, fs::path(), scan);
+            warm = std::min(warm, ms(clock::now() - start));
+        }
+        SlowStat slow;
+        auto start = clock::now();
+        {
+            StatPrefetcher<SlowStat> prefetch(slow, helpers);
+            prefetch.start(slow_files.data(), slow_files.size());
+            for (std::size_t i = 0; i < slow_files.size(); ++i) {
+                prefetch.get(i);
+            }
+        }
+        std::cout << " warm " << warm << " ms, " << slow_files.size() << " slow stats " << ms(clock::now() - start)
+                  << " ms" << std::endl;
+    }
+}
+
+/**
+ * @brief Times copying files of 16 MiB (one per 2000 of `files`, at least two) through a
+ * single buffer and through the read-ahead / write-behind pipeline of copy_contents(), with
+ * a cold source cache where the caches can be dropped.
+ */
+void bench_copy(const fs::path& dir, std::size_t files) {
+#ifndef _WIN32
+    using clock = std::chrono::steady_clock;
+    constexpr std::size_t kFileSize = 16u << 20;
+    std::size_t count = std::max<std::size_t>(2, files / 2000);
+    fs::path sources = dir / "sources";
+    fs::path copies = dir / "copies";
+    fs::create_directories(sources);
+    std::vector<char> data(kFileSize);
+    std::mt19937_64 rng(42);
+    for (std::size_t i = 0; i < count; ++i) {
+        for (std::size_t k = 0; k + 8 <= data.size(); k += 8) {
+            std::uint64_t word = rng();
+            std::memcpy(data.data() + k, &word, 8);
+        }
+        std::ofstream(sources / ("file" + std::to_string(i) + ".bin"), std::ios::binary).write(data.data(), data.size());
+    }
+    bool cold = drop_caches();
+    std::cout << "Copy benchmark (" << count << " files of " << format_bytes(kFileSize)
+              << (cold ? ", cold source cache" : "; caches cannot be dropped here, warm only") << "):" << std::endl;
+    for (bool pipelined : {false, true}) {
+        fs::remove_all(copies);
+        fs::create_directories(copies);
+        if (cold) drop_caches();
+        auto start = clock::now();
+        for (std::size_t i = 0; i < count; ++i) {
+            std::string name = "file" + std::to_string(i) + ".bin";
+            int in = ::open((sources / name).c_str(), O_RDONLY | O_CLOEXEC);
+            int out = ::open((copies / name).c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            if (in < 0 || out < 0 || copy_contents(in, out, pipelined ? kFileSize : 0) != 0 || ::fsync(out) != 0) {
+                std::cerr << "Error: copy benchmark failed: " << std::strerror(errno) << std::endl;
+            }
+            if (in >= 0) ::close(in);
+            if (out >= 0) ::close(out);
+        }
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        std::cout << "  " << (pipelined ? "pipelined:    " : "single buffer:") << " " << seconds * 1e3 << " ms, "
+                  << format_bytes(static_cast<std::uint64_t>(count * kFileSize / seconds)) << "/s" << std::endl;
+    }
+#else
+    (void)dir;
+    (void)files;
+    std::cerr << "Error: The copy benchmark needs a POSIX system." << std::endl;
+#endif
+}
+
+// --- Plan file format (NDJSON) ---
+// The first line is a header, every following line is one entry with paths relative to the
+// organized folder, so a plan computed against a snapshot can be applied to the live tree:
+//   {"organize_plan":1,"root":"/snap/landing"}
+//   {"src":"a.pdf","dst":"Documents/a.pdf","ino":1234,"size":5678,"mtime":1700000000000000000}
+
+/**
+ * @brief Appends `value` to `out` as a JSON string literal.
+ */
+void append_json_string(std::string& out, std::string_view value) {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for (unsigned char c : value) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xF];
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+    }
+    out += '"';
+}
+
+/**
+ * @brief Parses one flat JSON object (string and integer values only) into key/value pairs.
+ * Integers are returned as their decimal text.
+ * @return false if the line is not a well-formed flat object.
+ */
+bool parse_flat_json(std::string_view line, std::vector<std::pair<std::string, std::string>>& fields) {
+    fields.clear();
+    std::size_t pos = 0;
+    auto skip_ws = [&]() {
+        while (pos < line.size() && std::isspace(static_cast<unsigned char>(line[pos]))) ++pos;
+    };
+    // Four hex digits of a \u escape.
+    auto parse_hex4 = [&](unsigned& value) -> bool {
+        if (pos + 4 > line.size()) return false;
+        value = 0;
+        for (std::size_t end = pos + 4; pos < end; ++pos) {
+            char c = line[pos];
+            unsigned digit;
+            if (c >= '0' && c <= '9') {
+                digit = static_cast<unsigned>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                digit = static_cast<unsigned>(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                digit = static_cast<unsigned>(c - 'A' + 10);
+            } else {
+                return false;
+            }
+            value = value << 4 | digit;
+        }
+        return true;
+    };
+    auto parse_string = [&](std::string& out) -> bool {
+        if (pos >= line.size() || line[pos] != '"') return false;
+        ++pos;
+        out.clear();
+        while (pos < line.size() && line[pos] != '"') {
+            char c = line[pos++];
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos >= line.size()) return false;
+            char esc = line[pos++];
+            switch (esc) {
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'u': {
+                unsigned cp;
+                if (!parse_hex4(cp)) return false;
+                // A code point past the BMP comes as a surrogate pair; a lone half is malformed.
+                if (cp >= 0xDC00 && cp <= 0xDFFF) return false;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    unsigned low;
+                    if (pos + 2 > line.size() || line[pos] != '\\' || line[pos + 1] != 'u') return false;
+                    pos += 2;
+                    if (!parse_hex4(low) || low < 0xDC00 || low > 0xDFFF) return false;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                }
+                if (cp < 0x80) {
+                    out += static_cast<char>(cp);
+                } else if (cp < 0x800) {
+                    out += static_cast<char>(0xC0 | (cp >> 6));
+                    out += static_cast<char>(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    out += static_cast<char>(0xE0 | (cp >> 12));
+                    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                    out += static_cast<char>(0x80 | (cp & 0x3F));
+                } else {
+                    out += static_cast<char>(0xF0 | (cp >> 18));
+                    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                    out += static_cast<char>(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default: out += esc; break;
+            }
+        }
+        if (pos >= line.size()) return false;
+        ++pos;
+        return true;
+    };
+
+    skip_ws();
+    if (pos >= line.size() || line[pos++] != '{') return false;
+    skip_ws();
+    if (pos < line.size() && line[pos] == '}') return true;
+    while (true) {
+        std::string key, value;
+        skip_ws();
+        if (!parse_string(key)) return false;
+        skip_ws();
+        if (pos >= line.size() || line[pos++] != ':') return false;
+        skip_ws();
+        if (pos < line.size() && line[pos] == '"') {
+            if (!parse_string(value)) return false;
+        } else {
+            std::size_t start = pos;
+            while (pos < line.size() && (std::isdigit(static_cast<unsigned char>(line[pos])) || line[pos] == '-')) ++pos;
+            if (start == pos) return false;
+            value = std::string(line.substr(start, pos - start));
+        }
+        fields.emplace_back(std::move(key), std::move(value));
+        skip_ws();
+        if (pos >= line.size()) return false;
+        if (line[pos] == ',') {
+            ++pos;
+            continue;
+        }
+        return line[pos] == '}';
+    }
+}
+
+/**
+ * @brief Writes a plan to an NDJSON file with paths relative to `root`.
+ */
+void write_plan(const std::vector<PlanEntry>& plan, const fs::path& root, const fs::path& file) {
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot open plan file for writing: " + file.string());
+    }
+    std::string line = "{\"organize_plan\":1,\"root\":";
+    append_json_string(line, root.string());
+    line += "}\n";
+    out << line;
+    for (const auto& planned : plan) {
+        line = "{\"src\":";
+        append_json_string(line, planned.source.lexically_relative(root).generic_string());
+        line += ",\"dst\":";
+        append_json_string(line, planned.destination.lexically_relative(root).generic_string());
+        line += ",\"ino\":" + std::to_string(planned.stamp.inode);
+        line += ",\"size\":" + std::to_string(planned.stamp.size);
+        line += ",\"mtime\":" + std::to_string(planned.stamp.mtime_ns);
+        line += "}\n";
+        out << line;
+    }
+    if (!out.flush()) {
+        throw std::runtime_error("Error writing plan file: " + file.string());
+    }
+}
+
+/**
+ * @brief Reads an NDJSON plan and rebases its entries onto `root`.
+ * Entries whose paths escape the root are rejected.
+ */
+std::vector<PlanEntry> read_plan(const fs::path& file, const fs::path& root) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open plan file: " + file.string());
+    }
+    std::vector<PlanEntry> plan;
+    std::vector<std::pair<std::string, std::string>> fields;
+    std::string line;
+    std::size_t line_no = 0;
+    bool header_seen = false;
+    while (std::getline(in, line)) {
+        ++line_no;
+        if (line.empty()) {
+            continue;
+        }
+        if (!parse_flat_json(line, fields)) {
+            throw std::runtime_error("Malformed plan line " + std::to_string(line_no) + " in " + file.string());
+        }
+        if (!header_seen) {
+            if (fields.empty() || fields[0].first != "organize_plan" || fields[0].second != "1") {
+                throw std::runtime_error("Not an organize plan (version 1): " + file.string());
+            }
+            header_seen = true;
+            continue;
+        }
+        PlanEntry planned;
+        std::string src, dst;
+        for (const auto& [key, value] : fields) {
+            if (key == "src") src = value;
+            else if (key == "dst") dst = value;
+            else if (key == "ino") planned.stamp.inode = std::stoull(value);
+            else if (key == "size") planned.stamp.size = std::stoull(value);
+            else if (key == "mtime") planned.stamp.mtime_ns = std::stoll(value);
+        }
+        fs::path rel_src = fs::path(src).lexically_normal();
+        fs::path rel_dst = fs::path(dst).lexically_normal();
+        auto escapes = [](const fs::path& rel) {
+            return rel.empty() || rel.is_absolute() || (!rel.empty() && *rel.begin() == "..");
+        };
+        if (escapes(rel_src) || escapes(rel_dst)) {
+            throw std::runtime_error("Plan line " + std::to_string(line_no) + " points outside the target folder");
+        }
+        planned.source = root / rel_src;
+        planned.destination = root / rel_dst;
+        planned.category = category_id(rel_dst.begin()->string());
+        plan.push_back(std::move(planned));
+    }
+    if (!header_seen) {
+        throw std::runtime_error("Empty plan file: " + file.string());
+    }
+    return plan;
+}
+
+// --- Operation traces: record a real run, replay it later as a benchmark ---
+// Traces use the same NDJSON layout as plans: a header line, then one line per operation with
+// start offset and latency in nanoseconds, the recording thread, paths relative to the root,
+// the resulting errno (0 on success) and a size (file size for stat, entry count for scan):
+//   {"organize_trace":1,"root":"/srv/landing"}
+//   {"t":51234,"lat":1830,"tid":1,"op":"rename","a":"a.pdf","b":"Documents/a.pdf","err":0,"size":0}
+
+/**
+ * @brief One recorded filesystem operation.
+ */
+struct TraceRecord {
+    std::int64_t start_ns = 0;
+    std::int64_t latency_ns = 0;
+    int thread = 0;
+    std::string op;
+    std::string a;
+    std::string b;
+    int err = 0;
+    std::uint64_t size = 0;
+};
+
+/**
+ * @brief Backend wrapper that records every operation it forwards, with its result and latency.
+ */
+class TracingBackend : public FsBackend {
+public:
+    TracingBackend(FsBackend& inner, fs::path root)
+        : inner_(inner), root_(std::move(root)), origin_(std::chrono::steady_clock::now()) {}
+
+    bool make_directory(const fs::path& path, std::error_code& ec) override {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = inner_.make_directory(path, ec);
+        record("mkdir", start, path, {}, ec.value(), 0);
+        return ok;
+    }
+
+    bool list_directory(const fs::path& path, std::vector<fs::directory_entry>& entries, std::error_code& ec) override {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = inner_.list_directory(path, entries, ec);
+        record("scan", start, path, {}, ec.value(), entries.size());
+        return ok;
+    }
+
+    bool stat(const fs::path& path, FileStamp& stamp, std::error_code& ec) override {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = inner_.stat(path, stamp, ec);
+        record("stat", start, path, {}, ec.value(), ok ? stamp.size : 0);
+        return ok;
+    }
+
+    MoveStatus rename(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        auto start = std::chrono::steady_clock::now();
+        MoveStatus status = inner_.rename(from, to, ec);
+        record("rename", start, from, to, status == MoveStatus::Exists ? EEXIST : ec.value(), 0);
+        return status;
+    }
+
+    MoveStatus copy(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        auto start = std::chrono::steady_clock::now();
+        MoveStatus status = inner_.copy(from, to, ec);
+        record("copy", start, from, to, status == MoveStatus::Exists ? EEXIST : ec.value(), 0);
+        return status;
+    }
+
+    bool remove(const fs::path& path, std::error_code& ec) override {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = inner_.remove(path, ec);
+        record("remove", start, path, {}, ec.value(), 0);
+        return ok;
+    }
+
+    /**
+     * @brief Writes the recorded operations to an NDJSON trace file, ordered by start time.
+     */
+    void write(const fs::path& file) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::sort(records_.begin(), records_.end(),
+                  [](const TraceRecord& x, const TraceRecord& y) { return x.start_ns < y.start_ns; });
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Cannot open trace file for writing: " + file.string());
+        }
+        std::string line = "{\"organize_trace\":1,\"root\":";
+        append_json_string(line, root_.string());
+        line += "}\n";
+        out << line;
+        for (const auto& r : records_) {
+            line = "{\"t\":" + std::to_string(r.start_ns) + ",\"lat\":" + std::to_string(r.latency_ns);
+            line += ",\"tid\":" + std::to_string(r.thread) + ",\"op\":";
+            append_json_string(line, r.op);
+            line += ",\"a\":";
+            append_json_string(line, r.a);
+            line += ",\"b\":";
+            append_json_string(line, r.b);
+            line += ",\"err\":" + std::to_string(r.err) + ",\"size\":" + std::to_string(r.size) + "}\n";
+            out << line;
+        }
+        if (!out.flush()) {
+            throw std::runtime_error("Error writing trace file: " + file.string());
+        }
+    }
+
+    std::size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return records_.size();
+    }
+
+private:
+    void record(const char* op, std::chrono::steady_clock::time_point start, const fs::path& a,
+                const fs::path& b, int err, std::uint64_t size) {
+        auto end = std::chrono::steady_clock::now();
+        TraceRecord r;
+        r.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin_).count();
+        r.latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        r.op = op;
+        r.a = a.lexically_relative(root_).generic_string();
+        r.b = b.empty() ? std::string() : b.lexically_relative(root_).generic_string();
+        r.err = err;
+        r.size = size;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto [it, inserted] = threads_.emplace(std::this_thread::get_id(), static_cast<int>(threads_.size()));
+        r.thread = it->second;
+        records_.push_back(std::move(r));
+    }
+
+    FsBackend& inner_;
+    fs::path root_;
+    std::chrono::steady_clock::time_point origin_;
+    std::mutex mutex_;
+    std::vector<TraceRecord> records_;
+    std::unordered_map<std::thread::id, int> threads_;
+};
+
+/**
+ * @brief Reads an NDJSON trace written by TracingBackend::write().
+ */
+std::vector<TraceRecord> read_trace(const fs::path& file) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open trace file: " + file.string());
+    }
+    std::vector<TraceRecord> trace;
+    std::vector<std::pair<std::string, std::string>> fields;
+    std::string line;
+    std::size_t line_no = 0;
+    bool header_seen = false;
+    while (std::getline(in, line)) {
+        ++line_no;
+        if (line.empty()) {
+            continue;
+        }
+        if (!parse_flat_json(line, fields)) {
+            throw std::runtime_error("Malformed trace line " + std::to_string(line_no) + " in " + file.string());
+        }
+        if (!header_seen) {
+            if (fields.empty() || fields[0].first != "organize_trace" || fields[0].second != "1") {
+                throw std::runtime_error("Not an organize trace (version 1): " + file.string());
+            }
+            header_seen = true;
+            continue;
+        }
+        TraceRecord r;
+        for (const auto& [key, value] : fields) {
+            if (key == "t") r.start_ns = std::stoll(value);
+            else if (key == "lat") r.latency_ns = std::stoll(value);
+            else if (key == "tid") r.thread = std::stoi(value);
+            else if (key == "op") r.op = value;
+            else if (key == "a") r.a = value;
+            else if (key == "b") r.b = value;
+            else if (key == "err") r.err = std::stoi(value);
+            else if (key == "size") r.size = std::stoull(value);
+        }
+        for (const std::string* rel : {&r.a, &r.b}) {
+            fs::path p = fs::path(*rel).lexically_normal();
+            if (p.is_absolute() || (!p.empty() && *p.begin() == "..")) {
+                throw std::runtime_error("Trace line " + std::to_string(line_no) + " points outside the root");
+            }
+        }
+        trace.push_back(std::move(r));
+    }
+    if (!header_seen) {
+        throw std::runtime_error("Empty trace file: " + file.string());
+    }
+    return trace;
+}
+
+/**
+ * @brief Recreates the files a trace operated on below `root`, with their recorded sizes.
+ * Files are created sparse, so replaying a trace of a large tree costs little disk space.
+ * Category folders are left for the replayed mkdir operations to create.
+ */
+void build_synthetic_tree(const std::vector<TraceRecord>& trace, const fs::path& root) {
+    std::unordered_map<std::string, bool> seen;
+    for (const auto& r : trace) {
+        if ((r.op == "rename" || r.op == "copy") && !r.b.empty()) {
+            seen.emplace(r.b, false);
+        }
+        if ((r.op != "stat" && r.op != "rename" && r.op != "copy") || r.a.empty()) {
+            continue;
+        }
+        if (!seen.emplace(r.a, true).second || (r.op == "stat" && r.err != 0)) {
+            continue;
+        }
+        fs::path file = root / r.a;
+        fs::create_directories(file.parent_path());
+        std::ofstream(file, std::ios::binary | std::ios::trunc).close();
+        fs::resize_file(file, r.op == "stat" ? r.size : 0);
+    }
+}
+
+/**
+ * @brief Returns the q-quantile (0..1) of a list of latencies, or 0 for an empty list.
+ */
+std::int64_t latency_quantile(std::vector<std::int64_t> values, double q) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::size_t k = static_cast<std::size_t>(q * static_cast<double>(values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(k), values.end());
+    return values[k];
+}
+
+/**
+ * @brief Re-issues a recorded trace against `root` and prints a per-operation latency comparison.
+ * @param backend The backend the operations are replayed through.
+ * @param trace The recorded operations.
+ * @param root The (fresh) directory the trace paths are rebased onto.
+ * @param parallel When true, each recorded thread is replayed on its own thread; an operation
+ *                 only starts once every operation that had finished before it started in the
+ *                 recording has finished again. When false, everything runs on one thread.
+ * @param original_timing When true, each operation is delayed until its recorded start offset.
+ */
+void replay_trace(FsBackend& backend, const std::vector<TraceRecord>& trace, const fs::path& root,
+                  bool parallel, bool original_timing) {
+    const std::size_t n = trace.size();
+    std::vector<std::int64_t> replay_latency(n, 0);
+    std::vector<int> replay_err(n, 0);
+
+    build_synthetic_tree(trace, root);
+
+    std::vector<std::size_t> by_start(n);
+    for (std::size_t i = 0; i < n; ++i) by_start[i] = i;
+    std::stable_sort(by_start.begin(), by_start.end(),
+                     [&](std::size_t x, std::size_t y) { return trace[x].start_ns < trace[y].start_ns; });
+
+    auto origin = std::chrono::steady_clock::now();
+    auto run = [&](std::size_t i) {
+        const TraceRecord& r = trace[i];
+        if (original_timing) {
+            std::this_thread::sleep_until(origin + std::chrono::nanoseconds(r.start_ns));
+        }
+        std::error_code ec;
+        auto start = std::chrono::steady_clock::now();
+        if (r.op == "mkdir") {
+            backend.make_directory(root / r.a, ec);
+        } else if (r.op == "scan") {
+            std::vector<fs::directory_entry> entries;
+            backend.list_directory(root / r.a, entries, ec);
+        } else if (r.op == "stat") {
+            FileStamp stamp;
+            backend.stat(root / r.a, stamp, ec);
+        } else if (r.op == "rename") {
+            if (backend.rename(root / r.a, root / r.b, ec) == MoveStatus::Exists) {
+                ec.assign(EEXIST, std::generic_category());
+            }
+        } else if (r.op == "copy") {
+            if (backend.copy(root / r.a, root / r.b, ec) == MoveStatus::Exists) {
+                ec.assign(EEXIST, std::generic_category());
+            }
+        } else if (r.op == "remove") {
+            backend.remove(root / r.a, ec);
+        }
+        replay_latency[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - start).count();
+        replay_err[i] = ec.value();
+    };
+
+    if (!parallel) {
+        for (std::size_t i : by_start) {
+            run(i);
+        }
+    } else {
+        // Happens-before bookkeeping: `completed` is the length of the longest prefix of the
+        // end-ordered operations that has finished during replay.
+        std::vector<std::size_t> by_end(by_start);
+        std::sort(by_end.begin(), by_end.end(), [&](std::size_t x, std::size_t y) {
+            return trace[x].start_ns + trace[x].latency_ns < trace[y].start_ns + trace[y].latency_ns;
+        });
+        std::vector<std::int64_t> end_times(n);
+        std::vector<std::size_t> end_rank(n);
+        for (std::size_t k = 0; k < n; ++k) {
+            end_times[k] = trace[by_end[k]].start_ns + trace[by_end[k]].latency_ns;
+            end_rank[by_end[k]] = k;
+        }
+        std::vector<char> done(n, 0);
+        std::size_t completed = 0;
+        std::mutex mutex;
+        std::condition_variable cv;
+
+        std::unordered_map<int, std::vector<std::size_t>> per_thread;
+        for (std::size_t i : by_start) {
+            per_thread[trace[i].thread].push_back(i);
+        }
+        std::vector<std::thread> pool;
+        for (auto& [tid, ops] : per_thread) {
+            pool.emplace_back([&, ops_ptr = &ops]() {
+                for (std::size_t i : *ops_ptr) {
+                    std::size_t needed = static_cast<std::size_t>(
+                        std::lower_bound(end_times.begin(), end_times.end(), trace[i].start_ns) - end_times.begin());
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cv.wait(lock, [&] { return completed >= needed; });
+                    }
+                    run(i);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    done[end_rank[i]] = 1;
+                    while (completed < n && done[completed]) {
+                        ++completed;
+                    }
+                    cv.notify_all();
+                }
+            });
+        }
+        for (auto& thread : pool) {
+            thread.join();
+        }
+    }
+    auto wall = std::chrono::steady_clock::now() - origin;
+
+    // Per-operation summary: recorded vs replayed latency and how many results diverged.
+    std::vector<std::string> ops;
+    for (const auto& r : trace) {
+        if (std::find(ops.begin(), ops.end(), r.op) == ops.end()) ops.push_back(r.op);
+    }
+    std::cout << "Replayed " << n << " operations in "
+              << std::chrono::duration_cast<std::chrono::microseconds>(wall).count() / 1000.0 << " ms ("
+              << (parallel ? "parallel" : "sync") << ", " << (original_timing ? "original timing" : "as fast as possible")
+              << ")." << std::endl;
+    for (const auto& op : ops) {
+        std::vector<std::int64_t> recorded, replayed;
+        std::size_t mismatches = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            if (trace[i].op != op) continue;
+            recorded.push_back(trace[i].latency_ns);
+            replayed.push_back(replay_latency[i]);
+            if (trace[i].err != replay_err[i]) ++mismatches;
+        }
+        std::cout << "  " << op << ": " << recorded.size() << " ops, p50 " << latency_quantile(recorded, 0.5) / 1000.0
+                  << " -> " << latency_quantile(replayed, 0.5) / 1000.0 << " us, p99 "
+                  << latency_quantile(recorded, 0.99) / 1000.0 << " -> " << latency_quantile(replayed, 0.99) / 1000.0
+                  << " us, " << mismatches << " result mismatches" << std::endl;
+    }
+}
+
+// --- Fault injection: drive the engine's error paths with randomized failures ---
+// A fault spec is a comma-separated list of "<op>:<ERRNO>=<probability>" and
+// "<op>:latency=<microseconds>" items, where <op> is mkdir, scan, stat, rename, copy, remove or *.
+// Example: "rename:EXDEV=0.3,copy:ENOSPC=0.05,*:EINTR=0.02,rename:latency=200"
+
+struct FaultRule {
+    std::string op;
+    int err = 0;                 // 0 for a latency rule
+    double probability = 0.0;
+    std::int64_t latency_us = 0;
+};
+
+const std::unordered_map<std::string, int> FAULT_ERRNOS = {
+    {"ENOSPC", ENOSPC}, {"EIO", EIO}, {"EXDEV", EXDEV}, {"EINTR", EINTR},
+    {"EACCES", EACCES}, {"ENOENT", ENOENT}, {"EBUSY", EBUSY},
+};
+
+/**
+ * @brief Parses a fault spec string into rules.
+ * @throws std::runtime_error on malformed items.
+ */
+std::vector<FaultRule> parse_fault_spec(std::string_view spec) {
+    static const std::vector<std::string_view> ops = {"mkdir", "scan", "stat", "rename", "copy", "remove", "*"};
+    std::vector<FaultRule> rules;
+    while (!spec.empty()) {
+        std::size_t comma = spec.find(',');
+        std::string_view item = spec.substr(0, comma);
+        spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+        if (item.empty()) continue;
+
+        std::size_t colon = item.find(':');
+        std::size_t equals = item.find('=');
+        if (colon == std::string_view::npos || equals == std::string_view::npos || equals < colon) {
+            throw std::runtime_error("Malformed fault rule '" + std::string(item) + "'.");
+        }
+        FaultRule rule;
+        rule.op = std::string(item.substr(0, colon));
+        std::string name(item.substr(colon + 1, equals - colon - 1));
+        std::string value(item.substr(equals + 1));
+        if (std::find(ops.begin(), ops.end(), rule.op) == ops.end()) {
+            throw std::runtime_error("Unknown operation '" + rule.op + "' in fault rule.");
+        }
+        if (name == "latency") {
+            rule.latency_us = std::stoll(value);
+        } else {
+            auto it = FAULT_ERRNOS.find(name);
+            if (it == FAULT_ERRNOS.end()) {
+                throw std::runtime_error("Unsupported error '" + name + "' in fault rule.");
+            }
+            rule.err = it->second;
+            rule.probability = std::stod(value);
+        }
+        rules.push_back(std::move(rule));
+    }
+    return rules;
+}
+
+/**
+ * @brief Backend wrapper that fails or delays operations at configurable rates before they
+ * reach the real filesystem. An injected failure never performs the underlying operation.
+ */
+class FaultInjectingBackend : public FsBackend {
+public:
+    FaultInjectingBackend(FsBackend& inner, std::vector<FaultRule> rules, std::uint64_t seed)
+        : inner_(inner), rules_(std::move(rules)), rng_(seed) {}
+
+    bool make_directory(const fs::path& path, std::error_code& ec) override {
+        return !inject("mkdir", ec) && inner_.make_directory(path, ec);
+    }
+
+    bool list_directory(const fs::path& path, std::vector<fs::directory_entry>& entries, std::error_code& ec) override {
+        return !inject("scan", ec) && inner_.list_directory(path, entries, ec);
+    }
+
+    bool stat(const fs::path& path, FileStamp& stamp, std::error_code& ec) override {
+        return !inject("stat", ec) && inner_.stat(path, stamp, ec);
+    }
+
+    MoveStatus rename(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        return inject("rename", ec) ? MoveStatus::Failed : inner_.rename(from, to, ec);
+    }
+
+    MoveStatus copy(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        return inject("copy", ec) ? MoveStatus::Failed : inner_.copy(from, to, ec);
+    }
+
+    bool remove(const fs::path& path, std::error_code& ec) override {
+        return !inject("remove", ec) && inner_.remove(path, ec);
+    }
+
+    std::size_t injected() const { return injected_.load(); }
+
+private:
+    bool inject(const char* op, std::error_code& ec) {
+        double roll;
+        {
+            std::lock_guard<std::mutex> lock(rng_mutex_);
+            roll = std::uniform_real_distribution<double>(0.0, 1.0)(rng_);
+        }
+        for (const auto& rule : rules_) {
+            if (rule.op != "*" && rule.op != op) continue;
+            if (rule.latency_us > 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(rule.latency_us));
+            } else if (roll < rule.probability) {
+                ++injected_;
+                ec.assign(rule.err, std::generic_category());
+                return true;
+            } else {
+                roll -= rule.probability;
+            }
+        }
+        return false;
+    }
+
+    FsBackend& inner_;
+    std::vector<FaultRule> rules_;
+    std::mutex rng_mutex_;
+    std::mt19937_64 rng_;
+    std::atomic<std::size_t> injected_{0};
+};
+
+/**
+ * @brief Reads a whole (small) file into a string.
+ */
+std::string read_small_file(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+/**
+ * @brief Runs randomized organize passes under injected faults and checks the engine's
+ * invariants after each one: every original file exists exactly once, nothing unexpected
+ * (such as a partial copy) was left behind, and no pre-existing file was overwritten.
+ * @param scratch An empty directory the runs are created in.
+ * @param runs Number of randomized runs.
+ * @param seed Seed for tree layout, fault rates and thread counts.
+ * @param fixed_rules When non-empty, used for every run instead of randomized fault rates.
+ * @return The number of runs that violated an invariant; their trees are kept for inspection.
+ */
+std::size_t run_stress(const fs::path& scratch, std::size_t runs, std::uint64_t seed,
+                       const std::vector<FaultRule>& fixed_rules) {
+    static const std::vector<std::string> stems = {"image", "download", "Untitled", "report_v1", "IMG_0001", "a", "b", "notes"};
+    static const std::vector<std::string> exts = {".png", ".PDF", ".txt", ".zip", ".mp3", ".mkv", ".weird", ".tar.gz", ""};
+    std::mt19937_64 rng(seed);
+    auto pick = [&](std::size_t n) { return static_cast<std::size_t>(std::uniform_int_distribution<std::size_t>(0, n - 1)(rng)); };
+    auto chance = [&](double p) { return std::uniform_real_distribution<double>(0.0, 1.0)(rng) < p; };
+
+    SyncBackend sync_backend;
+    std::size_t violations = 0, total_files = 0, total_injected = 0;
+    bool was_quiet = g_quiet;
+    g_quiet = true;
+
+    for (std::size_t run = 0; run < runs; ++run) {
+        fs::path dir = scratch / ("run-" + std::to_string(run));
+        fs::create_directories(dir);
+
+        // Build a random tree: loose files plus some same-named files already in category folders.
+        std::unordered_map<std::string, int> expected;          // content -> expected copies
+        std::unordered_map<std::string, std::string> preexisting; // path -> content
+        std::size_t files = 1 + pick(60);
+        for (std::size_t f = 0; f < files; ++f) {
+            std::string name = stems[pick(stems.size())] + std::to_string(pick(4)) + exts[pick(exts.size())];
+            if (fs::exists(dir / name)) continue;
+            std::string content = "file:" + std::to_string(f) + "\n";
+            std::ofstream(dir / name, std::ios::binary) << content;
+            expected[content] = 1;
+            if (chance(0.2)) {
+                fs::path clash = dir / get_target_folder(fs::path(name).extension().string()) / name;
+                if (!fs::path(name).extension().empty() && !fs::exists(clash)) {
+                    fs::create_directories(clash.parent_path());
+                    std::string pre = "pre:" + std::to_string(f) + "\n";
+                    std::ofstream(clash, std::ios::binary) << pre;
+                    expected[pre] = 1;
+                    preexisting[clash.string()] = pre;
+                }
+            }
+        }
+        total_files += expected.size();
+
+        std::vector<FaultRule> rules = fixed_rules;
+        if (rules.empty()) {
+            auto rate = [&](double max) { return std::uniform_real_distribution<double>(0.0, max)(rng); };
+            rules = {
+                {"rename", EXDEV, rate(0.5), 0}, {"rename", EINTR, rate(0.2), 0}, {"rename", EIO, rate(0.05), 0},
+                {"copy", ENOSPC, rate(0.1), 0},  {"copy", EINTR, rate(0.2), 0},   {"remove", EIO, rate(0.1), 0},
+                {"remove", EINTR, rate(0.2), 0}, {"stat", EIO, rate(0.05), 0},    {"mkdir", EINTR, rate(0.01), 0},
+            };
+        }
+        FaultInjectingBackend faulty(sync_backend, rules, rng());
+        unsigned jobs = 1 + static_cast<unsigned>(pick(8));
+        try {
+            organize_files(dir, fs::path(), faulty, jobs);
+        } catch (const std::exception&) {
+            // An aborted run is fine as long as the invariants still hold.
+        }
+        total_injected += faulty.injected();
+
+        // Check invariants.
+        std::vector<std::string> problems;
+        std::unordered_map<std::string, int> seen;
+        for (const auto& entry : fs::recursive_directory_iterator(dir)) {
+            if (!entry.is_regular_file()) continue;
+            std::string content = read_small_file(entry.path());
+            if (!expected.count(content)) {
+                problems.push_back("unexpected file '" + entry.path().string() + "'");
+            }
+            ++seen[content];
+        }
+        for (const auto& [content, count] : expected) {
+            int got = seen.count(content) ? seen[content] : 0;
+            if (got == 0) problems.push_back("lost file with content '" + content.substr(0, content.size() - 1) + "'");
+            if (got > 1) problems.push_back("duplicated file with content '" + content.substr(0, content.size() - 1) + "'");
+        }
+        for (const auto& [path, content] : preexisting) {
+            if (read_small_file(path) != content) {
+                problems.push_back("overwrote existing file '" + path + "'");
+            }
+        }
+
+        if (problems.empty()) {
+            fs::remove_all(dir);
+        } else {
+            ++violations;
+            for (const auto& problem : problems) {
+                std::cerr << "Stress run " << run << ": " << problem << std::endl;
+            }
+        }
+    }
+
+    g_quiet = was_quiet;
+    std::cout << "Stress: " << runs << " runs, " << total_files << " files, " << total_injected
+              << " injected faults, " << violations << " runs with invariant violations." << std::endl;
+    return violations;
+}
+
+// --- Separate destinations: moves decided by device, replicas written in one read ---
+
+/**
+ * @brief Backend for runs whose category folders live under their own root (--dest). The
+ * device of every directory involved is stat'ed once and cached, so a move between devices
+ * goes straight to the (pipelined) copy instead of first trying a rename that can only fail
+ * with EXDEV, and a move within one device stays a rename. Everything else is passed on.
+ */
+class DeviceRoutingBackend final : public FsBackend {
+public:
+    explicit DeviceRoutingBackend(FsBackend& inner) : inner_(inner) {}
+
+    bool make_directory(const fs::path& path, std::error_code& ec) override { return inner_.make_directory(path, ec); }
+    bool list_directory(const fs::path& path, std::vector<fs::directory_entry>& entries, std::error_code& ec) override {
+        return inner_.list_directory(path, entries, ec);
+    }
+    bool stat(const fs::path& path, FileStamp& stamp, std::error_code& ec) override { return inner_.stat(path, stamp, ec); }
+
+    MoveStatus rename(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        std::uint64_t from_device, to_device;
+        if (device_of(from.parent_path(), from_device) && device_of(to.parent_path(), to_device) &&
+            from_device != to_device) {
+            ec = std::make_error_code(std::errc::cross_device_link);
+            return MoveStatus::Failed;
+        }
+        MoveStatus status = inner_.rename(from, to, ec);
+        if (status == MoveStatus::Moved) ++renamed_;
+        return status;
+    }
+
+    MoveStatus copy(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        MoveStatus status = inner_.copy(from, to, ec);
+        if (status == MoveStatus::Moved) ++copied_;
+        return status;
+    }
+
+    bool remove(const fs::path& path, std::error_code& ec) override { return inner_.remove(path, ec); }
+
+    std::size_t renamed() const { return renamed_.load(); }
+    std::size_t copied() const { return copied_.load(); }
+
+private:
+    /**
+     * @brief Looks up the device of a directory, stat'ing it the first time only.
+     * @return false if the directory cannot be stat'ed; the caller then just tries a rename.
+     */
+    bool device_of(const fs::path& dir, std::uint64_t& device) {
+#ifndef _WIN32
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = devices_.find(dir.native());
+            if (it != devices_.end()) {
+                device = it->second;
+                return true;
+            }
+        }
+        struct stat st;
+        if (::stat(dir.c_str(), &st) != 0) {
+            return false;
+        }
+        device = static_cast<std::uint64_t>(st.st_dev);
+        std::lock_guard<std::mutex> lock(mutex_);
+        devices_.emplace(dir.native(), device);
+        return true;
+#else
+        (void)dir;
+        (void)device;
+        return false;
+#endif
+    }
+
+    FsBackend& inner_;
+    std::mutex mutex_;
+    std::unordered_map<fs::path::string_type, std::uint64_t> devices_;
+    std::atomic<std::size_t> renamed_{0};
+    std::atomic<std::size_t> copied_{0};
+};
+
+#ifndef _WIN32
+/**
+ * @brief Backend for runs with several destination roots (--dest given more than once): the
+ * engine plans into the first root, and every file moved there is read once and written to
+ * the same place below every root by tee_contents(). Each copy is written to a temporary file,
+ * fsync'ed and moved into place without clobbering, as copy_no_clobber() does. Each root
+ * handles its own conflicts and failures. A matching file (same size and mtime) already in place counts as replicated, so a
+ * run that failed on one root only rewrites that root next time. Otherwise a name taken in
+ * the first root is reported as Exists for the engine's conflict policy, before any root is
+ * written, while a name taken in another root is suffixed there ("name (2).ext"). A failure
+ * on one root does not stop the others; the source is removed only when every root has it.
+ */
+class ReplicatingBackend final : public FsBackend {
+public:
+    static constexpr int kMaxSuffix = 1000;
+
+    struct ReplicaCounts {
+        std::atomic<std::size_t> written{0}, present{0}, renamed{0}, failed{0};
+    };
+
+    ReplicatingBackend(FsBackend& inner, std::vector<fs::path> roots)
+        : inner_(inner), roots_(std::move(roots)), counts_(roots_.size()) {}
+
+    bool make_directory(const fs::path& path, std::error_code& ec) override {
+        if (!inner_.make_directory(path, ec)) return false;
+        fs::path relative;
+        if (!primary_relative(path, relative)) return true;
+        for (std::size_t k = 1; k < roots_.size(); ++k) {
+            if (!inner_.make_directory(roots_[k] / relative, ec)) return false;
+        }
+        return true;
+    }
+    bool list_directory(const fs::path& path, std::vector<fs::directory_entry>& entries, std::error_code& ec) override {
+        return inner_.list_directory(path, entries, ec);
+    }
+    bool stat(const fs::path& path, FileStamp& stamp, std::error_code& ec) override { return inner_.stat(path, stamp, ec); }
+
+    MoveStatus rename(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        fs::path relative;
+        if (!primary_relative(to, relative)) return inner_.rename(from, to, ec);
+        MoveStatus status = replicate(from, to, relative, ec);
+        if (status == MoveStatus::Moved && !inner_.remove(from, ec)) {
+            return MoveStatus::Failed;  // every root has the file; the next run takes it from there
+        }
+        return status;
+    }
+
+    MoveStatus copy(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        fs::path relative;
+        return primary_relative(to, relative) ? replicate(from, to, relative, ec) : inner_.copy(from, to, ec);
+    }
+
+    bool remove(const fs::path& path, std::error_code& ec) override { return inner_.remove(path, ec); }
+
+    /**
+     * @brief Prints per root what was written, already there, renamed and failed.
+     */
+    void print(std::ostream& out) const {
+        for (std::size_t k = 0; k < roots_.size(); ++k) {
+            const ReplicaCounts& c = counts_[k];
+            out << "Replica '" << roots_[k].string() << "': " << c.written << " written, " << c.present
+                << " already there, " << c.renamed << " renamed, " << c.failed << " failed." << std::endl;
+        }
+    }
+
+private:
+    bool primary_relative(const fs::path& path, fs::path& relative) const {
+        relative = path.lexically_relative(roots_[0]);
+        return !relative.empty() && *relative.begin() != ".." && *relative.begin() != ".";
+    }
+
+    MoveStatus replicate(const fs::path& from, const fs::path& to, const fs::path& relative, std::error_code& ec) {
+        ec.clear();
+        int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (in < 0 || ::fstat(in, &st) != 0) {
+            ec.assign(errno, std::generic_category());
+            if (in >= 0) ::close(in);
+            return MoveStatus::Failed;
+        }
+        FileStamp source;
+        stamp_from_stat(st, source);
+
+        // Pick a name below every root before any data is written. Each replica is written to a
+        // temporary file beside it and moved into place only once it is complete and durable, so
+        // an interrupted run never leaves a partial file under a real name.
+        std::vector<fs::path> paths(roots_.size());
+        std::vector<fs::path> temps(roots_.size());
+        std::vector<int> suffixes(roots_.size(), 0);
+        std::vector<int> fds(roots_.size(), -1);
+        std::vector<int> errors(roots_.size(), 0);
+        std::string stem = to.stem().string();
+        std::string ext = to.extension().string();
+        auto candidate = [&](std::size_t k, int n) {
+            fs::path base = k == 0 ? to : roots_[k] / relative;
+            return n == 1 ? base : base.parent_path() / (stem + " (" + std::to_string(n) + ")" + ext);
+        };
+        for (std::size_t k = 0; k < roots_.size(); ++k) {
+            bool present = false;
+            for (int n = 1; n <= kMaxSuffix; ++n) {
+                paths[k] = candidate(k, n);
+                suffixes[k] = n;
+                struct stat existing;
+                if (::lstat(paths[k].c_str(), &existing) != 0) {
+                    if (errno != ENOENT) errors[k] = errno;
+                    break;
+                }
+                // A file that matches in size and mtime is only taken as replicated by an earlier
+                // run once its contents match too; anything else is a name conflict.
+                FileStamp there;
+                std::error_code ignored;
+                if (read_file_stamp(paths[k], there, ignored) && there.size == source.size &&
+                    there.mtime_ns == source.mtime_ns && same_contents(in, paths[k], source.size)) {
+                    present = true;
+                    break;
+                }
+                if (k == 0) {
+                    ::close(in);
+                    return MoveStatus::Exists;
+                }
+                if (n == kMaxSuffix) errors[k] = EEXIST;
+            }
+            if (present || errors[k] != 0) continue;
+            temps[k] = copy_temp_path(paths[k].parent_path());
+            fds[k] = ::open(temps[k].c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+            if (fds[k] < 0) errors[k] = errno;
+        }
+
+        std::vector<int> outs;
+        std::vector<std::size_t> targets;
+        for (std::size_t k = 0; k < roots_.size(); ++k) {
+            if (fds[k] >= 0) {
+                outs.push_back(fds[k]);
+                targets.push_back(k);
+            } else if (errors[k] == 0) {
+                ++counts_[k].present;
+            }
+        }
+        if (!outs.empty()) {
+            std::vector<int> write_errors;
+            tee_contents(in, outs, write_errors, source.size);
+            for (std::size_t j = 0; j < outs.size(); ++j) {
+                std::size_t k = targets[j];
+                errors[k] = write_errors[j];
+                if (errors[k] == 0 && !copy_metadata(in, outs[j], st)) {
+                    ++g_metadata_losses;
+                }
+                // Every replica must be durable before rename() removes the source.
+                if (errors[k] == 0 && ::fsync(outs[j]) != 0) {
+                    errors[k] = errno;
+                }
+                if (::close(outs[j]) != 0 && errors[k] == 0) {
+                    errors[k] = errno;
+                }
+            }
+            // Complete copies go into place, the primary first: if its name was taken meanwhile,
+            // nothing has been placed yet and the engine's conflict policy decides.
+            for (std::size_t k : targets) {
+                if (errors[k] != 0) {
+                    ::unlink(temps[k].c_str());
+                    continue;
+                }
+                std::error_code move_ec;
+                MoveStatus status = move_no_clobber(temps[k], paths[k], move_ec);
+                while (status == MoveStatus::Exists && k > 0 && suffixes[k] < kMaxSuffix) {
+                    paths[k] = candidate(k, ++suffixes[k]);
+                    status = move_no_clobber(temps[k], paths[k], move_ec);
+                }
+                if (status == MoveStatus::Exists && k == 0) {
+                    for (std::size_t other : targets) ::unlink(temps[other].c_str());
+                    ::close(in);
+                    return MoveStatus::Exists;
+                }
+                if (status != MoveStatus::Moved) {
+                    errors[k] = status == MoveStatus::Exists ? EEXIST : move_ec.value();
+                    ::unlink(temps[k].c_str());
+                    continue;
+                }
+                if ((errors[k] = fsync_directory(paths[k].parent_path())) != 0) {
+                    ::unlink(paths[k].c_str());
+                    continue;
+                }
+                if (suffixes[k] > 1) ++counts_[k].renamed;
+                ++counts_[k].written;
+            }
+        }
+        ::close(in);
+
+        for (std::size_t k = 0; k < roots_.size(); ++k) {
+            if (errors[k] == 0) continue;
+            ++counts_[k].failed;
+            if (!ec) ec.assign(errors[k], std::generic_category());
+            if (!g_quiet) {
+                std::lock_guard<std::mutex> lock(g_console_mutex);
+                std::cerr << "Error: replica '" << roots_[k].string() << "' failed for '" << from.filename().string()
+                          << "': " << std::strerror(errors[k]) << std::endl;
+            }
+        }
+        return ec ? MoveStatus::Failed : MoveStatus::Moved;
+    }
+
+    FsBackend& inner_;
+    std::vector<fs::path> roots_;
+    std::vector<ReplicaCounts> counts_;
+};
+#endif
+
+// --- Admission control: keep destination volumes above a free-space watermark ---
+// Renames within a volume need no space; copies (the EXDEV fallback) need the file's size and an
+// inode on the destination. AdmissionBackend reserves both before each copy against a cached
+// statvfs snapshot per volume, less what finished copies and in-flight reservations have taken
+// since. The snapshot is refreshed on a timer or after a number of admissions, never per file.
+
+/**
+ * @brief Free-space floor a destination volume must keep.
+ */
+struct Watermark {
+    std::uint64_t bytes = 0;   // absolute floor
+    double percent = 0.0;      // floor as a share of the volume size; the larger floor applies
+    std::uint64_t inodes = 0;
+};
+
+/**
+ * @brief Parses "<n>[K|M|G|T]" (binary units) or "<p>%" into a watermark's byte floor.
+ * @throws std::runtime_error on malformed input.
+ */
+void parse_watermark(std::string_view spec, Watermark& watermark) {
+    std::string text(spec);
+    std::size_t used = 0;
+    double number = 0;
+    try {
+        number = std::stod(text, &used);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    std::string_view unit = spec.substr(used);
+    if (used == 0 || number < 0 || unit.size() > 1) {
+        throw std::runtime_error("Bad free-space watermark '" + text + "'; use e.g. '5%' or '10G'.");
+    }
+    if (unit == "%") {
+        watermark.percent = number;
+        return;
+    }
+    double scale = 1;
+    if (!unit.empty()) {
+        std::size_t power = std::string_view("KMGT").find(static_cast<char>(std::toupper(static_cast<unsigned char>(unit[0]))));
+        if (power == std::string_view::npos) {
+            throw std::runtime_error("Bad free-space watermark '" + text + "'; use e.g. '5%' or '10G'.");
+        }
+        scale = std::ldexp(1.0, 10 * static_cast<int>(power + 1));
+    }
+    watermark.bytes = static_cast<std::uint64_t>(number * scale);
+}
+
+/**
+ * @brief Error code category for operations refused by admission control.
+ */
+class AdmissionCategory : public std::error_category {
+public:
+    const char* name() const noexcept override { return "admission"; }
+    std::string message(int) const override { return "deferred, destination would drop below its free-space watermark"; }
+};
+
+const std::error_category& admission_category() {
+    static const AdmissionCategory category;
+    return category;
+}
+
+/**
+ * @brief Space left on the volume holding `dir`, and an id for the volume.
+ */
+struct VolumeSpace {
+    std::uint64_t device = 0;
+    std::uint64_t total_bytes = 0;
+    std::uint64_t free_bytes = 0;
+    std::uint64_t free_inodes = 0;
+};
+
+bool read_volume_space(const fs::path& dir, VolumeSpace& space, std::error_code& ec) {
+#ifndef _WIN32
+    struct stat st;
+    struct statvfs vfs;
+    if (::stat(dir.c_str(), &st) != 0 || ::statvfs(dir.c_str(), &vfs) != 0) {
+        ec.assign(errno, std::generic_category());
+        return false;
+    }
+    space.device = static_cast<std::uint64_t>(st.st_dev);
+    space.total_bytes = static_cast<std::uint64_t>(vfs.f_blocks) * vfs.f_frsize;
+    space.free_bytes = static_cast<std::uint64_t>(vfs.f_bavail) * vfs.f_frsize;
+    space.free_inodes = static_cast<std::uint64_t>(vfs.f_favail);
+#else
+    fs::space_info info = fs::space(dir, ec);
+    if (ec) return false;
+    space.device = std::hash<std::string>{}(dir.root_name().string());
+    space.total_bytes = info.capacity;
+    space.free_bytes = info.available;
+    space.free_inodes = UINT64_MAX; // no inode limit to speak of
+#endif
+    ec.clear();
+    return true;
+}
+
+/**
+ * @brief Backend decorator that admits a copy only if its destination volume keeps the
+ * watermark afterwards. Refused copies fail with an admission_category() error before the
+ * destination is touched, so the file simply stays where it is until a later run.
+ */
+class AdmissionBackend final : public FsBackend {
+public:
+    AdmissionBackend(FsBackend& inner, Watermark watermark,
+                     std::chrono::steady_clock::duration refresh = std::chrono::seconds(1))
+        : inner_(inner), watermark_(watermark), refresh_(refresh) {}
+
+    bool make_directory(const fs::path& path, std::error_code& ec) override { return inner_.make_directory(path, ec); }
+    bool list_directory(const fs::path& path, std::vector<fs::directory_entry>& entries, std::error_code& ec) override {
+        return inner_.list_directory(path, entries, ec);
+    }
+    bool stat(const fs::path& path, FileStamp& stamp, std::error_code& ec) override { return inner_.stat(path, stamp, ec); }
+    MoveStatus rename(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        return inner_.rename(from, to, ec);
+    }
+    bool remove(const fs::path& path, std::error_code& ec) override { return inner_.remove(path, ec); }
+
+    MoveStatus copy(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        FileStamp stamp;
+        if (!inner_.stat(from, stamp, ec)) return MoveStatus::Failed;
+        Volume* volume = volume_for(to.parent_path(), ec);
+        if (!volume) return MoveStatus::Failed;
+        if (!admit(*volume, stamp.size)) {
+            ++deferred_;
+            deferred_bytes_ += stamp.size;
+            ec.assign(1, admission_category());
+            return MoveStatus::Failed;
+        }
+        MoveStatus status = inner_.copy(from, to, ec);
+        settle(*volume, stamp.size, status == MoveStatus::Moved);
+        return status;
+    }
+
+    std::size_t deferred() const { return deferred_.load(); }
+    std::uint64_t deferred_bytes() const { return deferred_bytes_.load(); }
+
+private:
+    // Refresh at least this often while copies keep coming, even within the refresh interval.
+    static constexpr unsigned kAdmissionsPerRefresh = 1024;
+
+    struct Volume {
+        std::mutex mutex;
+        fs::path probe;  // a directory on the volume, for statvfs
+        VolumeSpace space;
+        std::chrono::steady_clock::time_point taken;
+        unsigned admissions = 0;
+        std::uint64_t committed_bytes = 0;  // finished copies since the snapshot
+        std::uint64_t committed_inodes = 0;
+        std::uint64_t reserved_bytes = 0;   // copies in flight
+        std::uint64_t reserved_inodes = 0;
+    };
+
+    Volume* volume_for(const fs::path& dir, std::error_code& ec) {
+        std::lock_guard<std::mutex> lock(volumes_mutex_);
+        auto known = by_directory_.find(dir.native());
+        if (known != by_directory_.end()) return known->second;
+        VolumeSpace space;
+        if (!read_volume_space(dir, space, ec)) return nullptr;
+        std::unique_ptr<Volume>& volume = by_device_[space.device];
+        if (!volume) {
+            volume = std::make_unique<Volume>();
+            volume->probe = dir;
+            volume->space = space;
+            volume->taken = std::chrono::steady_clock::now();
+        }
+        by_directory_.emplace(dir.native(), volume.get());
+        return volume.get();
+    }
+
+    bool admit(Volume& volume, std::uint64_t bytes) {
+        std::lock_guard<std::mutex> lock(volume.mutex);
+        auto now = std::chrono::steady_clock::now();
+        if (now - volume.taken >= refresh_ || ++volume.admissions >= kAdmissionsPerRefresh) {
+            std::error_code ec;
+            VolumeSpace fresh;
+            if (read_volume_space(volume.probe, fresh, ec)) {
+                // Finished copies are in the new numbers; in-flight ones are partly, so their
+                // reservations stay and err on the safe side.
+                volume.space = fresh;
+                volume.committed_bytes = 0;
+                volume.committed_inodes = 0;
+            }
+            volume.taken = now;
+            volume.admissions = 0;
+        }
+        auto left = [](std::uint64_t free, std::uint64_t used) { return free > used ? free - used : 0; };
+        std::uint64_t free_bytes = left(volume.space.free_bytes, volume.committed_bytes + volume.reserved_bytes);
+        std::uint64_t free_inodes = left(volume.space.free_inodes, volume.committed_inodes + volume.reserved_inodes);
+        std::uint64_t floor = std::max(watermark_.bytes, static_cast<std::uint64_t>(
+                                                             watermark_.percent / 100.0 * static_cast<double>(volume.space.total_bytes)));
+        if (free_bytes < floor || free_bytes - floor < bytes || free_inodes <= watermark_.inodes) {
+            return false;
+        }
+        volume.reserved_bytes += bytes;
+        ++volume.reserved_inodes;
+        return true;
+    }
+
+    void settle(Volume& volume, std::uint64_t bytes, bool written) {
+        std::lock_guard<std::mutex> lock(volume.mutex);
+        volume.reserved_bytes -= bytes;
+        --volume.reserved_inodes;
+        if (written) {
+            volume.committed_bytes += bytes;
+            ++volume.committed_inodes;
+        }
+    }
+
+    FsBackend& inner_;
+    Watermark watermark_;
+    std::chrono::steady_clock::duration refresh_;
+    std::mutex volumes_mutex_;
+    std::unordered_map<fs::path::string_type, Volume*> by_directory_;
+    std::unordered_map<std::uint64_t, std::unique_ptr<Volume>> by_device_;
+    std::atomic<std::size_t> deferred_{0};
+    std::atomic<std::uint64_t> deferred_bytes_{0};
+};
+
+// --- S3 destination: upload organized files straight into an S3-compatible bucket ---
+// With --s3 s3://bucket/prefix, the category folders become key prefixes ("prefix/Images/a.jpg")
+// and "moving" a file means uploading it and deleting the local copy once the bucket has
+// confirmed it. Requests are plain HTTP/1.1 on kept-alive connections, signed with AWS
+// Signature Version 4, so any S3-compatible store (MinIO, a local mock) works; for AWS itself
+// put a TLS proxy in front. Files larger than a part are uploaded as multipart uploads whose
+// parts go out in parallel, each from a buffer of a fixed pool, so memory stays bounded
+// however many and however large the files are.
+
+#ifndef _WIN32
+
+/**
+ * @brief SHA-256 (FIPS 180-4), for request signing.
+ */
+class Sha256 {
+public:
+    void update(const void* data, std::size_t len) {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        length_ += len;
+        if (buffered_ > 0) {
+            std::size_t take = std::min(len, sizeof(buffer_) - buffered_);
+            std::memcpy(buffer_ + buffered_, bytes, take);
+            buffered_ += take;
+            bytes += take;
+            len -= take;
+            if (buffered_ < sizeof(buffer_)) return;
+            block(buffer_);
+            buffered_ = 0;
+        }
+        for (; len >= sizeof(buffer_); bytes += sizeof(buffer_), len -= sizeof(buffer_)) block(bytes);
+        std::memcpy(buffer_, bytes, len);
+        buffered_ = len;
+    }
+
+    /**
+     * @brief Finishes the hash and returns the 32 raw digest bytes.
+     */
+    std::string digest() {
+        std::uint64_t bits = length_ * 8;
+        unsigned char pad[72] = {0x80};
+        std::size_t pad_len = (buffered_ < 56 ? 56 : 120) - buffered_;
+        for (int i = 0; i < 8; ++i) pad[pad_len + i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+        update(pad, pad_len + 8);
+        std::string out(32, '\0');
+        for (int i = 0; i < 8; ++i) {
+            for (int j = 0; j < 4; ++j) out[4 * i + j] = static_cast<char>(state_[i] >> (24 - 8 * j));
+        }
+        return out;
+    }
+
+    static std::string hash(std::string_view data) {
+        Sha256 sha;
+        sha.update(data.data(), data.size());
+        return sha.digest();
+    }
+
+private:
+    static std::uint32_t rotr(std::uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void block(const unsigned char* p) {
+        static const std::uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        std::uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (std::uint32_t(p[4 * i]) << 24) | (std::uint32_t(p[4 * i + 1]) << 16) |
+                   (std::uint32_t(p[4 * i + 2]) << 8) | std::uint32_t(p[4 * i + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            std::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            std::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        std::uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+        std::uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+        for (int i = 0; i < 64; ++i) {
+            std::uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            std::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+        state_[4] += e;
+        state_[5] += f;
+        state_[6] += g;
+        state_[7] += h;
+    }
+
+    std::uint32_t state_[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                               0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char buffer_[64];
+    std::size_t buffered_ = 0;
+    std::uint64_t length_ = 0;
+};
+
+std::string hmac_sha256(std::string_view key, std::string_view message) {
+    std::string block(64, '\0');
+    if (key.size() > block.size()) {
+        std::string hashed = Sha256::hash(key);
+        std::memcpy(block.data(), hashed.data(), hashed.size());
+    } else {
+        std::memcpy(block.data(), key.data(), key.size());
+    }
+    std::string inner = block, outer = block;
+    for (std::size_t i = 0; i < block.size(); ++i) {
+        inner[i] = static_cast<char>(inner[i] ^ 0x36);
+        outer[i] = static_cast<char>(outer[i] ^ 0x5c);
+    }
+    return Sha256::hash(outer + Sha256::hash(inner.append(message)));
+}
+
+std::string to_hex(std::string_view bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(bytes.size() * 2);
+    for (unsigned char c : bytes) {
+        out += digits[c >> 4];
+        out += digits[c & 0xF];
+    }
+    return out;
+}
+
+std::string to_base64(std::string_view bytes) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((bytes.size() + 2) / 3 * 4);
+    for (std::size_t i = 0; i < bytes.size(); i += 3) {
+        std::uint32_t n = static_cast<std::uint32_t>(static_cast<unsigned char>(bytes[i])) << 16;
+        if (i + 1 < bytes.size()) n |= static_cast<std::uint32_t>(static_cast<unsigned char>(bytes[i + 1])) << 8;
+        if (i + 2 < bytes.size()) n |= static_cast<unsigned char>(bytes[i + 2]);
+        out += digits[(n >> 18) & 63];
+        out += digits[(n >> 12) & 63];
+        out += i + 1 < bytes.size() ? digits[(n >> 6) & 63] : '=';
+        out += i + 2 < bytes.size() ? digits[n & 63] : '=';
+    }
+    return out;
+}
+
+/**
+ * @brief Percent-encodes everything but the unreserved characters (and '/' if `keep_slash`),
+ * the way Signature Version 4 expects object keys and query values.
+ */
+std::string uri_encode(std::string_view text, bool keep_slash) {
+    static const char digits[] = "0123456789ABCDEF";
+    std::string out;
+    for (unsigned char c : text) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || (keep_slash && c == '/')) {
+            out += static_cast<char>(c);
+        } else {
+            out += '%';
+            out += digits[c >> 4];
+            out += digits[c & 0xF];
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Error code category for S3 requests that got an HTTP error status; the value is
+ * the status code.
+ */
+class S3Category : public std::error_category {
+public:
+    const char* name() const noexcept override { return "s3"; }
+    std::string message(int status) const override {
+        std::string text = "S3 request failed with HTTP " + std::to_string(status);
+        if (status == 403) text += " (check the credentials, region and clock)";
+        if (status == 404) text += " (no such bucket or upload)";
+        return text;
+    }
+};
+
+const std::error_category& s3_category() {
+    static const S3Category category;
+    return category;
+}
+
+struct HttpResponse {
+    int status = 0;
+    std::vector<std::pair<std::string, std::string>> headers; // names lowercased
+    std::string body;
+
+    std::string header(std::string_view name) const {
+        for (const auto& [key, value] : headers) {
+            if (key == name) return value;
+        }
+        return std::string();
+    }
+};
+
+/**
+ * @brief Minimal HTTP/1.1 client for one host: keeps idle connections for reuse, sends
+ * Content-Length bodies and reads Content-Length or chunked responses. Thread-safe.
+ */
+class HttpClient {
+public:
+    HttpClient(std::string host, std::string port) : host_(std::move(host)), port_(std::move(port)) {}
+
+    ~HttpClient() {
+        for (int fd : idle_) ::close(fd);
+    }
+
+    /**
+     * @brief The Host header value for this endpoint.
+     */
+    std::string authority() const { return port_ == "80" ? host_ : host_ + ":" + port_; }
+
+    /**
+     * @brief Sends one request and reads its response. A kept-alive connection the server
+     * closed in the meantime is replaced transparently.
+     * @return false on a network error (in `ec`); HTTP error statuses are returned as responses.
+     */
+    bool request(std::string_view method, std::string_view target,
+                 const std::vector<std::pair<std::string, std::string>>& headers, std::string_view body,
+                 HttpResponse& response, std::error_code& ec) {
+        std::string head;
+        head.append(method).append(" ").append(target).append(" HTTP/1.1\r\nHost: ").append(authority()).append("\r\n");
+        for (const auto& [name, value] : headers) head.append(name).append(": ").append(value).append("\r\n");
+        head.append("Content-Length: ").append(std::to_string(body.size())).append("\r\n\r\n");
+
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            bool reused = false;
+            int fd = take_connection(reused, ec);
+            if (fd < 0) return false;
+            bool received_any = false;
+            if (send_all(fd, head, ec) && send_all(fd, body, ec) &&
+                read_response(fd, method == "HEAD", response, received_any, ec)) {
+                bool keep = response.header("connection") != "close";
+                if (keep) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    idle_.push_back(fd);
+                } else {
+                    ::close(fd);
+                }
+                return true;
+            }
+            ::close(fd);
+            if (!reused || received_any) return false;
+        }
+        return false;
+    }
+
+private:
+    int take_connection(bool& reused, std::error_code& ec) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!idle_.empty()) {
+                int fd = idle_.back();
+                idle_.pop_back();
+                reused = true;
+                return fd;
+            }
+        }
+        reused = false;
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if (int rc = ::getaddrinfo(host_.c_str(), port_.c_str(), &hints, &found); rc != 0) {
+            ec = std::make_error_code(std::errc::host_unreachable);
+            return -1;
+        }
+        int fd = -1;
+        for (addrinfo* ai = found; ai && fd < 0; ai = ai->ai_next) {
+            fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (fd < 0) continue;
+            if (::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+                ec.assign(errno, std::generic_category());
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        ::freeaddrinfo(found);
+        if (fd < 0) return -1;
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        timeval timeout{60, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        return fd;
+    }
+
+    static bool send_all(int fd, std::string_view data, std::error_code& ec) {
+        while (!data.empty()) {
+            ssize_t sent = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                ec.assign(errno, std::generic_category());
+                return false;
+            }
+            data.remove_prefix(static_cast<std::size_t>(sent));
+        }
+        return true;
+    }
+
+    static bool read_response(int fd, bool head_request, HttpResponse& response, bool& received_any,
+                              std::error_code& ec) {
+        std::string data;
+        // Reads until `data` holds at least `need` bytes.
+        auto fill = [&](std::size_t need) {
+            char chunk[65536];
+            while (data.size() < need) {
+                ssize_t got = ::recv(fd, chunk, sizeof(chunk), 0);
+                if (got < 0 && errno == EINTR) continue;
+                if (got <= 0) {
+                    ec = got == 0 ? std::make_error_code(std::errc::connection_reset)
+                                  : std::error_code(errno, std::generic_category());
+                    return false;
+                }
+                received_any = true;
+                data.append(chunk, static_cast<std::size_t>(got));
+            }
+            return true;
+        };
+
+        std::size_t header_end;
+        while ((header_end = data.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill(data.size() + 1)) return false;
+        }
+        response = HttpResponse();
+        std::string_view head(data.data(), header_end);
+        std::size_t line_end = head.find("\r\n");
+        std::string_view status_line = head.substr(0, line_end);
+        if (status_line.substr(0, 5) != "HTTP/" || status_line.find(' ') == std::string_view::npos) {
+            ec = std::make_error_code(std::errc::protocol_error);
+            return false;
+        }
+        response.status = std::atoi(std::string(status_line.substr(status_line.find(' ') + 1, 3)).c_str());
+        while (line_end != std::string_view::npos) {
+            head.remove_prefix(line_end + 2);
+            line_end = head.find("\r\n");
+            std::string_view line = head.substr(0, line_end);
+            std::size_t colon = line.find(':');
+            if (colon == std::string_view::npos) continue;
+            std::string name(line.substr(0, colon));
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+            std::string_view value = line.substr(colon + 1);
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+            while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+            response.headers.emplace_back(std::move(name), std::string(value));
+        }
+
+        std::size_t body = header_end + 4;
+        if (head_request || response.status == 204 || response.status == 304 || response.status / 100 == 1) {
+            return true;
+        }
+        std::string length = response.header("content-length");
+        if (!length.empty()) {
+            char* end = nullptr;
+            errno = 0;
+            unsigned long long size = std::strtoull(length.c_str(), &end, 10);
+            if (!std::isdigit(static_cast<unsigned char>(length.front())) || *end != '\0' || errno == ERANGE) {
+                ec = std::make_error_code(std::errc::protocol_error);
+                return false;
+            }
+            if (!fill(body + size)) return false;
+            response.body = data.substr(body, size);
+            return true;
+        }
+        if (response.header("transfer-encoding").find("chunked") == std::string::npos) {
+            // Delimited by the end of the connection, which then cannot be reused.
+            while (fill(data.size() + 1)) {}
+            ec.clear();
+            response.body = data.substr(body);
+            response.headers.emplace_back("connection", "close");
+            return true;
+        }
+        for (std::size_t at = body;;) {
+            std::size_t eol;
+            while ((eol = data.find("\r\n", at)) == std::string::npos) {
+                if (!fill(data.size() + 1)) return false;
+            }
+            std::size_t size = std::strtoull(data.c_str() + at, nullptr, 16);
+            if (!fill(eol + 2 + size + 2)) return false;
+            response.body.append(data, eol + 2, size);
+            at = eol + 2 + size + 2;
+            if (size == 0) return true;  // no trailers are expected
+        }
+    }
+
+    std::string host_;
+    std::string port_;
+    std::mutex mutex_;
+    std::vector<int> idle_;
+};
+
+/**
+ * @brief Where and how to reach the bucket; see parse_s3_target() and the --s3-* options.
+ */
+struct S3Config {
+    std::string host;
+    std::string port = "80";
+    std::string bucket;
+    std::string prefix;                   // key prefix, empty or ending in '/'
+    std::string region = "us-east-1";
+    std::string access_key;
+    std::string secret_key;
+    std::string session_token;
+    std::size_t part_size = 8u << 20;     // multipart part size (S3 minimum: 5 MiB)
+    unsigned parallel = 8;                // parts in flight, and buffers in the pool
+};
+
+/**
+ * @brief Fills in the bucket and prefix from "s3://bucket/prefix", the endpoint from
+ * "http://host[:port]", and the credentials from the usual AWS environment variables.
+ * @throws std::runtime_error on malformed input or missing credentials.
+ */
+void parse_s3_target(std::string_view target, std::string_view endpoint, S3Config& config) {
+    if (target.substr(0, 5) != "s3://" || target.size() == 5) {
+        throw std::runtime_error("--s3 expects s3://bucket[/prefix].");
+    }
+    target.remove_prefix(5);
+    config.bucket = std::string(target.substr(0, target.find('/')));
+    if (target.size() > config.bucket.size() + 1) {
+        config.prefix = std::string(target.substr(config.bucket.size() + 1));
+        if (config.prefix.back() != '/') config.prefix += '/';
+    }
+    if (endpoint.substr(0, 7) != "http://") {
+        throw std::runtime_error("--s3-endpoint expects http://host[:port] (HTTPS needs a TLS proxy in front).");
+    }
+    endpoint.remove_prefix(7);
+    endpoint = endpoint.substr(0, endpoint.find('/'));
+    std::size_t colon = endpoint.rfind(':');
+    if (colon != std::string_view::npos && endpoint.find(']', colon) == std::string_view::npos) {
+        config.port = std::string(endpoint.substr(colon + 1));
+        endpoint = endpoint.substr(0, colon);
+    }
+    if (endpoint.size() > 2 && endpoint.front() == '[' && endpoint.back() == ']') {
+        endpoint = endpoint.substr(1, endpoint.size() - 2);
+    }
+    config.host = std::string(endpoint);
+
+    auto env = [](const char* name) {
+        const char* value = std::getenv(name);
+        return std::string(value ? value : "");
+    };
+    config.access_key = env("AWS_ACCESS_KEY_ID");
+    config.secret_key = env("AWS_SECRET_ACCESS_KEY");
+    config.session_token = env("AWS_SESSION_TOKEN");
+    if (config.access_key.empty() || config.secret_key.empty()) {
+        throw std::runtime_error("--s3 needs AWS_ACCESS_KEY_ID and AWS_SECRET_ACCESS_KEY in the environment.");
+    }
+    for (const char* name : {"AWS_REGION", "AWS_DEFAULT_REGION"}) {
+        if (!env(name).empty()) {
+            config.region = env(name);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Signed S3 requests with retries. Network errors, 5xx, 408 and 429 answers are
+ * retried with exponential backoff and jitter; every attempt is signed afresh. The payload's
+ * SHA-256 is part of the signature, so the server rejects a body changed on the way.
+ */
+class S3Client {
+public:
+    static constexpr int kMaxAttempts = 5;
+
+    explicit S3Client(const S3Config& config) : config_(config), http_(config.host, config.port) {}
+
+    /**
+     * @brief Sends a request for `key` in the bucket.
+     * @param query Name/value pairs, sorted by name, not yet encoded.
+     * @param digest The body's raw SHA-256 if the caller already has it; computed otherwise.
+     * @return false on a network error or an HTTP error status (ec then holds the status in
+     *         s3_category()); `response` holds the last answer either way.
+     */
+    bool send(std::string_view method, std::string_view key, const std::vector<std::pair<std::string, std::string>>& query,
+              std::vector<std::pair<std::string, std::string>> headers, std::string_view body,
+              HttpResponse& response, std::error_code& ec, const std::string* digest = nullptr) {
+        std::string payload_hash = to_hex(digest ? *digest : Sha256::hash(body));
+        std::string path = "/" + uri_encode(config_.bucket, false) + "/" + uri_encode(key, true);
+        std::string query_string;
+        for (const auto& [name, value] : query) {
+            if (!query_string.empty()) query_string += '&';
+            query_string += uri_encode(name, false) + "=" + uri_encode(value, false);
+        }
+        std::string target = query_string.empty() ? path : path + "?" + query_string;
+        std::size_t unsigned_headers = headers.size();
+
+        for (int attempt = 1;; ++attempt) {
+            headers.resize(unsigned_headers);
+            sign(method, path, query_string, payload_hash, headers);
+            response = HttpResponse();
+            ec.clear();
+            bool sent = http_.request(method, target, headers, body, response, ec);
+            if (sent && response.status / 100 == 2) return true;
+            bool retry = !sent || response.status >= 500 || response.status == 408 || response.status == 429;
+            if (sent) ec.assign(response.status, s3_category());
+            if (!retry || attempt == kMaxAttempts) return false;
+            ++retries_;
+            backoff(attempt);
+        }
+    }
+
+    std::size_t retries() const { return retries_.load(); }
+
+private:
+    void sign(std::string_view method, const std::string& path, const std::string& query,
+              const std::string& payload_hash, std::vector<std::pair<std::string, std::string>>& headers) const {
+        std::time_t now = std::time(nullptr);
+        std::tm utc{};
+        ::gmtime_r(&now, &utc);
+        char stamp[17];
+        std::strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &utc);
+        std::string date(stamp, 8);
+        headers.emplace_back("x-amz-content-sha256", payload_hash);
+        headers.emplace_back("x-amz-date", stamp);
+        if (!config_.session_token.empty()) headers.emplace_back("x-amz-security-token", config_.session_token);
+
+        std::vector<std::pair<std::string, std::string>> signed_headers{{"host", http_.authority()}};
+        for (const auto& [name, value] : headers) {
+            std::string lower(name);
+            std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+            signed_headers.emplace_back(std::move(lower), value);
+        }
+        std::sort(signed_headers.begin(), signed_headers.end());
+        std::string canonical_headers, header_names;
+        for (const auto& [name, value] : signed_headers) {
+            canonical_headers += name + ":" + value + "\n";
+            header_names += (header_names.empty() ? "" : ";") + name;
+        }
+        std::string canonical = std::string(method) + "\n" + path + "\n" + query + "\n" + canonical_headers + "\n" +
+                                header_names + "\n" + payload_hash;
+        std::string scope = date + "/" + config_.region + "/s3/aws4_request";
+        std::string to_sign = std::string("AWS4-HMAC-SHA256\n") + stamp + "\n" + scope + "\n" + to_hex(Sha256::hash(canonical));
+        std::string key = hmac_sha256("AWS4" + config_.secret_key, date);
+        key = hmac_sha256(key, config_.region);
+        key = hmac_sha256(key, "s3");
+        key = hmac_sha256(key, "aws4_request");
+        headers.emplace_back("Authorization", "AWS4-HMAC-SHA256 Credential=" + config_.access_key + "/" + scope +
+                                                  ", SignedHeaders=" + header_names +
+                                                  ", Signature=" + to_hex(hmac_sha256(key, to_sign)));
+    }
+
+    static void backoff(int attempt) {
+        thread_local std::mt19937 rng(std::random_device{}());
+        auto base = std::chrono::milliseconds(100) * (1 << std::min(attempt - 1, 6));
+        std::uniform_int_distribution<long long> jitter(0, base.count());
+        std::this_thread::sleep_for(base + std::chrono::milliseconds(jitter(rng)));
+    }
+
+    const S3Config& config_;
+    HttpClient http_;
+    std::atomic<std::size_t> retries_{0};
+};
+
+/**
+ * @brief Backend that uploads files planned into the category folders to S3 instead of
+ * renaming them; everything else (listing, stat, the sources) goes to the inner backend.
+ * rename() uploads and then removes the source, copy() only uploads. Uploads never replace an
+ * existing object: a HEAD answers the common case before any data is read, and the final PUT
+ * or CompleteMultipartUpload is conditional (If-None-Match: *) to close the race. Files up to
+ * part_size go up in one PUT; larger ones as a multipart upload whose parts the caller reads
+ * into pooled buffers and a pool of `parallel` uploader threads sends. Parts grow beyond
+ * part_size where needed to stay within S3's 10,000 parts. Every PUT carries the SHA-256 of
+ * its body (x-amz-checksum-sha256), and the checksum S3 reports back for each part and for
+ * the object is checked before an upload counts, and so before its source is removed. An
+ * object already under the name whose checksum matches the file's, left by a run whose
+ * confirmation was lost, counts as uploaded.
+ */
+class S3Backend final : public FsBackend {
+public:
+    static constexpr std::uint64_t kMaxParts = 10000;
+
+    S3Backend(FsBackend& inner, const fs::path& base_path, S3Config config)
+        : inner_(inner), base_path_(base_path), config_(std::move(config)), client_(config_) {
+        for (unsigned i = 0; i < config_.parallel; ++i) {
+            free_buffers_.push_back(std::make_unique<std::string>());
+            workers_.emplace_back([this] { upload_parts(); });
+        }
+    }
+
+    ~S3Backend() override {
+        {
+            std::lock_guard<std::mutex> lock(tasks_mutex_);
+            stopping_ = true;
+        }
+        tasks_cv_.notify_all();
+        for (auto& worker : workers_) worker.join();
+    }
+
+    bool make_directory(const fs::path& path, std::error_code& ec) override {
+        // Key prefixes need no creating.
+        return object_key(path, false).empty() ? inner_.make_directory(path, ec) : true;
+    }
+    bool list_directory(const fs::path& path, std::vector<fs::directory_entry>& entries, std::error_code& ec) override {
+        return inner_.list_directory(path, entries, ec);
+    }
+    bool stat(const fs::path& path, FileStamp& stamp, std::error_code& ec) override { return inner_.stat(path, stamp, ec); }
+
+    MoveStatus rename(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        std::string key = object_key(to, true);
+        if (key.empty()) return inner_.rename(from, to, ec);
+        MoveStatus status = upload(from, key, ec);
+        if (status != MoveStatus::Moved) return status;
+        // The object is confirmed; only now may the source go. If it cannot, take the object
+        // back so the file stays in exactly one place.
+        if (!inner_.remove(from, ec)) {
+            std::error_code ignored;
+            HttpResponse response;
+            client_.send("DELETE", key, {}, {}, {}, response, ignored);
+            return MoveStatus::Failed;
+        }
+        return MoveStatus::Moved;
+    }
+
+    MoveStatus copy(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        std::string key = object_key(to, true);
+        return key.empty() ? inner_.copy(from, to, ec) : upload(from, key, ec);
+    }
+
+    bool remove(const fs::path& path, std::error_code& ec) override {
+        std::string key = object_key(path, true);
+        if (key.empty()) return inner_.remove(path, ec);
+        HttpResponse response;
+        return client_.send("DELETE", key, {}, {}, {}, response, ec);
+    }
+
+    std::size_t uploaded() const { return uploaded_.load(); }
+    std::uint64_t uploaded_bytes() const { return uploaded_bytes_.load(); }
+    std::size_t retries() const { return client_.retries(); }
+
+private:
+    struct Multipart {
+        std::string key;
+        std::string upload_id;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::size_t pending = 0;
+        std::vector<std::string> etags;
+        std::vector<std::string> digests;  // raw SHA-256 per part
+        std::error_code ec;
+    };
+
+    struct PartTask {
+        std::shared_ptr<Multipart> upload;
+        std::size_t number;  // 1-based
+        std::unique_ptr<std::string> buffer;
+    };
+
+    /**
+     * @brief The object key for a path inside a category folder of the base path ("" for any
+     * other path); with `file`, the path must name a file below the category folder.
+     */
+    std::string object_key(const fs::path& path, bool file) const {
+        fs::path relative = path.lexically_relative(base_path_);
+        if (relative.empty() || !FOLDER_MAP.count(relative.begin()->string())) return std::string();
+        if (file && std::next(relative.begin()) == relative.end()) return std::string();
+        return config_.prefix + relative.generic_string();
+    }
+
+    std::uint64_t part_size_for(std::uint64_t size) const {
+        return std::max<std::uint64_t>(config_.part_size, (size + kMaxParts - 1) / kMaxParts);
+    }
+
+    /**
+     * @brief The checksum S3 reports for a multipart object: the SHA-256 of the concatenated
+     * part digests, with the number of parts appended.
+     */
+    static std::string composite_checksum(const std::vector<std::string>& digests) {
+        std::string joined;
+        for (const std::string& digest : digests) joined += digest;
+        return to_base64(Sha256::hash(joined)) + "-" + std::to_string(digests.size());
+    }
+
+    /**
+     * @brief The checksum an upload of the open file `fd` would get, read part by part.
+     */
+    std::string local_checksum(int fd, std::uint64_t size, std::error_code& ec) {
+        std::unique_ptr<std::string> buffer = acquire_buffer();
+        std::string checksum;
+        if (size <= config_.part_size) {
+            if (read_part(fd, 0, static_cast<std::size_t>(size), *buffer, ec)) checksum = to_base64(Sha256::hash(*buffer));
+        } else {
+            std::uint64_t part_size = part_size_for(size);
+            std::vector<std::string> digests;
+            for (std::uint64_t offset = 0; offset < size; offset += part_size) {
+                std::size_t length = static_cast<std::size_t>(std::min(part_size, size - offset));
+                if (!read_part(fd, offset, length, *buffer, ec)) break;
+                digests.push_back(Sha256::hash(*buffer));
+            }
+            if (!ec) checksum = composite_checksum(digests);
+        }
+        release_buffer(std::move(buffer));
+        return checksum;
+    }
+
+    /**
+     * @brief HEADs `key` with checksums enabled.
+     * @return false if there is no such object or the request failed (`response` tells which).
+     */
+    bool head_object(const std::string& key, HttpResponse& response, std::error_code& ec) {
+        return client_.send("HEAD", key, {}, {{"x-amz-checksum-mode", "ENABLED"}}, {}, response, ec);
+    }
+
+    static bool same_object(const HttpResponse& response, std::uint64_t size, const std::string& checksum) {
+        return response.header("content-length") == std::to_string(size) && !checksum.empty() &&
+               response.header("x-amz-checksum-sha256") == checksum;
+    }
+
+    /**
+     * @brief Whether the object under `key` is the one a lost-confirmation upload stored: after
+     * a conditional write answered 412, the earlier attempt may have gone through.
+     */
+    bool stored_as(const std::string& key, std::uint64_t size, const std::string& checksum) {
+        HttpResponse response;
+        std::error_code ignored;
+        return head_object(key, response, ignored) && same_object(response, size, checksum);
+    }
+
+    MoveStatus upload(const fs::path& from, const std::string& key, std::error_code& ec) {
+        int fd = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            ec.assign(errno, std::generic_category());
+            return MoveStatus::Failed;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ec.assign(errno, std::generic_category());
+            ::close(fd);
+            return MoveStatus::Failed;
+        }
+        std::uint64_t size = static_cast<std::uint64_t>(st.st_size);
+
+        MoveStatus status = MoveStatus::Failed;
+        HttpResponse response;
+        std::error_code probe;
+        if (head_object(key, response, probe)) {
+            // Only an object of the same size can be this file; then its checksum decides.
+            status = MoveStatus::Exists;
+            if (response.header("content-length") == std::to_string(size)) {
+                std::string checksum = local_checksum(fd, size, ec);
+                if (ec) {
+                    status = MoveStatus::Failed;
+                } else if (same_object(response, size, checksum)) {
+                    status = MoveStatus::Moved;
+                }
+            }
+        } else if (response.status != 404) {
+            ec = probe;
+        } else if (size <= config_.part_size) {
+            status = put_object(fd, static_cast<std::size_t>(size), key, ec);
+        } else {
+            status = put_multipart(fd, size, key, ec);
+        }
+        ::close(fd);
+        if (status == MoveStatus::Moved) {
+            ++uploaded_;
+            uploaded_bytes_ += size;
+        }
+        return status;
+    }
+
+    MoveStatus put_object(int fd, std::size_t size, const std::string& key, std::error_code& ec) {
+        std::unique_ptr<std::string> buffer = acquire_buffer();
+        MoveStatus status = MoveStatus::Failed;
+        if (read_part(fd, 0, size, *buffer, ec)) {
+            std::string digest = Sha256::hash(*buffer);
+            std::string checksum = to_base64(digest);
+            HttpResponse response;
+            if (client_.send("PUT", key, {}, {{"If-None-Match", "*"}, {"x-amz-checksum-sha256", checksum}}, *buffer,
+                             response, ec, &digest)) {
+                if (response.header("x-amz-checksum-sha256") == checksum) {
+                    status = MoveStatus::Moved;
+                } else {
+                    // Not confirmed: take the object back rather than trust it.
+                    ec = std::make_error_code(std::errc::io_error);
+                    std::error_code ignored;
+                    client_.send("DELETE", key, {}, {}, {}, response, ignored);
+                }
+            } else if (response.status == 412) {
+                status = stored_as(key, size, checksum) ? MoveStatus::Moved : MoveStatus::Exists;
+                if (status == MoveStatus::Moved) ec.clear();
+            }
+        }
+        release_buffer(std::move(buffer));
+        return status;
+    }
+
+    MoveStatus put_multipart(int fd, std::uint64_t size, const std::string& key, std::error_code& ec) {
+        auto upload = std::make_shared<Multipart>();
+        upload->key = key;
+        HttpResponse response;
+        if (!client_.send("POST", key, {{"uploads", ""}}, {{"x-amz-checksum-algorithm", "SHA256"}}, {}, response, ec)) {
+            return MoveStatus::Failed;
+        }
+        upload->upload_id = xml_value(response.body, "UploadId");
+        if (upload->upload_id.empty()) {
+            ec = std::make_error_code(std::errc::protocol_error);
+            return MoveStatus::Failed;
+        }
+
+        std::uint64_t part_size = part_size_for(size);
+        std::size_t parts = static_cast<std::size_t>((size + part_size - 1) / part_size);
+        upload->etags.resize(parts);
+        upload->digests.resize(parts);
+        for (std::size_t part = 0; part < parts; ++part) {
+            {
+                std::lock_guard<std::mutex> lock(upload->mutex);
+                if (upload->ec) break;  // a part failed for good; stop reading
+            }
+            std::unique_ptr<std::string> buffer = acquire_buffer();
+            std::uint64_t offset = part * part_size;
+            std::size_t length = static_cast<std::size_t>(std::min<std::uint64_t>(part_size, size - offset));
+            std::error_code read_ec;
+            if (!read_part(fd, offset, length, *buffer, read_ec)) {
+                release_buffer(std::move(buffer));
+                std::lock_guard<std::mutex> lock(upload->mutex);
+                upload->ec = read_ec;
+                break;
+            }
+            {
+                std::lock_guard<std::mutex> lock(upload->mutex);
+                ++upload->pending;
+            }
+            {
+                std::lock_guard<std::mutex> lock(tasks_mutex_);
+                tasks_.push_back(PartTask{upload, part + 1, std::move(buffer)});
+            }
+            tasks_cv_.notify_one();
+        }
+        {
+            std::unique_lock<std::mutex> lock(upload->mutex);
+            upload->done.wait(lock, [&] { return upload->pending == 0; });
+        }
+
+        MoveStatus status = MoveStatus::Failed;
+        if (upload->ec) {
+            ec = upload->ec;
+        } else {
+            std::string manifest = "<CompleteMultipartUpload>";
+            for (std::size_t part = 0; part < parts; ++part) {
+                manifest += "<Part><PartNumber>" + std::to_string(part + 1) + "</PartNumber><ETag>" +
+                            upload->etags[part] + "</ETag><ChecksumSHA256>" + to_base64(upload->digests[part]) +
+                            "</ChecksumSHA256></Part>";
+            }
+            manifest += "</CompleteMultipartUpload>";
+            std::string checksum = composite_checksum(upload->digests);
+            // S3 can answer 200 and still report an error in the body.
+            if (client_.send("POST", key, {{"uploadId", upload->upload_id}}, {{"If-None-Match", "*"}}, manifest,
+                             response, ec) &&
+                response.body.find("<Error>") == std::string::npos) {
+                if (xml_value(response.body, "ChecksumSHA256") == checksum) {
+                    return MoveStatus::Moved;
+                }
+                // Not confirmed: take the object back rather than trust it.
+                ec = std::make_error_code(std::errc::io_error);
+                std::error_code ignored;
+                client_.send("DELETE", key, {}, {}, {}, response, ignored);
+                return MoveStatus::Failed;
+            }
+            if (response.status == 412) {
+                status = stored_as(key, size, checksum) ? MoveStatus::Moved : MoveStatus::Exists;
+                if (status == MoveStatus::Moved) {
+                    ec.clear();
+                    return status;
+                }
+            } else if (!ec) {
+                ec = std::make_error_code(std::errc::io_error);
+            }
+        }
+        std::error_code ignored;
+        client_.send("DELETE", key, {{"uploadId", upload->upload_id}}, {}, {}, response, ignored);
+        return status;
+    }
+
+    void upload_parts() {
+        while (true) {
+            PartTask task;
+            {
+                std::unique_lock<std::mutex> lock(tasks_mutex_);
+                tasks_cv_.wait(lock, [&] { return stopping_ || !tasks_.empty(); });
+                if (tasks_.empty()) return;
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            Multipart& upload = *task.upload;
+            HttpResponse response;
+            std::error_code ec;
+            std::string digest = Sha256::hash(*task.buffer);
+            std::string checksum = to_base64(digest);
+            bool ok = client_.send("PUT", upload.key,
+                                   {{"partNumber", std::to_string(task.number)}, {"uploadId", upload.upload_id}},
+                                   {{"x-amz-checksum-sha256", checksum}}, *task.buffer, response, ec, &digest);
+            release_buffer(std::move(task.buffer));
+            if (ok && response.header("x-amz-checksum-sha256") != checksum) {
+                ok = false;
+                ec = std::make_error_code(std::errc::io_error);
+            }
+            std::lock_guard<std::mutex> lock(upload.mutex);
+            if (ok) {
+                upload.etags[task.number - 1] = response.header("etag");
+                upload.digests[task.number - 1] = std::move(digest);
+            } else if (!upload.ec) {
+                upload.ec = ec;
+            }
+            if (--upload.pending == 0) upload.done.notify_all();
+        }
+    }
+
+    std::unique_ptr<std::string> acquire_buffer() {
+        std::unique_lock<std::mutex> lock(buffers_mutex_);
+        buffers_cv_.wait(lock, [&] { return !free_buffers_.empty(); });
+        std::unique_ptr<std::string> buffer = std::move(free_buffers_.back());
+        free_buffers_.pop_back();
+        return buffer;
+    }
+
+    void release_buffer(std::unique_ptr<std::string> buffer) {
+        {
+            std::lock_guard<std::mutex> lock(buffers_mutex_);
+            free_buffers_.push_back(std::move(buffer));
+        }
+        buffers_cv_.notify_one();
+    }
+
+    static bool read_part(int fd, std::uint64_t offset, std::size_t length, std::string& buffer, std::error_code& ec) {
+        buffer.resize(length);
+        for (std::size_t done = 0; done < length;) {
+            ssize_t got = ::pread(fd, buffer.data() + done, length - done, static_cast<off_t>(offset + done));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) {
+                ec = got == 0 ? std::make_error_code(std::errc::io_error) : std::error_code(errno, std::generic_category());
+                return false;
+            }
+            done += static_cast<std::size_t>(got);
+        }
+        return true;
+    }
+
+    static std::string xml_value(const std::string& xml, const std::string& tag) {
+        std::size_t start = xml.find("<" + tag + ">");
+        if (start == std::string::npos) return std::string();
+        start += tag.size() + 2;
+        std::size_t end = xml.find("</" + tag + ">", start);
+        return end == std::string::npos ? std::string() : xml.substr(start, end - start);
+    }
+
+    FsBackend& inner_;
+    fs::path base_path_;
+    S3Config config_;
+    S3Client client_;
+    std::mutex buffers_mutex_;
+    std::condition_variable buffers_cv_;
+    std::vector<std::unique_ptr<std::string>> free_buffers_;
+    std::mutex tasks_mutex_;
+    std::condition_variable tasks_cv_;
+    std::deque<PartTask> tasks_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+    std::atomic<std::size_t> uploaded_{0};
+    std::atomic<std::uint64_t> uploaded_bytes_{0};
+};
+
+#endif
+
+// --- Watch mode: organize files as they arrive (Linux inotify) ---
+
+// Set from the signal handler to end watch mode cleanly.
+volatile std::sig_atomic_t g_stop_requested = 0;
+
+extern "C" void request_stop(int) {
+    g_stop_requested = 1;
+}
+
+/**
+ * @brief Decides how long watch mode waits to gather events into one batch.
+ * It keeps an exponentially weighted estimate of the arrival rate. While the rate is so low
+ * that fewer than two events would arrive within the longest allowed window, batching only
+ * adds latency and the window stays at zero. Above that, the window is whatever it takes to
+ * gather `target_batch` events, capped at `max_window`, so it opens up as load builds and
+ * collapses back to zero when the directory goes quiet.
+ * Time is passed in explicitly so the controller can be driven by simulated arrivals.
+ */
+class AdaptiveBatcher {
+public:
+    AdaptiveBatcher(std::chrono::nanoseconds max_window, std::size_t target_batch, std::size_t max_batch)
+        : max_window_(max_window), target_batch_(target_batch), max_batch_(max_batch) {}
+
+    std::size_t max_batch() const { return max_batch_; }
+
+    /**
+     * @brief The window for a batch whose first event arrives at time `now`. The rate estimate
+     * is decayed by the quiet time since the last batch, so a lone event after a burst is not
+     * held back by the burst's window.
+     */
+    std::chrono::nanoseconds window(std::chrono::nanoseconds now) const {
+        double rate = rate_;
+        if (have_last_) {
+            rate *= decay(std::chrono::duration<double>(now - last_).count());
+        }
+        double max_window_s = std::chrono::duration<double>(max_window_).count();
+        if (rate * max_window_s < 2.0) {
+            return std::chrono::nanoseconds(0);
+        }
+        double wanted = static_cast<double>(target_batch_) / rate;
+        return std::chrono::nanoseconds(static_cast<std::int64_t>(std::min(wanted, max_window_s) * 1e9));
+    }
+
+    /**
+     * @brief Feeds back a finished batch of `size` events that closed at time `now`.
+     */
+    void completed(std::size_t size, std::chrono::nanoseconds now) {
+        if (have_last_) {
+            double elapsed = std::max(1e-6, std::chrono::duration<double>(now - last_).count());
+            double instant = static_cast<double>(size) / elapsed;
+            double keep = decay(elapsed);
+            rate_ = keep * rate_ + (1.0 - keep) * instant;
+        }
+        have_last_ = true;
+        last_ = now;
+    }
+
+private:
+    static constexpr double kHalfLifeSeconds = 0.25;
+
+    static double decay(double elapsed_s) {
+        return std::exp(-elapsed_s / kHalfLifeSeconds * std::log(2.0));
+    }
+
+    std::chrono::nanoseconds max_window_;
+    std::size_t target_batch_;
+    std::size_t max_batch_;
+    std::chrono::nanoseconds last_{0};
+    bool have_last_ = false;
+    double rate_ = 0.0;
+};
+
+/**
+ * @brief Drives AdaptiveBatcher with synthetic arrival patterns and prints, per pattern, how
+ * batching compares with handling each event on its own under a simple cost model.
+ * Used to check the controller's behaviour without an inotify source: idle arrivals must
+ * keep a zero window and an unbatched p99, a burst must be batched at lower busy time, and
+ * the window must fall back to zero once a burst is over.
+ * @return False if any of those properties does not hold; each failure is reported.
+ */
+bool simulate_batching(std::chrono::nanoseconds max_window) {
+    using ns = std::chrono::nanoseconds;
+    // Cost model: fixed overhead per batch plus a per-file cost.
+    const std::int64_t batch_cost = 200000, file_cost = 5000;
+
+    auto uniform = [](double rate, double seconds, double start = 0.0) {
+        std::vector<std::int64_t> t;
+        for (double x = start; x < start + seconds; x += 1.0 / rate) t.push_back(static_cast<std::int64_t>(x * 1e9));
+        return t;
+    };
+    enum class Pattern { Idle, Steady, Burst, Mixed };
+    struct Case {
+        Pattern pattern;
+        std::string name;
+        std::vector<std::int64_t> arrivals;
+    };
+    std::vector<Case> patterns;
+    patterns.push_back({Pattern::Idle, "idle (1/s)", uniform(1, 30)});
+    patterns.push_back({Pattern::Steady, "steady (500/s)", uniform(500, 10)});
+    patterns.push_back({Pattern::Burst, "burst (100k at 200k/s)", uniform(200000, 0.5)});
+    {
+        std::vector<std::int64_t> mixed = uniform(2, 5);
+        for (auto t : uniform(50000, 1, 5)) mixed.push_back(t);
+        for (auto t : uniform(2, 5, 6)) mixed.push_back(t);
+        patterns.push_back({Pattern::Mixed, "mixed (idle, 50k burst, idle)", mixed});
+    }
+
+    struct Result {
+        std::size_t batches = 0;
+        double mean = 0.0;
+        std::int64_t busy = 0;
+        std::uint64_t p99 = 0;
+        std::int64_t max_window = 0;
+        std::int64_t last_window = 0;
+    };
+    bool ok = true;
+    auto fail = [&](const std::string& name, const std::string& what) {
+        std::cerr << "Error: " << name << ": " << what << "." << std::endl;
+        ok = false;
+    };
+
+    std::cout << "Batching simulation (max window " << static_cast<double>(max_window.count()) / 1e6 << " ms):" << std::endl;
+    for (const auto& [pattern, name, arrivals] : patterns) {
+        Result results[2];
+        for (bool adaptive : {false, true}) {
+            Result& result = results[adaptive];
+            AdaptiveBatcher batcher(adaptive ? max_window : ns(0), 64, 4096);
+            LatencyHistogram latency;
+            std::size_t i = 0;
+            std::int64_t free_at = 0;
+            while (i < arrivals.size()) {
+                std::int64_t open = std::max(arrivals[i], free_at);
+                std::int64_t window = batcher.window(ns(open)).count();
+                std::int64_t close = open + window;
+                std::size_t j = i;
+                while (j < arrivals.size() && arrivals[j] <= close && j - i < batcher.max_batch()) ++j;
+                // When the batch filled up early it is closed at its last arrival.
+                if (j - i == batcher.max_batch()) close = std::max(open, arrivals[j - 1]);
+                std::int64_t work = batch_cost + file_cost * static_cast<std::int64_t>(j - i);
+                std::int64_t done = close + work;
+                result.busy += work;
+                result.max_window = std::max(result.max_window, window);
+                result.last_window = window;
+                for (std::size_t k = i; k < j; ++k) latency.record(static_cast<std::uint64_t>(done - arrivals[k]));
+                batcher.completed(j - i, ns(close));
+                free_at = done;
+                i = j;
+                ++result.batches;
+            }
+            result.mean = static_cast<double>(arrivals.size()) / static_cast<double>(result.batches);
+            result.p99 = latency.quantile(0.99);
+            std::cout << "  " << name << (adaptive ? " adaptive: " : " unbatched: ") << result.batches << " batches, mean size "
+                      << result.mean << ", busy " << static_cast<double>(result.busy) / 1e6 << " ms, p50 "
+                      << static_cast<double>(latency.quantile(0.5)) / 1e6 << " ms, p99 "
+                      << static_cast<double>(result.p99) / 1e6 << " ms" << std::endl;
+        }
+
+        const Result& unbatched = results[0];
+        const Result& adaptive = results[1];
+        switch (pattern) {
+        case Pattern::Idle:
+            if (adaptive.max_window > 0) fail(name, "opened a batching window");
+            if (adaptive.p99 > unbatched.p99 + unbatched.p99 / 10) fail(name, "p99 more than 10% above unbatched");
+            break;
+        case Pattern::Burst:
+            if (adaptive.mean < 8.0) fail(name, "mean batch size below 8");
+            if (adaptive.busy >= unbatched.busy) fail(name, "busy time not below unbatched");
+            break;
+        case Pattern::Mixed:
+            if (adaptive.max_window == 0) fail(name, "never opened a batching window");
+            if (adaptive.last_window > 0) fail(name, "window did not return to zero after the burst");
+            break;
+        case Pattern::Steady:
+            break;
+        }
+    }
+    return ok;
+}
+
+/**
+ * @brief Counters and latency histograms collected by watch mode.
+ * Each file is timestamped when its event is received, once it is classified and once its
+ * rename has completed; end-to-end is receipt to completion.
+ */
+struct WatchStats {
+    std::atomic<std::uint64_t> events{0};
+    std::atomic<std::uint64_t> batches{0};
+    std::atomic<std::uint64_t> moved{0};
+    std::atomic<std::uint64_t> skipped{0};
+    std::atomic<std::uint64_t> failed{0};
+    std::atomic<std::uint64_t> slo_violations{0};
+    std::uint64_t slo_ns = 1000000000ull;
+    LatencyHistogram classify;
+    LatencyHistogram rename;
+    LatencyHistogram end_to_end;
+};
+
+/**
+ * @brief Prints the watch-mode counters and latency percentiles.
+ */
+void print_watch_stats(std::ostream& out, const WatchStats& stats) {
+    std::lock_guard<std::mutex> lock(g_console_mutex);
+    std::uint64_t batches = stats.batches.load();
+    out << "Watch stats: " << stats.events.load() << " events in " << batches << " batches (mean "
+        << (batches ? static_cast<double>(stats.events.load()) / static_cast<double>(batches) : 0.0) << "), "
+        << stats.moved.load() << " moved, " << stats.skipped.load() << " skipped, " << stats.failed.load()
+        << " failed, " << stats.slo_violations.load() << " over the " << static_cast<double>(stats.slo_ns) / 1e6
+        << " ms SLO." << std::endl;
+    print_latency(out, "receipt->classified", stats.classify);
+    print_latency(out, "classified->renamed", stats.rename);
+    print_latency(out, "end-to-end", stats.end_to_end);
+}
+
+/**
+ * @brief A file reported by inotify, with the time its event was read.
+ */
+struct Arrival {
+    fs::path path;
+    std::chrono::steady_clock::time_point received;
+};
+
+/**
+ * @brief Classifies a batch of arrivals, then moves them on the parallel engine, recording
+ * each file's latencies.
+ */
+void organize_arrivals(FsBackend& backend, const fs::path& library_path, const std::vector<Arrival>& batch,
+                       unsigned jobs, WatchStats& stats) {
+    struct Classified {
+        std::string folder;
+        std::chrono::steady_clock::time_point at;
+    };
+    std::vector<const fs::path*> files(batch.size());
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        files[i] = &batch[i].path;
+    }
+    std::vector<CategoryId> categories(batch.size());
+    ExtensionClassifier::classify_batch(files.data(), files.size(), categories.data());
+    auto classified_at = std::chrono::steady_clock::now();
+    std::vector<Classified> classified(batch.size());
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        if (categories[i] != kNoCategory) classified[i].folder = g_categories[categories[i]];
+        classified[i].at = classified_at;
+    }
+    if (g_live) {
+        g_live->planned += static_cast<std::uint64_t>(
+            std::count_if(categories.begin(), categories.end(), [](CategoryId id) { return id != kNoCategory; }));
+    }
+
+    auto ns = [](std::chrono::steady_clock::duration d) {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    };
+    // Conflict counting is fixed for the whole run: pick the policy once, not per file.
+    auto place = g_conflict_sketch ? &SuffixHotNames::place<FsBackend> : &SkipExisting::place<FsBackend>;
+    parallel_for(batch.size(), jobs, [&](std::size_t i) {
+        const Arrival& arrival = batch[i];
+        const std::string& folder = classified[i].folder;
+        if (folder.empty()) {
+            return;
+        }
+        std::error_code ec;
+        auto started = live_move_started();
+        MoveStatus status = place(backend, arrival.path, library_path / folder / arrival.path.filename(), ec);
+        live_move_done(status, categories[i], 0, started);
+        auto done = std::chrono::steady_clock::now();
+
+        stats.classify.record(ns(classified[i].at - arrival.received));
+        stats.rename.record(ns(done - classified[i].at));
+        std::uint64_t total = ns(done - arrival.received);
+        stats.end_to_end.record(total);
+        if (total > stats.slo_ns) {
+            ++stats.slo_violations;
+        }
+
+        switch (status) {
+        case MoveStatus::Moved:
+            ++stats.moved;
+            break;
+        case MoveStatus::Exists: {
+            ++stats.skipped;
+            if (g_quiet) break;
+            std::lock_guard<std::mutex> lock(g_console_mutex);
+            std::cout << "Skipping '" << arrival.path.filename().string() << "': file already exists in '" << folder
+                      << "' folder." << std::endl;
+            break;
+        }
+        case MoveStatus::Failed: {
+            ++stats.failed;
+            if (g_quiet) break;
+            std::lock_guard<std::mutex> lock(g_console_mutex);
+            std::cerr << "Error moving file '" << arrival.path.filename().string() << "': " << ec.message() << std::endl;
+            break;
+        }
+        }
+    });
+    if (g_live) g_live->set_idle();
+}
+
+/**
+ * @brief Organizes the folder once, then keeps organizing files as they are closed after
+ * writing or moved into it, until SIGINT or SIGTERM. Events are gathered into batches whose
+ * window is chosen by an AdaptiveBatcher.
+ * @param library_path Where the category folders live: the base path, or a --dest root.
+ * @param max_window The longest a batch may wait for more events.
+ * @param stats_interval Print stats every this many seconds (0 prints them only on exit).
+ */
+void watch_folder(const fs::path& base_path, const fs::path& library_path, const fs::path& self_path,
+                  FsBackend& backend, unsigned jobs, WatchStats& stats, std::chrono::nanoseconds max_window,
+                  unsigned stats_interval) {
+    ScanOptions scan;
+    if (library_path != base_path) {
+        scan.dest = library_path;
+    }
+#ifdef __linux__
+    int fd = ::inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("inotify_init1 failed: ") + std::strerror(errno));
+    }
+    if (::inotify_add_watch(fd, base_path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::runtime_error(std::string("inotify_add_watch failed: ") + std::strerror(err));
+    }
+
+    // Catch up on whatever arrived before the watch was in place.
+    organize_files(base_path, self_path, backend, jobs, scan);
+
+    std::signal(SIGINT, request_stop);
+    std::signal(SIGTERM, request_stop);
+    const auto origin = std::chrono::steady_clock::now();
+    auto next_report = origin + std::chrono::seconds(stats_interval);
+    AdaptiveBatcher batcher(max_window, 64, 4096);
+    std::vector<Arrival> batch;
+    alignas(struct inotify_event) char buffer[64 * 1024];
+
+    while (!g_stop_requested) {
+        // Wait for the first event of a batch, then keep reading until the window closes.
+        batch.clear();
+        bool overflowed = false;
+        auto deadline = std::chrono::steady_clock::time_point::max();
+        while (!g_stop_requested && batch.size() < batcher.max_batch()) {
+            int timeout_ms = 200;
+            if (!batch.empty()) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                timeout_ms = static_cast<int>(std::max<std::int64_t>(0, left.count()));
+            }
+            struct pollfd pfd = {fd, POLLIN, 0};
+            int ready = ::poll(&pfd, 1, timeout_ms);
+            if (stats_interval > 0 && std::chrono::steady_clock::now() >= next_report) {
+                print_watch_stats(std::cout, stats);
+                next_report += std::chrono::seconds(stats_interval);
+            }
+            if (ready > 0) {
+                ssize_t len = ::read(fd, buffer, sizeof(buffer));
+                auto received = std::chrono::steady_clock::now();
+                for (ssize_t offset = 0; offset < len;) {
+                    const auto* event = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+                    offset += static_cast<ssize_t>(sizeof(struct inotify_event) + event->len);
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        overflowed = true;
+                    }
+                    if (event->len == 0 || (event->mask & IN_ISDIR)) {
+                        continue;
+                    }
+                    ++stats.events;
+                    if (g_live) ++g_live->events;
+                    fs::path item_path = base_path / event->name;
+                    if (item_path != self_path) {
+                        if (batch.empty()) {
+                            deadline = received + batcher.window(received - origin);
+                        }
+                        batch.push_back({std::move(item_path), received});
+                    }
+                }
+            }
+            if (!batch.empty() && std::chrono::steady_clock::now() >= deadline) {
+                break;
+            }
+            if (overflowed) {
+                break;
+            }
+        }
+
+        if (!batch.empty()) {
+            ++stats.batches;
+            organize_arrivals(backend, library_path, batch, jobs, stats);
+            batcher.completed(batch.size(), std::chrono::steady_clock::now() - origin);
+        }
+        if (overflowed) {
+            // The kernel dropped events; a full pass picks up whatever they referred to.
+            organize_files(base_path, self_path, backend, jobs, scan);
+        }
+    }
+    ::close(fd);
+#else
+    (void)base_path; (void)library_path; (void)self_path; (void)backend; (void)jobs; (void)stats; (void)max_window; (void)stats_interval;
+    throw std::runtime_error("Watch mode requires Linux (inotify).");
+#endif
+}
+
+// --- Live stats segment and `organize top` ---
+// A run publishes its LiveCounters as /organize.<pid> in POSIX shared memory. The publisher is
+// the segment's only writer and guards it with a seqlock: the sequence is odd while a snapshot
+// is being copied in, and readers retry until they see the same even value before and after
+// their copy, so a slow or stopped viewer can never hold up the run. `organize top` maps the
+// segment read-only and derives rates from the difference between two snapshots.
+
+#ifndef _WIN32
+
+/**
+ * @brief Layout of the shared segment: plain data behind the seqlock. `size` is checked by
+ * readers, so a layout change is caught instead of misread.
+ */
+struct LiveSegment {
+    static constexpr unsigned kCategories = 64;
+    static constexpr unsigned kNameLength = 32;
+
+    struct Snapshot {
+        std::int64_t started_ns;  // wall clock, since the Unix epoch
+        std::int64_t updated_ns;
+        char mode[16];
+        char root[256];
+        std::uint64_t planned, moved, skipped, stale, failed, bytes, events;
+        std::uint64_t dirs_scanned, dirs_queued;
+        std::uint64_t latency_count, latency_p50, latency_p90, latency_p99, latency_p999, latency_max;
+        std::uint32_t workers;
+        std::uint32_t categories;
+        std::uint32_t finished;  // set by the last snapshot, published as the run ends
+        std::uint32_t reserved;
+        std::uint8_t worker_state[LiveCounters::kMaxWorkers];
+        std::uint64_t worker_files[LiveCounters::kMaxWorkers];
+        char category_name[kCategories][kNameLength];
+        std::uint64_t category_moved[kCategories];
+    };
+
+    char magic[8];
+    std::uint32_t size;
+    std::uint32_t pid;
+    std::atomic<std::uint64_t> sequence;
+    Snapshot snapshot;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "the seqlock sequence is shared between processes");
+
+constexpr char kLiveMagic[8] = {'O', 'R', 'G', 'L', 'I', 'V', 'E', '1'};
+
+std::string live_segment_name(long pid) {
+    return "/organize." + std::to_string(pid);
+}
+
+std::int64_t unix_time_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+template <std::size_t N>
+void copy_field(char (&field)[N], std::string_view text) {
+    std::size_t length = std::min(text.size(), N - 1);
+    std::memcpy(field, text.data(), length);
+    field[length] = '\0';
+}
+
+/**
+ * @brief Publishes a run's LiveCounters to its shared memory segment every `interval`, from a
+ * thread of its own. The segment is removed again when the publisher is destroyed.
+ * @throws std::system_error if the segment cannot be created.
+ */
+class LivePublisher {
+public:
+    LivePublisher(const LiveCounters& counters, std::string_view mode, const fs::path& root,
+                  std::chrono::milliseconds interval = std::chrono::milliseconds(250))
+        : counters_(counters), name_(live_segment_name(::getpid())), interval_(interval) {
+        int fd = ::shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0 && errno == EEXIST) {
+            // Left behind by an earlier process that had the same pid.
+            ::shm_unlink(name_.c_str());
+            fd = ::shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        }
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "shm_open " + name_);
+        }
+        void* memory = MAP_FAILED;
+        int err = 0;
+        if (::ftruncate(fd, sizeof(LiveSegment)) != 0) {
+            err = errno;
+        } else if ((memory = ::mmap(nullptr, sizeof(LiveSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+            err = errno;
+        }
+        ::close(fd);
+        if (memory == MAP_FAILED) {
+            ::shm_unlink(name_.c_str());
+            throw std::system_error(err, std::generic_category(), "mapping " + name_);
+        }
+        segment_ = new (memory) LiveSegment{};
+        segment_->size = sizeof(LiveSegment);
+        segment_->pid = static_cast<std::uint32_t>(::getpid());
+        started_ns_ = unix_time_ns();
+        copy_field(mode_, mode);
+        copy_field(root_, root.string());
+        publish();
+        // Readers check the magic first; it goes in last, once there is a snapshot to read.
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(segment_->magic, kLiveMagic, sizeof(kLiveMagic));
+        thread_ = std::thread([this] { run(); });
+    }
+
+    ~LivePublisher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+        publish(true);
+        ::munmap(segment_, sizeof(LiveSegment));
+        ::shm_unlink(name_.c_str());
+    }
+
+    LivePublisher(const LivePublisher&) = delete;
+    LivePublisher& operator=(const LivePublisher&) = delete;
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!cv_.wait_for(lock, interval_, [this] { return stopping_; })) {
+            publish();
+        }
+    }
+
+    /**
+     * @brief Takes a snapshot of the counters, then writes it under the seqlock.
+     */
+    void publish(bool finished = false) {
+        LiveSegment::Snapshot& s = scratch_;
+        s = LiveSegment::Snapshot{};
+        s.finished = finished;
+        s.started_ns = started_ns_;
+        s.updated_ns = unix_time_ns();
+        std::memcpy(s.mode, mode_, sizeof(mode_));
+        std::memcpy(s.root, root_, sizeof(root_));
+        auto load = [](const std::atomic<std::uint64_t>& counter) { return counter.load(std::memory_order_relaxed); };
+        s.planned = load(counters_.planned);
+        s.stale = load(counters_.stale);
+        s.events = load(counters_.events);
+        s.dirs_scanned = load(counters_.dirs_scanned);
+        s.dirs_queued = load(counters_.dirs_queued);
+        const LatencyHistogram& latency = counters_.move_latency;
+        s.latency_count = latency.count();
+        s.latency_p50 = latency.quantile(0.5);
+        s.latency_p90 = latency.quantile(0.9);
+        s.latency_p99 = latency.quantile(0.99);
+        s.latency_p999 = latency.quantile(0.999);
+        s.latency_max = latency.max();
+        s.workers = std::min(counters_.worker_count.load(std::memory_order_relaxed), LiveCounters::kMaxWorkers);
+        std::uint64_t category_moved[256] = {};
+        std::size_t categories = std::min<std::size_t>(g_categories.size(), 256);
+        for (unsigned w = 0; w <= s.workers; ++w) {
+            const LiveCounters::Worker& worker = w < s.workers ? counters_.workers[w] : counters_.overflow;
+            std::uint64_t moved = load(worker.moved), skipped = load(worker.skipped), failed = load(worker.failed);
+            if (w < s.workers) {
+                s.worker_state[w] = static_cast<std::uint8_t>(worker.state.load(std::memory_order_relaxed));
+                s.worker_files[w] = moved + skipped + failed;
+            }
+            s.moved += moved;
+            s.skipped += skipped;
+            s.failed += failed;
+            s.bytes += load(worker.bytes);
+            for (std::size_t id = 0; id < categories; ++id) category_moved[id] += load(worker.category_moved[id]);
+        }
+        // The busiest categories, if there are more than fit.
+        std::vector<std::pair<std::uint64_t, std::size_t>> busy;
+        for (std::size_t id = 0; id < categories; ++id) {
+            if (category_moved[id] > 0) busy.emplace_back(category_moved[id], id);
+        }
+        if (busy.size() > LiveSegment::kCategories) {
+            std::partial_sort(busy.begin(), busy.begin() + LiveSegment::kCategories, busy.end(),
+                              [](const auto& a, const auto& b) { return a.first > b.first; });
+            busy.resize(LiveSegment::kCategories);
+        }
+        s.categories = static_cast<std::uint32_t>(busy.size());
+        for (std::size_t i = 0; i < busy.size(); ++i) {
+            copy_field(s.category_name[i], g_categories[busy[i].second]);
+            s.category_moved[i] = busy[i].first;
+        }
+
+        std::uint64_t sequence = segment_->sequence.load(std::memory_order_relaxed);
+        segment_->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&segment_->snapshot, &s, sizeof(s));
+        segment_->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    const LiveCounters& counters_;
+    std::string name_;
+    std::chrono::milliseconds interval_;
+    LiveSegment* segment_ = nullptr;
+    LiveSegment::Snapshot scratch_;
+    std::int64_t started_ns_ = 0;
+    char mode_[16];
+    char root_[256];
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+/**
+ * @brief Another process's live stats segment, mapped read-only.
+ * @throws std::runtime_error if the process publishes none or the layout differs.
+ */
+class LiveView {
+public:
+    explicit LiveView(long pid) {
+        std::string name = live_segment_name(pid);
+        int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            throw std::runtime_error("No live stats for process " + std::to_string(pid) + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        void* memory = MAP_FAILED;
+        if (::fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) == sizeof(LiveSegment)) {
+            memory = ::mmap(nullptr, sizeof(LiveSegment), PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error("Cannot read live stats of process " + std::to_string(pid) +
+                                     " (written by a different version of organize?)");
+        }
+        segment_ = static_cast<const LiveSegment*>(memory);
+        if (std::memcmp(segment_->magic, kLiveMagic, sizeof(kLiveMagic)) != 0 || segment_->size != sizeof(LiveSegment)) {
+            ::munmap(memory, sizeof(LiveSegment));
+            throw std::runtime_error("Not an organize live stats segment: " + name);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+
+    ~LiveView() { ::munmap(const_cast<LiveSegment*>(segment_), sizeof(LiveSegment)); }
+
+    LiveView(const LiveView&) = delete;
+    LiveView& operator=(const LiveView&) = delete;
+
+    /**
+     * @brief Copies out a consistent snapshot; false if the publisher kept it busy throughout.
+     */
+    bool read(LiveSegment::Snapshot& out) const {
+        for (int attempt = 0; attempt < 1000; ++attempt) {
+            std::uint64_t before = segment_->sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::memcpy(&out, &segment_->snapshot, sizeof(out));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (segment_->sequence.load(std::memory_order_relaxed) == before) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    const LiveSegment* segment_ = nullptr;
+};
+
+bool process_alive(long pid) {
+    return ::kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM;
+}
+
+/**
+ * @brief Pids of the running processes that publish live stats. Segments left behind by
+ * processes that are gone are removed on the way (Linux lists them in /dev/shm).
+ */
+std::vector<long> live_processes() {
+    std::vector<long> pids;
+#ifdef __linux__
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator("/dev/shm", ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind("organize.", 0) != 0 || name.size() == 9 ||
+            name.find_first_not_of("0123456789", 9) != std::string::npos) {
+            continue;
+        }
+        long pid = std::stol(name.substr(9));
+        if (process_alive(pid)) {
+            pids.push_back(pid);
+        } else {
+            ::shm_unlink(live_segment_name(pid).c_str());
+        }
+    }
+    std::sort(pids.begin(), pids.end());
+#endif
+    return pids;
+}
+
+/**
+ * @brief Prints one frame of `organize top`. Rates are taken against `before` when there is one.
+ */
+void render_top(std::ostream& out, long pid, const LiveSegment::Snapshot& now, const LiveSegment::Snapshot* before) {
+    char buffer[64];
+    double seconds = before ? static_cast<double>(now.updated_ns - before->updated_ns) / 1e9 : 0.0;
+    auto rate = [&](std::uint64_t current, std::uint64_t previous) {
+        if (seconds <= 0.0) return std::string();
+        std::snprintf(buffer, sizeof(buffer), " (%.1f/s)", static_cast<double>(current - previous) / seconds);
+        return std::string(buffer);
+    };
+    auto ms = [](std::uint64_t ns) { return static_cast<double>(ns) / 1e6; };
+
+    std::int64_t up = std::max<std::int64_t>(0, (now.updated_ns - now.started_ns) / 1000000000);
+    std::snprintf(buffer, sizeof(buffer), "%02lld:%02lld:%02lld", static_cast<long long>(up / 3600),
+                  static_cast<long long>(up / 60 % 60), static_cast<long long>(up % 60));
+    out << "organize " << pid << ": " << now.mode << " '" << now.root << "', up " << buffer;
+    std::int64_t age = (unix_time_ns() - now.updated_ns) / 1000000000;
+    if (age >= 5) out << " (no update for " << age << " s)";
+    out << std::endl;
+
+    out << "Files:      " << now.moved << " moved" << rate(now.moved, before ? before->moved : 0) << ", " << now.skipped
+        << " skipped, " << now.stale << " stale, " << now.failed << " failed" << std::endl;
+    bool watch = std::string_view(now.mode) == "watch";
+    if (!watch) {  // watch mode moves files without stat'ing them
+        out << "Data:       " << format_bytes(now.bytes) << " moved";
+        if (seconds > 0.0) {
+            out << " (" << format_bytes(static_cast<std::uint64_t>(static_cast<double>(now.bytes - before->bytes) / seconds))
+                << "/s)";
+        }
+        out << std::endl;
+    }
+    std::uint64_t done = now.moved + now.skipped + now.stale + now.failed;
+    out << "Queue:      " << (now.planned > done ? now.planned - done : 0) << " of " << now.planned
+        << " planned files pending, " << now.dirs_queued << " directories to scan (" << now.dirs_scanned << " scanned)"
+        << std::endl;
+    if (watch) {
+        out << "Events:     " << now.events << rate(now.events, before ? before->events : 0) << std::endl;
+    }
+    out << "Latency:    n=" << now.latency_count << " (1 move in " << LiveCounters::kLatencySample << " timed), p50=" << ms(now.latency_p50) << " ms, p90=" << ms(now.latency_p90)
+        << " ms, p99=" << ms(now.latency_p99) << " ms, p999=" << ms(now.latency_p999) << " ms, max="
+        << ms(now.latency_max) << " ms" << std::endl;
+
+    static const char* const kStates[] = {"idle", "scanning", "moving"};
+    unsigned per_state[3] = {};
+    for (unsigned w = 0; w < now.workers; ++w) ++per_state[std::min<unsigned>(now.worker_state[w], 2)];
+    out << "Workers:    " << per_state[2] << " moving, " << per_state[1] << " scanning, " << per_state[0] << " idle"
+        << std::endl;
+    for (unsigned w = 0; w < now.workers; ++w) {
+        std::snprintf(buffer, sizeof(buffer), "  #%-3u %-9s ", w, kStates[std::min<unsigned>(now.worker_state[w], 2)]);
+        out << buffer << now.worker_files[w] << " files"
+            << rate(now.worker_files[w], before && w < before->workers ? before->worker_files[w] : 0) << std::endl;
+    }
+
+    if (now.categories > 0) out << "Categories:" << std::endl;
+    for (unsigned c = 0; c < now.categories; ++c) {
+        std::uint64_t previous = 0;
+        for (unsigned p = 0; before && p < before->categories; ++p) {
+            if (std::strcmp(before->category_name[p], now.category_name[c]) == 0) previous = before->category_moved[p];
+        }
+        std::snprintf(buffer, sizeof(buffer), "  %-14s ", now.category_name[c]);
+        out << buffer << now.category_moved[c] << rate(now.category_moved[c], previous) << std::endl;
+    }
+}
+
+/**
+ * @brief `organize top [<pid>] [--once] [--interval <s>]`: shows the live stats of a running
+ * organize, refreshed every interval until Ctrl+C or until the process exits. Without a pid,
+ * the only running organize is shown (or the running ones are listed). --once prints a single
+ * frame, with rates measured over one interval.
+ * @return The exit status.
+ */
+int run_top(int argc, char* argv[]) {
+    try {
+        long pid = 0;
+        bool once = false;
+        double interval = 1.0;
+        for (int i = 0; i < argc; ++i) {
+            std::string_view arg = argv[i];
+            if (arg == "--once") {
+                once = true;
+            } else if (arg == "--interval" && i + 1 < argc) {
+                interval = std::stod(argv[++i]);
+                if (!(interval >= 0.1)) {
+                    std::cerr << "Error: --interval needs at least 0.1 seconds." << std::endl;
+                    return 1;
+                }
+            } else if (!arg.empty() && arg.find_first_not_of("0123456789") == std::string_view::npos && pid == 0) {
+                pid = std::stol(std::string(arg));
+            } else {
+                std::cerr << "Error: Unknown argument to top: '" << arg << "'. Usage: organize top [<pid>] [--once] [--interval <s>]"
+                          << std::endl;
+                return 1;
+            }
+        }
+        if (pid == 0) {
+            std::vector<long> pids = live_processes();
+            if (pids.empty()) {
+                std::cerr << "Error: No running organize publishes live stats." << std::endl;
+                return 1;
+            }
+            if (pids.size() > 1) {
+                std::cout << "Several organize processes are running; pick one with 'organize top <pid>':" << std::endl;
+                for (long running : pids) {
+                    try {
+                        LiveView view(running);
+                        LiveSegment::Snapshot snapshot;
+                        if (view.read(snapshot)) {
+                            std::cout << "  " << running << "  " << snapshot.mode << " '" << snapshot.root << "'" << std::endl;
+                        }
+                    } catch (const std::exception&) {
+                    }
+                }
+                return 1;
+            }
+            pid = pids.front();
+        }
+
+        LiveView view(pid);
+        std::signal(SIGINT, request_stop);
+        std::signal(SIGTERM, request_stop);
+        bool clear = !once && ::isatty(STDOUT_FILENO);
+        auto pause = [&]() {
+            auto until = std::chrono::steady_clock::now() + std::chrono::duration<double>(interval);
+            while (!g_stop_requested && std::chrono::steady_clock::now() < until) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+        };
+        LiveSegment::Snapshot previous{}, current{};
+        bool have_previous = false;
+        if (once) {
+            have_previous = view.read(previous);
+            pause();
+        }
+        while (!g_stop_requested) {
+            if (!view.read(current)) {
+                std::cerr << "Error: Live stats of process " << pid << " stay busy." << std::endl;
+                return 1;
+            }
+            if (clear) std::cout << "\x1b[H\x1b[2J";
+            render_top(std::cout, pid, current, have_previous ? &previous : nullptr);
+            if (once) break;
+            if (current.finished || !process_alive(pid)) {
+                std::cout << "Process " << pid << " has exited." << std::endl;
+                break;
+            }
+            previous = current;
+            have_previous = true;
+            pause();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+#endif
+
+// --- Layout snapshots: compact sorted catalogs of the category folders, diffed by merge-join ---
+// Format: the magic "ORGSNAP1", then one record per file, sorted by (category, name):
+//   varint shared+1   bytes shared with the previous key ("<category>/<name>"); 0 ends the file
+//   varint suffix_len, suffix bytes
+//   varint zigzag(inode - previous inode), varint size, varint zigzag(mtime - previous mtime)
+// Front coding plus deltas keep camera-style runs (IMG_0001.jpg, IMG_0002.jpg, ...) to a few bytes.
+
+const char SNAPSHOT_MAGIC[] = "ORGSNAP1";
+
+/**
+ * @brief One file in a snapshot; `name` is relative to its category folder.
+ */
+struct SnapshotEntry {
+    std::string category;
+    std::string name;
+    FileStamp stamp;
+};
+
+void put_varint(std::string& out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool get_varint(std::istream& in, std::uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = in.get();
+        if (c == EOF) return false;
+        value |= static_cast<std::uint64_t>(c & 0x7F) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+std::uint64_t zigzag(std::int64_t v) { return (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63); }
+std::int64_t unzigzag(std::uint64_t v) { return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1); }
+
+/**
+ * @brief Streams sorted entries into a snapshot file. The entries go to a temporary file next
+ * to it that finish() moves into place, so an earlier snapshot stays intact until the new one
+ * is complete; an unfinished writer removes its temporary file.
+ */
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const fs::path& file) : file_(file), temp_(fs::path(file) += ".tmp") {
+        out_.open(temp_, std::ios::binary | std::ios::trunc);
+        if (!out_) {
+            throw std::runtime_error("Cannot open snapshot file for writing: " + temp_.string());
+        }
+        out_.write(SNAPSHOT_MAGIC, 8);
+    }
+
+    ~SnapshotWriter() {
+        if (!finished_) {
+            out_.close();
+            std::error_code ec;
+            fs::remove(temp_, ec);
+        }
+    }
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    void add(const std::string& category, const std::string& name, const FileStamp& stamp) {
+        std::string key = category + '/' + name;
+        std::size_t shared = 0;
+        while (shared < key.size() && shared < previous_key_.size() && key[shared] == previous_key_[shared]) ++shared;
+        buffer_.clear();
+        put_varint(buffer_, shared + 1);
+        put_varint(buffer_, key.size() - shared);
+        buffer_.append(key, shared, std::string::npos);
+        put_varint(buffer_, zigzag(static_cast<std::int64_t>(stamp.inode - previous_.inode)));
+        put_varint(buffer_, stamp.size);
+        put_varint(buffer_, zigzag(stamp.mtime_ns - previous_.mtime_ns));
+        out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        previous_key_ = std::move(key);
+        previous_ = stamp;
+        ++count_;
+    }
+
+    std::size_t finish() {
+        out_.put('\0');
+        if (!out_.flush()) {
+            throw std::runtime_error("Error writing snapshot file: " + temp_.string());
+        }
+        out_.close();
+#ifndef _WIN32
+        if (int err = fsync_file(temp_); err != 0) {
+            throw std::runtime_error("Error writing snapshot file: " + temp_.string() + ": " + std::strerror(err));
+        }
+#endif
+        std::error_code ec;
+        fs::rename(temp_, file_, ec);
+        if (ec) {
+            throw std::runtime_error("Cannot replace snapshot file '" + file_.string() + "': " + ec.message());
+        }
+        finished_ = true;
+#ifndef _WIN32
+        fsync_directory(file_.parent_path().empty() ? fs::path(".") : file_.parent_path());
+#endif
+        return count_;
+    }
+
+private:
+    fs::path file_;
+    fs::path temp_;
+    std::ofstream out_;
+    bool finished_ = false;
+    std::string buffer_;
+    std::string previous_key_;
+    FileStamp previous_;
+    std::size_t count_ = 0;
+};
+
+/**
+ * @brief Streams entries back out of a snapshot file, one at a time.
+ */
+class SnapshotReader {
+public:
+    explicit SnapshotReader(const fs::path& file) : in_(file, std::ios::binary), file_(file) {
+        char magic[8];
+        if (!in_ || !in_.read(magic, 8) || std::memcmp(magic, SNAPSHOT_MAGIC, 8) != 0) {
+            throw std::runtime_error("Not an organize snapshot: " + file.string());
+        }
+    }
+
+    /**
+     * @brief Reads the next entry; returns false at the end of the snapshot.
+     */
+    bool next(SnapshotEntry& entry) {
+        std::uint64_t shared = 0, suffix = 0, inode = 0, size = 0, mtime = 0;
+        if (!get_varint(in_, shared)) corrupt();
+        if (shared == 0) return false;
+        if (--shared > key_.size() || !get_varint(in_, suffix)) corrupt();
+        key_.resize(static_cast<std::size_t>(shared + suffix));
+        if (!in_.read(&key_[static_cast<std::size_t>(shared)], static_cast<std::streamsize>(suffix))) corrupt();
+        if (!get_varint(in_, inode) || !get_varint(in_, size) || !get_varint(in_, mtime)) corrupt();
+        stamp_.inode += static_cast<std::uint64_t>(unzigzag(inode));
+        stamp_.size = size;
+        stamp_.mtime_ns += unzigzag(mtime);
+
+        std::size_t slash = key_.find('/');
+        if (slash == std::string::npos) corrupt();
+        entry.category.assign(key_, 0, slash);
+        entry.name.assign(key_, slash + 1, std::string::npos);
+        entry.stamp = stamp_;
+        return true;
+    }
+
+private:
+    [[noreturn]] void corrupt() { throw std::runtime_error("Corrupt snapshot: " + file_.string()); }
+
+    std::ifstream in_;
+    fs::path file_;
+    std::string key_;
+    FileStamp stamp_;
+};
+
+/**
+ * @brief Writes a snapshot of every file below the category folders of `base_path`.
+ * Categories are written in name order and each one is sorted on its own, so memory is
+ * bounded by the largest category rather than the whole tree.
+ * @return The number of entries written.
+ */
+std::size_t write_snapshot(FsBackend& backend, const fs::path& base_path, const fs::path& file) {
+    std::vector<std::string> categories;
+    for (const auto& [folder, _] : FOLDER_MAP) categories.push_back(folder);
+    std::sort(categories.begin(), categories.end());
+
+    SnapshotWriter writer(file);
+    std::vector<std::pair<std::string, FileStamp>> entries;
+    for (const auto& category : categories) {
+        entries.clear();
+        fs::path dir = base_path / category;
+        std::error_code ec;
+        for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            if (!it->is_regular_file(ec)) continue;
+            FileStamp stamp;
+            if (backend.stat(it->path(), stamp, ec)) {
+                entries.emplace_back(it->path().lexically_relative(dir).generic_string(), stamp);
+            }
+        }
+        std::sort(entries.begin(), entries.end(), [](const auto& x, const auto& y) { return x.first < y.first; });
+        for (const auto& [name, stamp] : entries) {
+            writer.add(category, name, stamp);
+        }
+    }
+    return writer.finish();
+}
+
+/**
+ * @brief Prints what arrived, disappeared, changed or moved between two snapshots.
+ * Both are read once, in order, with a merge-join; only unmatched entries are held in memory
+ * (to pair them up by inode as moves), so memory follows the churn, not the snapshot size.
+ */
+void diff_snapshots(const fs::path& old_file, const fs::path& new_file, std::ostream& out) {
+    SnapshotReader old_reader(old_file), new_reader(new_file);
+    SnapshotEntry a, b;
+    bool has_a = old_reader.next(a), has_b = new_reader.next(b);
+
+    struct Counts { std::size_t arrived = 0, disappeared = 0, changed = 0, moved_in = 0, moved_out = 0; };
+    std::unordered_map<std::string, Counts> per_category;
+    std::unordered_map<std::uint64_t, SnapshotEntry> gone, arrived;  // keyed by inode
+    std::vector<SnapshotEntry> gone_no_inode, arrived_no_inode;
+
+    auto less = [](const SnapshotEntry& x, const SnapshotEntry& y) {
+        return x.category != y.category ? x.category < y.category : x.name < y.name;
+    };
+    while (has_a || has_b) {
+        if (has_a && (!has_b || less(a, b))) {
+            // Hard links share an inode; only the first can be paired, the rest are plain changes.
+            if (!a.stamp.inode || !gone.emplace(a.stamp.inode, a).second) gone_no_inode.push_back(a);
+            has_a = old_reader.next(a);
+        } else if (has_b && (!has_a || less(b, a))) {
+            if (!b.stamp.inode || !arrived.emplace(b.stamp.inode, b).second) arrived_no_inode.push_back(b);
+            has_b = new_reader.next(b);
+        } else {
+            if (a.stamp.inode != b.stamp.inode || a.stamp.size != b.stamp.size || a.stamp.mtime_ns != b.stamp.mtime_ns) {
+                out << "~ " << b.category << "/" << b.name << std::endl;
+                ++per_category[b.category].changed;
+            }
+            has_a = old_reader.next(a);
+            has_b = new_reader.next(b);
+        }
+    }
+
+    // Pair disappeared and arrived entries that share an inode, size and mtime: those are moves
+    // or renames. Requiring size and mtime as well keeps a recycled inode from posing as a move.
+    std::vector<std::pair<std::string, std::string>> lines;
+    for (auto& [inode, from] : gone) {
+        auto it = arrived.find(inode);
+        if (it != arrived.end() && it->second.stamp.size == from.stamp.size &&
+            it->second.stamp.mtime_ns == from.stamp.mtime_ns) {
+            lines.emplace_back(from.category + "/" + from.name, "> " + from.category + "/" + from.name + " -> " +
+                                                                    it->second.category + "/" + it->second.name);
+            ++per_category[from.category].moved_out;
+            ++per_category[it->second.category].moved_in;
+            arrived.erase(it);
+        } else {
+            gone_no_inode.push_back(std::move(from));
+        }
+    }
+    for (auto& [inode, to] : arrived) arrived_no_inode.push_back(std::move(to));
+    for (const auto& e : gone_no_inode) {
+        lines.emplace_back(e.category + "/" + e.name, "- " + e.category + "/" + e.name);
+        ++per_category[e.category].disappeared;
+    }
+    for (const auto& e : arrived_no_inode) {
+        lines.emplace_back(e.category + "/" + e.name, "+ " + e.category + "/" + e.name);
+        ++per_category[e.category].arrived;
+    }
+    std::sort(lines.begin(), lines.end());
+    for (const auto& line : lines) out << line.second << std::endl;
+
+    std::vector<std::string> categories;
+    for (const auto& [category, _] : per_category) categories.push_back(category);
+    std::sort(categories.begin(), categories.end());
+    out << "Changes by category:" << std::endl;
+    for (const auto& category : categories) {
+        const Counts& c = per_category[category];
+        out << "  " << category << ": " << c.arrived << " arrived, " << c.disappeared << " disappeared, " << c.changed
+            << " changed, " << c.moved_in << " moved in, " << c.moved_out << " moved out" << std::endl;
+    }
+}
+
+// --- Mirror mode: an organized copy of a source that is never modified ---
+// The state file records what has been mirrored, sorted by source path, so a run merge-joins
+// it against the scan and copies only what is new or changed (by size and mtime):
+//   the magic "ORGMIR01", varint folder count, per folder varint length and bytes ("Images")
+//   then one record per file:
+//   varint shared+1   bytes shared with the previous source path ('/'-separated, relative
+//                     to the source folder); 0 ends the file
+//   varint suffix_len, suffix bytes
+//   varint size, varint zigzag(mtime - previous mtime)
+//   varint folder index * 2 + renamed; if renamed, varint length and the copy's own file name
+
+const char MIRROR_MAGIC[] = "ORGMIR01";
+
+/**
+ * @brief One mirrored file: where it came from, what it looked like when copied, and where
+ * the copy is (relative to the destination root).
+ */
+struct MirrorRecord {
+    std::string source;
+    FileStamp stamp;
+    std::string copy;
+};
+
+/**
+ * @brief Writes a mirror state file from records in source order, through a temporary file
+ * that replaces the old state only once complete and flushed to disk.
+ */
+void write_mirror_state(const fs::path& file, const std::vector<const MirrorRecord*>& records) {
+    std::vector<std::string> folders;
+    std::unordered_map<std::string, std::uint64_t> folder_index;
+    for (const MirrorRecord* record : records) {
+        std::string folder = fs::path(record->copy).parent_path().generic_string();
+        if (folder_index.emplace(folder, folders.size()).second) folders.push_back(folder);
+    }
+
+    fs::path temp = file;
+    temp += ".tmp";
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot open mirror state for writing: " + temp.string());
+    }
+    std::string buffer(MIRROR_MAGIC, 8);
+    put_varint(buffer, folders.size());
+    for (const std::string& folder : folders) {
+        put_varint(buffer, folder.size());
+        buffer += folder;
+    }
+    const std::string* previous = nullptr;
+    std::int64_t previous_mtime = 0;
+    for (const MirrorRecord* record : records) {
+        const std::string& key = record->source;
+        std::size_t shared = 0;
+        if (previous) {
+            while (shared < key.size() && shared < previous->size() && key[shared] == (*previous)[shared]) ++shared;
+        }
+        put_varint(buffer, shared + 1);
+        put_varint(buffer, key.size() - shared);
+        buffer.append(key, shared, std::string::npos);
+        put_varint(buffer, record->stamp.size);
+        put_varint(buffer, zigzag(record->stamp.mtime_ns - previous_mtime));
+        fs::path copy(record->copy);
+        std::string name = copy.filename().string();
+        bool renamed = name != fs::path(key).filename().string();
+        put_varint(buffer, folder_index[copy.parent_path().generic_string()] * 2 + renamed);
+        if (renamed) {
+            put_varint(buffer, name.size());
+            buffer += name;
+        }
+        previous = &key;
+        previous_mtime = record->stamp.mtime_ns;
+        if (buffer.size() >= (1 << 16)) {
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+    }
+    buffer += '\0';
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    if (!out.flush()) {
+        throw std::runtime_error("Error writing mirror state: " + temp.string());
+    }
+    out.close();
+#ifndef _WIN32
+    if (int err = fsync_file(temp); err != 0) {
+        throw std::runtime_error("Error writing mirror state: " + temp.string() + ": " + std::strerror(err));
+    }
+#endif
+    std::error_code ec;
+    fs::rename(temp, file, ec);
+    if (ec) {
+        throw std::runtime_error("Cannot replace mirror state '" + file.string() + "': " + ec.message());
+    }
+#ifndef _WIN32
+    fsync_directory(file.parent_path());
+#endif
+}
+
+/**
+ * @brief Streams the records of a mirror state file back, one at a time.
+ */
+class MirrorStateReader {
+public:
+    explicit MirrorStateReader(const fs::path& file) : in_(file, std::ios::binary), file_(file) {
+        char magic[8];
+        if (!in_ || !in_.read(magic, 8) || std::memcmp(magic, MIRROR_MAGIC, 8) != 0) {
+            throw std::runtime_error("Not an organize mirror state: " + file.string());
+        }
+        std::uint64_t count = 0, length = 0;
+        if (!get_varint(in_, count)) corrupt();
+        for (std::uint64_t i = 0; i < count; ++i) {
+            if (!get_varint(in_, length) || length > 4096) corrupt();
+            std::string folder(static_cast<std::size_t>(length), '\0');
+            if (!in_.read(folder.data(), static_cast<std::streamsize>(length))) corrupt();
+            folders_.push_back(std::move(folder));
+        }
+    }
+
+    /**
+     * @brief Reads the next record; returns false at the end of the state.
+     */
+    bool next(MirrorRecord& record) {
+        std::uint64_t shared = 0, suffix = 0, size = 0, mtime = 0, folder = 0, length = 0;
+        if (!get_varint(in_, shared)) corrupt();
+        if (shared == 0) return false;
+        if (--shared > key_.size() || !get_varint(in_, suffix)) corrupt();
+        key_.resize(static_cast<std::size_t>(shared + suffix));
+        if (!in_.read(&key_[static_cast<std::size_t>(shared)], static_cast<std::streamsize>(suffix))) corrupt();
+        if (!get_varint(in_, size) || !get_varint(in_, mtime) || !get_varint(in_, folder)) corrupt();
+        if ((folder >> 1) >= folders_.size()) corrupt();
+        mtime_ += unzigzag(mtime);
+        record.source = key_;
+        record.stamp = FileStamp();
+        record.stamp.size = size;
+        record.stamp.mtime_ns = mtime_;
+        record.copy = folders_[static_cast<std::size_t>(folder >> 1)];
+        record.copy += '/';
+        if (folder & 1) {
+            if (!get_varint(in_, length) || length > 4096) corrupt();
+            std::size_t at = record.copy.size();
+            record.copy.resize(at + static_cast<std::size_t>(length));
+            if (!in_.read(&record.copy[at], static_cast<std::streamsize>(length))) corrupt();
+        } else {
+            std::size_t slash = key_.rfind('/');
+            record.copy.append(key_, slash == std::string::npos ? 0 : slash + 1, std::string::npos);
+        }
+        return true;
+    }
+
+private:
+    [[noreturn]] void corrupt() { throw std::runtime_error("Corrupt mirror state: " + file_.string()); }
+
+    std::ifstream in_;
+    fs::path file_;
+    std::vector<std::string> folders_;
+    std::string key_;
+    std::int64_t mtime_ = 0;
+};
+
+enum class CopyMethod { Reflink, Kernel, Buffered };
+
+/**
+ * @brief Copies a file to a new path, the cheapest way the filesystems allow: a reflink that
+ * shares the extents (Btrfs, XFS), else copy_file_range(), which keeps the data in the kernel
+ * and lets NFS 4.2 or SMB servers copy server-side, else copy_contents(). Metadata is carried
+ * over as by copy_no_clobber(), and the copy is fsync'ed before it is closed, so it can be
+ * renamed into place and recorded; a partial copy is unlinked again.
+ * @return false on failure, with the error in `ec`.
+ */
+bool clone_file(const fs::path& from, const fs::path& to, CopyMethod& method, std::error_code& ec) {
+    ec.clear();
+#ifndef _WIN32
+    int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        ec.assign(errno, std::generic_category());
+        return false;
+    }
+    struct stat st;
+    int out = -1;
+    if (::fstat(in, &st) != 0 ||
+        (out = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777)) < 0) {
+        ec.assign(errno, std::generic_category());
+        ::close(in);
+        return false;
+    }
+    int err = -1;  // -1: not copied yet
+    method = CopyMethod::Buffered;
+#ifdef __linux__
+    if (::ioctl(out, FICLONE, in) == 0) {
+        method = CopyMethod::Reflink;
+        err = 0;
+    }
+    for (off_t done = 0; err < 0;) {
+        ssize_t n = ::copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0);
+        if (n > 0) {
+            method = CopyMethod::Kernel;
+            done += n;
+        } else if (n == 0) {
+            err = 0;  // end of the source
+        } else if (errno == EINTR) {
+            continue;
+        } else if (done == 0 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)) {
+            break;  // not possible between these files; copy through user space
+        } else {
+            err = errno;
+        }
+    }
+#endif
+    if (err < 0) {
+        err = copy_contents(in, out, static_cast<std::uint64_t>(st.st_size));
+    }
+    if (err == 0 && !copy_metadata(in, out, st)) {
+        ++g_metadata_losses;
+    }
+    if (err == 0 && ::fsync(out) != 0) {
+        err = errno;
+    }
+    if (::close(out) != 0 && err == 0) {
+        err = errno;
+    }
+    ::close(in);
+    if (err != 0) {
+        ::unlink(to.c_str());
+        ec.assign(err, std::generic_category());
+        return false;
+    }
+    return true;
+#else
+    method = CopyMethod::Buffered;
+    if (!fs::copy_file(from, to, fs::copy_options::none, ec)) {
+        std::error_code ignored;
+        fs::remove(to, ignored);
+        return false;
+    }
+    return true;
+#endif
+}
+
+/**
+ * @brief Removes the temporary copies (copy_temp_path()) in `dir` that were left by runs that
+ * are no longer running, so an interrupted copy does not linger in the library.
+ * @return How many were removed.
+ */
+std::size_t remove_stale_copies(const fs::path& dir) {
+    std::size_t removed = 0;
+#ifndef _WIN32
+    static const std::string kPrefix = ".organize-copy-";
+    std::error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (name.compare(0, kPrefix.size(), kPrefix) != 0) continue;
+        long pid = std::strtol(name.c_str() + kPrefix.size(), nullptr, 10);
+        if (pid <= 0 || process_alive(pid)) continue;
+        std::error_code ignored;
+        removed += fs::remove(it->path(), ignored);
+    }
+#else
+    (void)dir;
+#endif
+    return removed;
+}
+
+struct MirrorReport {
+    std::size_t added = 0;
+    std::size_t updated = 0;
+    std::size_t unchanged = 0;
+    std::size_t adopted = 0;     // copies found in place from an interrupted run
+    std::size_t failed = 0;
+    std::size_t gone = 0;        // recorded sources that no longer exist; their copies are kept
+    std::size_t swept = 0;       // temporary copies left by interrupted runs, removed
+    std::size_t reflinked = 0;
+    std::size_t kernel_copied = 0;
+    std::uint64_t bytes = 0;
+};
+
+/**
+ * @brief Mirrors the files of `base_path` into the category folders below `scan.dest`
+ * without modifying the source. The scan is merged with the state of the previous run, so
+ * only new and changed files are copied: work beyond the scan is proportional to the churn.
+ * New files are copied next to their destination under a temporary name and then renamed
+ * into place without clobbering, taking "name (2).ext" and so on when another source already
+ * took the name. Changed files replace their earlier copy atomically, in the same place.
+ * Copies are fsync'ed before they are renamed, and their folders before the state records
+ * them, so the state never names a copy a crash could have lost. Temporary copies left by
+ * interrupted runs are removed from the folders a run writes to before it starts copying.
+ * Copies of files that disappeared from the source are kept, and so are copies removed from
+ * the mirror until their source changes; removing the state file forces a full pass.
+ */
+MirrorReport mirror_files(FsBackend& backend, const fs::path& base_path, const fs::path& self_path,
+                          const fs::path& state_file, unsigned jobs, ScanOptions scan) {
+    constexpr int kMaxSuffix = 1000;
+    const fs::path& root = scan.dest;
+    scan.jobs = jobs;
+    std::vector<PlanEntry> plan = build_plan(backend, base_path, self_path, scan);
+    ensure_folders(backend, root);
+    ensure_plan_folders(backend, root, plan);
+
+    enum class Action : std::uint8_t { Unchanged, Add, Update };
+    std::vector<MirrorRecord> records(plan.size());
+    std::vector<const MirrorRecord*> order(plan.size());
+    for (std::size_t i = 0; i < plan.size(); ++i) {
+        records[i].source = plan[i].source.lexically_relative(base_path).generic_string();
+        records[i].stamp = plan[i].stamp;
+        records[i].copy = plan[i].destination.lexically_relative(root).generic_string();
+        order[i] = &records[i];
+    }
+    std::sort(order.begin(), order.end(), [](const MirrorRecord* a, const MirrorRecord* b) { return a->source < b->source; });
+
+    // Merge-join the sorted scan with the previous state.
+    MirrorReport report;
+    std::vector<Action> actions(plan.size(), Action::Add);
+    std::vector<MirrorRecord> kept;  // previous records of changed files, restored if the update fails
+    std::vector<std::size_t> kept_index(plan.size(), SIZE_MAX);
+    std::error_code ec;
+    // An empty state, as a crash before the state was flushed could leave, is no state: a full
+    // pass takes the copies already in place over.
+    std::uintmax_t state_size = fs::file_size(state_file, ec);
+    if (!ec && state_size > 0) {
+        MirrorStateReader reader(state_file);
+        MirrorRecord old;
+        bool has_old = reader.next(old);
+        for (const MirrorRecord* record : order) {
+            while (has_old && old.source < record->source) {
+                ++report.gone;
+                has_old = reader.next(old);
+            }
+            if (!has_old || old.source != record->source) continue;
+            std::size_t i = static_cast<std::size_t>(record - records.data());
+            if (old.stamp.size == record->stamp.size && old.stamp.mtime_ns == record->stamp.mtime_ns) {
+                actions[i] = Action::Unchanged;
+            } else {
+                actions[i] = Action::Update;
+                kept_index[i] = kept.size();
+                kept.push_back(old);
+            }
+            records[i].copy = std::move(old.copy);
+            has_old = reader.next(old);
+        }
+        for (; has_old; has_old = reader.next(old)) ++report.gone;
+    }
+
+    std::vector<std::size_t> work;
+    for (std::size_t i = 0; i < plan.size(); ++i) {
+        if (actions[i] == Action::Unchanged) {
+            ++report.unchanged;
+        } else {
+            work.push_back(i);
+        }
+    }
+    // The folders this run writes to: cleared of temporary copies left by interrupted runs
+    // first, and flushed before the state records what went into them.
+    auto folder_of = [&](std::size_t i) { return (root / fs::path(records[i].copy)).parent_path(); };
+    std::vector<fs::path> folders;
+    for (std::size_t i : work) folders.push_back(folder_of(i));
+    std::sort(folders.begin(), folders.end());
+    folders.erase(std::unique(folders.begin(), folders.end()), folders.end());
+    for (const fs::path& folder : folders) report.swept += remove_stale_copies(folder);
+
+    std::vector<std::uint8_t> failed(plan.size(), 0), took_over(plan.size(), 0);
+    std::atomic<std::size_t> added{0}, updated{0}, adopted{0}, reflinked{0}, kernel_copied{0};
+    std::atomic<std::uint64_t> bytes{0};
+    if (g_live) g_live->planned += work.size();
+    parallel_for(work.size(), jobs, [&](std::size_t w) {
+        std::size_t i = work[w];
+        MirrorRecord& record = records[i];
+        auto started = live_move_started();
+        fs::path destination = root / fs::path(record.copy);
+        fs::path temp = copy_temp_path(destination.parent_path());
+        std::error_code ec;
+        CopyMethod method = CopyMethod::Buffered;
+        bool copied = false;
+        if (actions[i] == Action::Update) {
+            copied = clone_file(plan[i].source, temp, method, ec);
+            if (copied) fs::rename(temp, destination, ec);
+            failed[i] = !copied || ec;
+        } else {
+            std::string stem = destination.stem().string();
+            std::string ext = destination.extension().string();
+            MoveStatus status = MoveStatus::Exists;
+            for (int n = 1; n <= kMaxSuffix && status == MoveStatus::Exists; ++n) {
+                fs::path candidate = n == 1 ? destination
+                                            : destination.parent_path() / (stem + " (" + std::to_string(n) + ")" + ext);
+                FileStamp there;
+                if (read_file_stamp(candidate, there, ec)) {
+                    // A matching copy was made by a run that did not get to save its state:
+                    // take it over instead of copying again under another name.
+                    if (there.size == record.stamp.size && there.mtime_ns == record.stamp.mtime_ns) {
+                        record.copy = candidate.lexically_relative(root).generic_string();
+                        took_over[i] = 1;
+                        ++adopted;
+                        live_move_done(MoveStatus::Exists, plan[i].category, record.stamp.size, started);
+                        return;
+                    }
+                    continue;
+                }
+                if (!copied && !(copied = clone_file(plan[i].source, temp, method, ec))) {
+                    status = MoveStatus::Failed;
+                    break;
+                }
+                status = move_no_clobber(temp, candidate, ec);
+                if (status == MoveStatus::Moved) {
+                    record.copy = candidate.lexically_relative(root).generic_string();
+                }
+            }
+            if (status == MoveStatus::Exists) {
+                ec = std::make_error_code(std::errc::file_exists);
+            }
+            failed[i] = status != MoveStatus::Moved;
+        }
+        live_move_done(failed[i] ? MoveStatus::Failed : MoveStatus::Moved, plan[i].category, record.stamp.size, started);
+        if (failed[i]) {
+            std::error_code ignored;
+            fs::remove(temp, ignored);
+            if (g_quiet) return;
+            std::lock_guard<std::mutex> lock(g_console_mutex);
+            std::cerr << "Error mirroring file '" << record.source << "': " << ec.message() << std::endl;
+            return;
+        }
+        ++(actions[i] == Action::Update ? updated : added);
+        if (method == CopyMethod::Reflink) ++reflinked;
+        if (method == CopyMethod::Kernel) ++kernel_copied;
+        bytes += record.stamp.size;
+    });
+    if (g_live) g_live->set_idle();
+
+    // New names must be durable before the state records them; a folder that cannot be flushed
+    // fails the copies made into it this run.
+    std::vector<int> folder_errors(folders.size(), 0);
+#ifndef _WIN32
+    for (std::size_t f = 0; f < folders.size(); ++f) {
+        folder_errors[f] = fsync_directory(folders[f]);
+        if (folder_errors[f] != 0) {
+            std::cerr << "Error flushing directory " << folders[f].string() << ": " << std::strerror(folder_errors[f])
+                      << std::endl;
+        }
+    }
+#endif
+    for (std::size_t i : work) {
+        if (failed[i]) continue;
+        fs::path folder = folder_of(i);
+        std::size_t f = static_cast<std::size_t>(std::lower_bound(folders.begin(), folders.end(), folder) - folders.begin());
+        if (folder_errors[f] != 0) {
+            failed[i] = 1;
+            --(took_over[i] ? adopted : actions[i] == Action::Update ? updated : added);
+        }
+    }
+
+    // Record what the mirror now holds: failed updates keep their previous record so the next
+    // run tries again, failed additions are left out.
+    std::vector<const MirrorRecord*> state;
+    state.reserve(order.size());
+    for (const MirrorRecord* record : order) {
+        std::size_t i = static_cast<std::size_t>(record - records.data());
+        if (!failed[i]) {
+            state.push_back(record);
+        } else if (kept_index[i] != SIZE_MAX) {
+            state.push_back(&kept[kept_index[i]]);
+        }
+        report.failed += failed[i];
+    }
+    write_mirror_state(state_file, state);
+
+    report.added = added;
+    report.updated = updated;
+    report.adopted = adopted;
+    report.reflinked = reflinked;
+    report.kernel_copied = kernel_copied;
+    report.bytes = bytes;
+    return report;
+}
+
+/**
+ * @brief Prints the outcome of a mirror run.
+ */
+void print_mirror_report(std::ostream& out, const MirrorReport& report) {
+    out << "Mirror complete: " << report.added << " added, " << report.updated << " updated, " << report.unchanged
+        << " unchanged, " << report.failed << " failed." << std::endl;
+    if (report.added + report.updated > 0) {
+        out << "Copied " << format_bytes(report.bytes) << " (" << report.reflinked << " files reflinked, "
+            << report.kernel_copied << " copied in the kernel)." << std::endl;
+    }
+    if (report.swept > 0) {
+        out << "Removed " << report.swept << " temporary copies left by interrupted runs." << std::endl;
+    }
+    if (report.adopted > 0) {
+        out << "Took over " << report.adopted << " copies left by an interrupted run." << std::endl;
+    }
+    if (report.gone > 0) {
+        out << report.gone << " mirrored sources no longer exist; their copies were kept." << std::endl;
+    }
+}
+
+// --- Integrity scrub: re-hash organized files against the hashes recorded when they arrived ---
+// The hash database is NDJSON, like plans and traces, keyed by path below the base folder:
+//   {"organize_hashes":1}
+//   {"path":"Images/a.jpg","size":5678,"mtime":1700000000000000000,"xxh64":"9c3f0e5b2a7d4e11"}
+// Organize runs given --hash-db hash the files in the category folders that are new or changed
+// since their record. --scrub re-reads every recorded file whose size and mtime still match and
+// reports content that no longer hashes the same. Files are read whole and in physical order
+// (FIEMAP) under a shared bandwidth cap, and a stopped scrub resumes from a position file kept
+// next to the database.
+
+/**
+ * @brief Streaming XXH64 (seed 0): fast enough to keep up with sequential disk reads.
+ */
+class Xxh64 {
+public:
+    void update(const unsigned char* data, std::size_t len) {
+        total_ += len;
+        if (buffered_ + len < 32) {
+            std::memcpy(buffer_ + buffered_, data, len);
+            buffered_ += len;
+            return;
+        }
+        if (buffered_ > 0) {
+            std::size_t fill = 32 - buffered_;
+            std::memcpy(buffer_ + buffered_, data, fill);
+            consume(buffer_);
+            data += fill;
+            len -= fill;
+            buffered_ = 0;
+        }
+        for (; len >= 32; data += 32, len -= 32) {
+            consume(data);
+        }
+        std::memcpy(buffer_, data, len);
+        buffered_ = len;
+    }
+
+    std::uint64_t digest() const {
+        std::uint64_t h = total_ >= 32 ? rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18) : kP5;
+        if (total_ >= 32) {
+            for (std::uint64_t v : v_) {
+                h = (h ^ round(0, v)) * kP1 + kP4;
+            }
+        }
+        h += total_;
+        const unsigned char* p = buffer_;
+        std::size_t left = buffered_;
+        for (; left >= 8; p += 8, left -= 8) {
+            h = rotl(h ^ round(0, read64(p)), 27) * kP1 + kP4;
+        }
+        if (left >= 4) {
+            std::uint32_t k;
+            std::memcpy(&k, p, 4);
+            h = rotl(h ^ (k * kP1), 23) * kP2 + kP3;
+            p += 4;
+            left -= 4;
+        }
+        for (; left > 0; ++p, --left) {
+            h = rotl(h ^ (*p * kP5), 11) * kP1;
+        }
+        h ^= h >> 33;
+        h *= kP2;
+        h ^= h >> 29;
+        h *= kP3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    static constexpr std::uint64_t kP1 = 0x9E3779B185EBCA87ull;
+    static constexpr std::uint64_t kP2 = 0xC2B2AE3D27D4EB4Full;
+    static constexpr std::uint64_t kP3 = 0x165667B19E3779F9ull;
+    static constexpr std::uint64_t kP4 = 0x85EBCA77C2B2AE63ull;
+    static constexpr std::uint64_t kP5 = 0x27D4EB2F165667C5ull;
+
+    static std::uint64_t rotl(std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static std::uint64_t round(std::uint64_t acc, std::uint64_t input) { return rotl(acc + input * kP2, 31) * kP1; }
+    static std::uint64_t read64(const unsigned char* p) {
+        std::uint64_t v;
+        std::memcpy(&v, p, 8); // the format is little-endian, like the hosts this runs on
+        return v;
+    }
+
+    void consume(const unsigned char* p) {
+        for (int i = 0; i < 4; ++i) {
+            v_[i] = round(v_[i], read64(p + 8 * i));
+        }
+    }
+
+    std::uint64_t v_[4] = {kP1 + kP2, kP2, 0, 0 - kP1};
+    std::uint64_t total_ = 0;
+    unsigned char buffer_[32];
+    std::size_t buffered_ = 0;
+};
+
+/**
+ * @brief Caps the combined read bandwidth of all scrub workers. Each read books the next slot
+ * on a shared schedule and sleeps until it starts, so the long-run rate never exceeds the cap.
+ */
+class RateLimiter {
+public:
+    explicit RateLimiter(double bytes_per_second) : rate_(bytes_per_second) {}
+
+    void acquire(std::uint64_t bytes) {
+        if (rate_ <= 0) return;
+        std::chrono::steady_clock::time_point start;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto now = std::chrono::steady_clock::now();
+            if (next_ < now) next_ = now;
+            start = next_;
+            next_ += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(static_cast<double>(bytes) / rate_));
+        }
+        std::this_thread::sleep_until(start);
+    }
+
+private:
+    double rate_;
+    std::mutex mutex_;
+    std::chrono::steady_clock::time_point next_;
+};
+
+/**
+ * @brief Physical byte offset of a file's first extent, or UINT64_MAX if the filesystem
+ * cannot say (no FIEMAP, an inline or empty file, or another platform).
+ */
+std::uint64_t physical_offset(const fs::path& path) {
+#ifdef __linux__
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return UINT64_MAX;
+    // Room for the header and a single extent, which is all the ordering needs.
+    alignas(struct fiemap) unsigned char request[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+    auto* map = reinterpret_cast<struct fiemap*>(request);
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+    bool mapped = ::ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0;
+    ::close(fd);
+    return mapped ? map->fm_extents[0].fe_physical : UINT64_MAX;
+#else
+    (void)path;
+    return UINT64_MAX;
+#endif
+}
+
+/**
+ * @brief Hashes a whole file with sequential, rate-limited reads, dropping it from the page
+ * cache afterwards so a scrub does not evict the foreground working set. Each read is charged
+ * what it is expected to return given the file's `size`, so small files cost only their size
+ * and the read that finds the end costs nothing; bytes past `size` are charged once read.
+ * @return false if the file cannot be read or the scrub was stopped midway (`ec` stays clear).
+ *         Reading stops once `stop` is set, a stop is requested or `deadline` passes.
+ */
+bool hash_file(const fs::path& path, std::uint64_t size, RateLimiter& limiter, std::uint64_t& hash,
+               std::error_code& ec, std::atomic<bool>& stop, std::chrono::steady_clock::time_point deadline) {
+    auto stopped = [&]() {
+        if (g_stop_requested || std::chrono::steady_clock::now() >= deadline) stop = true;
+        return stop.load(std::memory_order_relaxed);
+    };
+    constexpr std::size_t kChunk = 1 << 20;
+    std::vector<unsigned char> buffer(kChunk);
+    Xxh64 hasher;
+    std::uint64_t hashed = 0;
+    auto charge_before = [&]() {
+        if (hashed < size) limiter.acquire(std::min<std::uint64_t>(kChunk, size - hashed));
+    };
+    auto charge_after = [&](std::uint64_t got) {
+        std::uint64_t expected = hashed < size ? std::min<std::uint64_t>(kChunk, size - hashed) : 0;
+        if (got > expected) limiter.acquire(got - expected);
+        hashed += got;
+    };
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ec.assign(errno, std::generic_category());
+        return false;
+    }
+#ifdef __linux__
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    bool ok = true;
+    while (!stopped()) {
+        charge_before();
+        ssize_t n = ::read(fd, buffer.data(), kChunk);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            ec.assign(errno, std::generic_category());
+            ok = false;
+            break;
+        }
+        if (n == 0) break;
+        charge_after(static_cast<std::uint64_t>(n));
+        hasher.update(buffer.data(), static_cast<std::size_t>(n));
+    }
+#ifdef __linux__
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    ::close(fd);
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        ec = std::make_error_code(std::errc::io_error);
+        return false;
+    }
+    bool ok = true;
+    while (in && !stopped()) {
+        charge_before();
+        in.read(reinterpret_cast<char*>(buffer.data()), kChunk);
+        charge_after(static_cast<std::uint64_t>(in.gcount()));
+        hasher.update(buffer.data(), static_cast<std::size_t>(in.gcount()));
+    }
+    if (in.bad()) {
+        ec = std::make_error_code(std::errc::io_error);
+        ok = false;
+    }
+#endif
+    if (!ok || stop) return false;
+    hash = hasher.digest();
+    return true;
+}
+
+/**
+ * @brief One file's entry in the hash database.
+ */
+struct HashRecord {
+    std::uint64_t size = 0;
+    std::int64_t mtime_ns = 0;
+    std::uint64_t hash = 0;
+};
+
+using HashDatabase = std::unordered_map<std::string, HashRecord>;
+
+const char HASH_DB_HEADER[] = "{\"organize_hashes\":1}";
+
+/**
+ * @brief Loads a hash database; a missing file is an empty database.
+ * @throws std::runtime_error on malformed content.
+ */
+HashDatabase read_hash_db(const fs::path& file) {
+    HashDatabase db;
+    std::ifstream in(file, std::ios::binary);
+    if (!in) return db;
+    std::string line;
+    std::vector<std::pair<std::string, std::string>> fields;
+    std::size_t number = 0;
+    while (std::getline(in, line)) {
+        ++number;
+        if (line.empty()) continue;
+        if (!parse_flat_json(line, fields)) {
+            throw std::runtime_error("Malformed hash database line " + std::to_string(number) + " in '" + file.string() + "'");
+        }
+        std::string path;
+        HashRecord record;
+        bool has_hash = false;
+        for (const auto& [key, value] : fields) {
+            if (key == "path") path = value;
+            else if (key == "size") record.size = std::stoull(value);
+            else if (key == "mtime") record.mtime_ns = std::stoll(value);
+            else if (key == "xxh64") {
+                record.hash = std::stoull(value, nullptr, 16);
+                has_hash = true;
+            }
+        }
+        if (!path.empty() && has_hash) db[path] = record;
+    }
+    return db;
+}
+
+/**
+ * @brief Replaces the hash database atomically (write a temporary file, then rename).
+ */
+void write_hash_db(const HashDatabase& db, const fs::path& file) {
+    std::vector<const HashDatabase::value_type*> sorted;
+    sorted.reserve(db.size());
+    for (const auto& entry : db) sorted.push_back(&entry);
+    std::sort(sorted.begin(), sorted.end(), [](const auto* a, const auto* b) { return a->first < b->first; });
+
+    fs::path temp = file;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Cannot write hash database: '" + temp.string() + "'");
+        }
+        out << HASH_DB_HEADER << '\n';
+        std::string line;
+        char hex[17];
+        for (const auto* entry : sorted) {
+            line = "{\"path\":";
+            append_json_string(line, entry->first);
+            std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(entry->second.hash));
+            line += ",\"size\":" + std::to_string(entry->second.size) + ",\"mtime\":" +
+                    std::to_string(entry->second.mtime_ns) + ",\"xxh64\":\"" + hex + "\"}\n";
+            out << line;
+        }
+        if (!out.flush()) {
+            throw std::runtime_error("Cannot write hash database: '" + temp.string() + "'");
+        }
+    }
+#ifndef _WIN32
+    if (int err = fsync_file(temp); err != 0) {
+        throw std::runtime_error("Cannot write hash database: '" + temp.string() + "': " + std::strerror(err));
+    }
+#endif
+    fs::rename(temp, file);
+#ifndef _WIN32
+    fsync_directory(file.parent_path().empty() ? fs::path(".") : file.parent_path());
+#endif
+}
+
+/**
+ * @brief Settings for scrub_library().
+ */
+struct ScrubOptions {
+    bool verify = false;                  // re-hash unchanged files (a scrub) rather than only record
+    double bytes_per_second = 0;          // read bandwidth cap; 0: unlimited
+    unsigned jobs = 1;
+    std::chrono::nanoseconds time_budget{0}; // 0: unlimited
+};
+
+/**
+ * @brief Outcome of scrub_library().
+ */
+struct ScrubReport {
+    std::size_t verified = 0;
+    std::size_t corrupt = 0;
+    std::size_t recorded = 0;
+    std::size_t unreadable = 0;
+    std::size_t missing = 0;
+    std::size_t resumed_past = 0;
+    std::size_t left = 0;       // not reached before the budget ran out or a stop was requested
+    std::uint64_t bytes = 0;
+    double seconds = 0;
+};
 
 /**
- * @brief Populates the global extension-to-folder map for efficient lookups.
- * This creates a reverse map from the FOLDER_MAP constant.
+ * @brief Records hashes for new or changed files below the category folders and, with
+ * `options.verify`, re-hashes unchanged ones to find silent corruption. Mismatching records
+ * are kept so the file keeps being reported until it is dealt with.
+ * @throws std::runtime_error if the database cannot be read or written.
  */
-void build_extension_map() {
-    for (const auto& [folder, extensions] : FOLDER_MAP) {
-        for (const auto& ext : extensions) {
-            g_extension_to_folder_map[ext] = folder;
+ScrubReport scrub_library(const fs::path& base_path, const fs::path& db_file, const ScrubOptions& options) {
+    auto started = std::chrono::steady_clock::now();
+    HashDatabase db = read_hash_db(db_file);
+    fs::path position_file = db_file;
+    position_file += ".position";
+
+    struct Item {
+        std::uint64_t physical;
+        std::uint64_t inode;
+        std::string key;
+        fs::path path;
+        FileStamp stamp;
+        bool verify; // unchanged since recorded: compare instead of record
+    };
+    // Files are read in (physical offset, inode, key) order; the resume position is such a key.
+    auto order = [](const Item& a, const Item& b) {
+        if (a.physical != b.physical) return a.physical < b.physical;
+        if (a.inode != b.inode) return a.inode < b.inode;
+        return a.key < b.key;
+    };
+
+    ScrubReport report;
+    std::vector<Item> items;
+    std::unordered_map<std::string, bool> seen;
+    std::unordered_map<std::string, bool> unlisted;  // categories whose folder could not be walked
+    for (const auto& [category, _] : FOLDER_MAP) {
+        fs::path dir = base_path / category;
+        std::error_code ec;
+        for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            if (!it->is_regular_file(ec)) continue;
+            Item item;
+            if (!read_file_stamp(it->path(), item.stamp, ec)) {
+                ec.clear();
+                continue;
+            }
+            item.key = category + "/" + it->path().lexically_relative(dir).generic_string();
+            auto known = db.find(item.key);
+            item.verify = known != db.end() && known->second.size == item.stamp.size &&
+                          known->second.mtime_ns == item.stamp.mtime_ns;
+            if (known != db.end()) seen[item.key] = true;
+            if (item.verify && !options.verify) continue;
+            item.path = it->path();
+            item.inode = item.stamp.inode;
+            item.physical = options.verify ? physical_offset(item.path) : UINT64_MAX;
+            items.push_back(std::move(item));
+        }
+        // A missing folder means its files are gone; any other failure leaves them unknown,
+        // so their records are kept rather than dropped as gone.
+        if (ec && ec != std::errc::no_such_file_or_directory) {
+            unlisted[category] = true;
+            std::lock_guard<std::mutex> lock(g_console_mutex);
+            std::cerr << "Error listing '" << dir.string() << "': " << ec.message()
+                      << "; keeping the records of '" << category << "'." << std::endl;
+        }
+    }
+    for (auto it = db.begin(); it != db.end();) {
+        if (!seen.count(it->first) && !unlisted.count(it->first.substr(0, it->first.find('/')))) {
+            ++report.missing;
+            if (!g_quiet) std::cout << "Recorded file is gone: '" << it->first << "'" << std::endl;
+            it = db.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    std::sort(items.begin(), items.end(), order);
+
+    // Resume after the last position a previous scrub completed everything up to.
+    std::size_t first = 0;
+    if (options.verify) {
+        std::ifstream position(position_file);
+        Item last;
+        if (position >> last.physical >> last.inode && position.get() == ' ' && std::getline(position, last.key)) {
+            while (first < items.size() && !order(last, items[first])) ++first;
+            report.resumed_past = first;
+            std::cout << "Resuming scrub after " << first << " files." << std::endl;
+        }
+    }
+
+    RateLimiter limiter(options.bytes_per_second);
+    std::atomic<bool> stop{false};
+    auto deadline = options.time_budget.count() > 0 ? started + options.time_budget
+                                                    : std::chrono::steady_clock::time_point::max();
+    std::mutex mutex;
+    std::vector<std::uint8_t> done(items.size(), 0);
+    std::size_t contiguous = first; // items[first, contiguous) are all done
+    auto last_save = std::chrono::steady_clock::now();
+    auto save_position = [&]() {
+        if (!options.verify || contiguous == first) return;
+        const Item& last = items[contiguous - 1];
+        fs::path temp = position_file;
+        temp += ".tmp";
+        std::ofstream(temp, std::ios::trunc) << last.physical << ' ' << last.inode << ' ' << last.key << '\n';
+        std::error_code ec;
+        fs::rename(temp, position_file, ec);
+    };
+    std::atomic<std::size_t> verified{0}, corrupt{0}, recorded{0}, unreadable{0};
+    std::atomic<std::uint64_t> bytes{0};
+
+    parallel_for(items.size() - first, options.jobs, [&](std::size_t n) {
+        std::size_t i = first + n;
+        if (g_stop_requested || std::chrono::steady_clock::now() >= deadline) stop = true;
+        if (stop) return;
+        Item& item = items[i];
+        std::uint64_t hash = 0;
+        std::error_code ec;
+        if (!hash_file(item.path, item.stamp.size, limiter, hash, ec, stop, deadline)) {
+            if (!ec) return; // stopped midway; the file is scrubbed next time
+            ++unreadable;
+            std::lock_guard<std::mutex> lock(g_console_mutex);
+            std::cerr << "Error reading '" << item.key << "': " << ec.message() << std::endl;
+        } else {
+            bytes += item.stamp.size;
+            std::lock_guard<std::mutex> lock(mutex);
+            HashRecord& record = db[item.key];
+            if (item.verify) {
+                ++verified;
+                if (record.hash != hash) {
+                    ++corrupt;
+                    std::lock_guard<std::mutex> console(g_console_mutex);
+                    std::cerr << "Error: content of '" << item.key << "' no longer matches its recorded hash." << std::endl;
+                }
+            } else {
+                record = HashRecord{item.stamp.size, item.stamp.mtime_ns, hash};
+                ++recorded;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        done[i] = 1;
+        while (contiguous < items.size() && done[contiguous]) ++contiguous;
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_save >= std::chrono::seconds(5)) {
+            save_position();
+            last_save = now;
+        }
+    });
+
+    write_hash_db(db, db_file);
+    report.left = items.size() - contiguous;
+    if (options.verify) {
+        if (report.left == 0) {
+            std::error_code ec;
+            fs::remove(position_file, ec);
+        } else {
+            save_position();
         }
     }
+    report.verified = verified;
+    report.corrupt = corrupt;
+    report.recorded = recorded;
+    report.unreadable = unreadable;
+    report.bytes = bytes;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return report;
 }
 
 /**
- * @brief Ensures that all required destination folders exist in the base path.
- * If they don't exist, they are created. This function handles potential errors
- * during directory creation.
- * @param base_path The root directory where folders should be created.
+ * @brief Records hashes for `files`, which lie below the category folders of `base_path`,
+ * such as the destinations of the files a run just moved; files whose record still matches
+ * their size and modification time are left alone. Unlike scrub_library(), the rest of the
+ * library is not walked, so records of files that are gone stay until the next scrub.
+ * @throws std::runtime_error if the database cannot be read or written.
  */
-void ensure_folders(const fs::path& base_path) {
-    for (const auto& [folder_name, _] : FOLDER_MAP) {
-        fs::path folder_path = base_path / folder_name;
-        try {
-            if (!fs::exists(folder_path)) {
-                fs::create_directory(folder_path);
-            }
-        } catch (const fs::filesystem_error& e) {
-            // Throw a runtime_error to be caught by the calling function
-            throw std::runtime_error("Error creating directory " + folder_path.string() + ": " + e.what());
+ScrubReport record_hashes(const fs::path& base_path, const fs::path& db_file, const std::vector<fs::path>& files,
+                          const ScrubOptions& options) {
+    auto started = std::chrono::steady_clock::now();
+    HashDatabase db = read_hash_db(db_file);
+    ScrubReport report;
+    RateLimiter limiter(options.bytes_per_second);
+    std::atomic<bool> stop{false};
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    std::mutex mutex;
+    std::atomic<std::size_t> recorded{0}, unreadable{0};
+    std::atomic<std::uint64_t> bytes{0};
+
+    parallel_for(files.size(), options.jobs, [&](std::size_t i) {
+        if (g_stop_requested) stop = true;
+        if (stop) return;
+        std::string key = files[i].lexically_relative(base_path).generic_string();
+        if (key.empty() || key.compare(0, 2, "..") == 0) return;
+        FileStamp stamp;
+        std::error_code ec;
+        if (!read_file_stamp(files[i], stamp, ec)) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto known = db.find(key);
+            if (known != db.end() && known->second.size == stamp.size && known->second.mtime_ns == stamp.mtime_ns) return;
+        }
+        std::uint64_t hash = 0;
+        if (!hash_file(files[i], stamp.size, limiter, hash, ec, stop, deadline)) {
+            if (!ec) return;
+            ++unreadable;
+            std::lock_guard<std::mutex> lock(g_console_mutex);
+            std::cerr << "Error reading '" << key << "': " << ec.message() << std::endl;
+            return;
         }
+        bytes += stamp.size;
+        ++recorded;
+        std::lock_guard<std::mutex> lock(mutex);
+        db[key] = HashRecord{stamp.size, stamp.mtime_ns, hash};
+    });
+
+    write_hash_db(db, db_file);
+    report.recorded = recorded;
+    report.unreadable = unreadable;
+    report.bytes = bytes;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return report;
+}
+
+/**
+ * @brief Prints a scrub_library() report.
+ */
+void print_scrub_report(std::ostream& out, const ScrubReport& report) {
+    out << "Hashed " << report.verified + report.recorded << " files (" << format_bytes(report.bytes) << ") in "
+        << report.seconds << " s: " << report.verified << " verified, " << report.corrupt << " corrupt, "
+        << report.recorded << " recorded, " << report.unreadable << " unreadable, " << report.missing
+        << " gone." << std::endl;
+    if (report.left > 0) {
+        out << "Stopped with " << report.left << " files left; the next scrub resumes here." << std::endl;
     }
 }
 
+// --- MIME database: compile freedesktop shared-mime-info into the classifier tables ---
+// --import-mime reads a shared-mime-info XML (e.g. /usr/share/mime/packages/freedesktop.org.xml),
+// maps each MIME type to a category and writes a compact "ORGMIME1" file that --mime-db loads
+// into g_extension_table and g_magic_table. Layout:
+//   varint category count, then per category: varint length, name
+//   varint extension count, then per extension: varint length, bytes, category index byte
+//   varint rule count, then per rule: varint priority, category index byte, varint part count,
+//     then per part: varint offset, varint length, bytes
+// Only what the flat tables can answer without allocating is compiled: simple "*.ext" globs and
+// magic rules made of fixed-offset byte comparisons (ranges and masks are left out).
+
+const char MIME_DB_MAGIC[] = "ORGMIME1";
+
 /**
- * @brief Determines the target folder for a given file extension using the pre-computed map.
- * @param file_ext The file extension (e.g., ".txt", ".pdf").
- * @return The name of the folder where the file should be moved. Returns "Others" if not found.
+ * @brief Built-in MIME type to category mapping, first match wins. A pattern ending in '/'
+ * matches a top-level media type; anything else matches as a substring of the type.
  */
-std::string get_target_folder(std::string_view file_ext) {
-    std::string lower_ext;
-    lower_ext.reserve(file_ext.length());
-    std::transform(file_ext.begin(), file_ext.end(), std::back_inserter(lower_ext),
-                   [](unsigned char c){ return std::tolower(c); });
+const std::vector<std::pair<std::string_view, std::string_view>> MIME_CATEGORY_RULES = {
+    {"image/", "Images"}, {"audio/", "Music"}, {"video/", "Video"},
+    {"executable", "Programs"}, {"x-msdownload", "Programs"}, {"x-msi", "Programs"},
+    {"package-archive", "Programs"}, {"java-archive", "Programs"}, {"x-deb", "Programs"},
+    {"debian.binary-package", "Programs"}, {"x-rpm", "Programs"}, {"shellscript", "Programs"},
+    {"x-bat", "Programs"}, {"x-ms-dos", "Programs"}, {"x-msdos", "Programs"},
+    {"x-sharedlib", "Programs"}, {"x-appimage", "Programs"},
+    {"text/", "Documents"}, {"pdf", "Documents"}, {"document", "Documents"}, {"msword", "Documents"},
+    {"ms-excel", "Documents"}, {"ms-powerpoint", "Documents"}, {"spreadsheet", "Documents"},
+    {"presentation", "Documents"}, {"rtf", "Documents"}, {"epub", "Documents"}, {"postscript", "Documents"},
+    {"x-tex", "Documents"}, {"json", "Documents"}, {"xml", "Documents"}, {"yaml", "Documents"},
+    {"zip", "Compressed"}, {"compress", "Compressed"}, {"x-tar", "Compressed"}, {"x-xz", "Compressed"},
+    {"x-7z", "Compressed"}, {"rar", "Compressed"}, {"lzma", "Compressed"}, {"lzip", "Compressed"},
+    {"lz4", "Compressed"}, {"zstd", "Compressed"}, {"lzop", "Compressed"}, {"cpio", "Compressed"},
+    {"x-archive", "Compressed"}, {"iso9660", "Compressed"}, {"cd-image", "Compressed"},
+    {"diskimage", "Compressed"}, {"ms-cab", "Compressed"}, {"x-arj", "Compressed"}, {"x-lha", "Compressed"},
+    {"x-lzh", "Compressed"}, {"x-ace", "Compressed"}, {"x-stuffit", "Compressed"},
+};
 
-    auto it = g_extension_to_folder_map.find(lower_ext);
-    if (it != g_extension_to_folder_map.end()) {
-        return it->second;
+/**
+ * @brief MIME type to category mapping: user overrides from --mime-map, then the built-in rules.
+ */
+class MimeCategoryMap {
+public:
+    /**
+     * @brief Loads override lines of the form "<type> <Category>". <type> is an exact MIME type,
+     * or a media type, a slash and an asterisk; Category is a FOLDER_MAP folder or '-' to ignore it.
+     * @throws std::runtime_error if the file cannot be read or names an unknown category.
+     */
+    void load_overrides(const fs::path& file) {
+        std::ifstream in(file);
+        if (!in) {
+            throw std::runtime_error("Cannot open MIME map: '" + file.string() + "'");
+        }
+        std::string type;
+        std::string category;
+        while (in >> type) {
+            if (type[0] == '#') {
+                std::getline(in, type);
+                continue;
+            }
+            if (!(in >> category)) {
+                throw std::runtime_error("MIME map entry '" + type + "' has no category");
+            }
+            CategoryId id = category == "-" ? kNoCategory : category_id(category);
+            if (category != "-" && id == kNoCategory) {
+                throw std::runtime_error("MIME map names unknown category '" + category + "'");
+            }
+            overrides_.emplace_back(type, id);
+        }
     }
-    return "Others";
-}
+
+    CategoryId lookup(std::string_view type) const {
+        for (const auto& [pattern, id] : overrides_) {
+            bool prefix = pattern.size() > 1 && pattern.compare(pattern.size() - 2, 2, "/*") == 0;
+            if (prefix ? type.substr(0, pattern.size() - 1) == std::string_view(pattern).substr(0, pattern.size() - 1)
+                       : type == pattern) {
+                return id;
+            }
+        }
+        for (const auto& [pattern, category] : MIME_CATEGORY_RULES) {
+            bool matched = pattern.back() == '/' ? type.substr(0, pattern.size()) == pattern
+                                                 : type.find(pattern) != std::string_view::npos;
+            if (matched) return category_id(category);
+        }
+        return kNoCategory;
+    }
+
+private:
+    std::vector<std::pair<std::string, CategoryId>> overrides_;
+};
 
 /**
- * @brief Organizes all files in the given base path.
- * It iterates through each item, and if it's a file, moves it to the appropriate subfolder.
- * @param base_path The directory whose files need to be organized.
- * @param self_path The full path to the executable to avoid moving itself.
+ * @brief Just enough of an XML tokenizer for shared-mime-info: yields start, end and
+ * self-closing tags with their attributes, skipping text, comments and declarations.
  */
-void organize_files(const fs::path& base_path, const fs::path& self_path) {
-    ensure_folders(base_path);
-    for (const auto& entry : fs::directory_iterator(base_path)) {
-        // We only want to move files, not directories or the program itself
-        // Use weakly_canonical to resolve paths for comparison
-        if (entry.is_regular_file() && fs::weakly_canonical(entry.path()) != self_path) {
-            fs::path item_path = entry.path();
-            std::string ext = item_path.extension().string();
+class XmlTags {
+public:
+    struct Tag {
+        std::string name;
+        std::vector<std::pair<std::string, std::string>> attributes;
+        bool closing = false;
+        bool self_closing = false;
 
-            // Skip files with no extension
-            if (ext.empty()) {
+        const std::string* attribute(std::string_view key) const {
+            for (const auto& [k, v] : attributes) {
+                if (k == key) return &v;
+            }
+            return nullptr;
+        }
+    };
+
+    explicit XmlTags(std::string text) : text_(std::move(text)) {}
+
+    /**
+     * @brief Reads the next tag.
+     * @return false at the end of the document.
+     * @throws std::runtime_error on malformed markup.
+     */
+    bool next(Tag& tag) {
+        for (;;) {
+            pos_ = text_.find('<', pos_);
+            if (pos_ == std::string::npos) return false;
+            if (text_.compare(pos_, 4, "<!--") == 0) {
+                skip_past("-->");
+            } else if (text_.compare(pos_, 2, "<?") == 0 || text_.compare(pos_, 2, "<!") == 0) {
+                skip_past(">");
+            } else {
+                break;
+            }
+        }
+        ++pos_;
+        tag = Tag();
+        if (peek() == '/') {
+            tag.closing = true;
+            ++pos_;
+        }
+        tag.name = read_name();
+        for (;;) {
+            skip_space();
+            char c = peek();
+            if (c == '>') {
+                ++pos_;
+                return true;
+            }
+            if (c == '/') {
+                pos_ += 2;
+                tag.self_closing = true;
+                return true;
+            }
+            std::string key = read_name();
+            skip_space();
+            if (peek() != '=') malformed();
+            ++pos_;
+            skip_space();
+            char quote = peek();
+            if (quote != '"' && quote != '\'') malformed();
+            std::size_t end = text_.find(quote, ++pos_);
+            if (end == std::string::npos) malformed();
+            tag.attributes.emplace_back(std::move(key), decode_entities(std::string_view(text_).substr(pos_, end - pos_)));
+            pos_ = end + 1;
+        }
+    }
+
+private:
+    char peek() const {
+        if (pos_ >= text_.size()) malformed();
+        return text_[pos_];
+    }
+
+    void skip_space() {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) ++pos_;
+    }
+
+    void skip_past(std::string_view marker) {
+        pos_ = text_.find(marker, pos_);
+        if (pos_ == std::string::npos) malformed();
+        pos_ += marker.size();
+    }
+
+    std::string read_name() {
+        std::size_t start = pos_;
+        while (pos_ < text_.size() && !std::isspace(static_cast<unsigned char>(text_[pos_])) &&
+               text_[pos_] != '>' && text_[pos_] != '/' && text_[pos_] != '=') {
+            ++pos_;
+        }
+        if (pos_ == start) malformed();
+        return text_.substr(start, pos_ - start);
+    }
+
+    static std::string decode_entities(std::string_view raw) {
+        std::string out;
+        for (std::size_t i = 0; i < raw.size(); ++i) {
+            std::size_t semi;
+            if (raw[i] != '&' || (semi = raw.find(';', i)) == std::string_view::npos) {
+                out += raw[i];
                 continue;
             }
+            std::string_view entity = raw.substr(i + 1, semi - i - 1);
+            if (entity == "lt") out += '<';
+            else if (entity == "gt") out += '>';
+            else if (entity == "amp") out += '&';
+            else if (entity == "quot") out += '"';
+            else if (entity == "apos") out += '\'';
+            else if (entity.size() > 1 && entity[0] == '#') {
+                bool hex = entity[1] == 'x';
+                unsigned long code = std::stoul(std::string(entity.substr(hex ? 2 : 1)), nullptr, hex ? 16 : 10);
+                out += static_cast<char>(code); // only ASCII references occur in attribute values we use
+            } else {
+                out.append(raw.substr(i, semi - i + 1));
+            }
+            i = semi;
+        }
+        return out;
+    }
 
-            std::string folder = get_target_folder(ext);
-            fs::path target_dir = base_path / folder;
-            fs::path target_path = target_dir / item_path.filename();
+    [[noreturn]] void malformed() const {
+        throw std::runtime_error("Malformed XML near byte " + std::to_string(pos_));
+    }
 
-            try {
-                // Avoid overwriting files with the same name.
-                if (!fs::exists(target_path)) {
-                    fs::rename(item_path, target_path);
-                } else {
-                    std::cout << "Skipping '" << item_path.filename().string() << "': file already exists in '" << folder << "' folder." << std::endl;
+    std::string text_;
+    std::size_t pos_ = 0;
+};
+
+/**
+ * @brief Decodes a shared-mime-info match value into the bytes it compares.
+ * @return false for match types the fixed-offset table cannot express.
+ */
+bool decode_magic_value(const std::string& type, const std::string& value, std::string& bytes) {
+    bytes.clear();
+    if (type == "string") {
+        for (std::size_t i = 0; i < value.size(); ++i) {
+            if (value[i] != '\\' || i + 1 == value.size()) {
+                bytes += value[i];
+                continue;
+            }
+            char c = value[++i];
+            if (c == 'x') {
+                std::size_t digits = 0;
+                unsigned code = 0;
+                while (digits < 2 && i + 1 < value.size() && std::isxdigit(static_cast<unsigned char>(value[i + 1]))) {
+                    char h = static_cast<char>(std::tolower(static_cast<unsigned char>(value[++i])));
+                    code = code * 16 + static_cast<unsigned>(h <= '9' ? h - '0' : h - 'a' + 10);
+                    ++digits;
                 }
-            } catch (const fs::filesystem_error& e) {
-                // Report error for the specific file and continue with others
-                std::cerr << "Error moving file '" << item_path.filename().string() << "': " << e.what() << std::endl;
+                bytes += static_cast<char>(code);
+            } else if (c >= '0' && c <= '7') {
+                unsigned code = static_cast<unsigned>(c - '0');
+                for (int n = 1; n < 3 && i + 1 < value.size() && value[i + 1] >= '0' && value[i + 1] <= '7'; ++n) {
+                    code = code * 8 + static_cast<unsigned>(value[++i] - '0');
+                }
+                bytes += static_cast<char>(code);
+            } else if (c == 'n') {
+                bytes += '\n';
+            } else if (c == 'r') {
+                bytes += '\r';
+            } else if (c == 't') {
+                bytes += '\t';
+            } else {
+                bytes += c;
+            }
+        }
+        return !bytes.empty();
+    }
+
+    std::size_t width;
+    bool big_endian;
+    if (type == "byte") {
+        width = 1;
+        big_endian = true;
+    } else if (type == "big16" || type == "big32") {
+        width = type == "big16" ? 2 : 4;
+        big_endian = true;
+    } else if (type == "little16" || type == "little32") {
+        width = type == "little16" ? 2 : 4;
+        big_endian = false;
+    } else {
+        return false; // host16/host32 depend on the machine that runs the match
+    }
+    std::uint64_t number;
+    try {
+        number = std::stoull(value, nullptr, 0);
+    } catch (const std::exception&) {
+        return false;
+    }
+    for (std::size_t k = 0; k < width; ++k) {
+        std::size_t shift = 8 * (big_endian ? width - 1 - k : k);
+        bytes += static_cast<char>((number >> shift) & 0xFF);
+    }
+    return true;
+}
+
+/**
+ * @brief Parses a shared-mime-info XML file, maps its types through `categories`, and writes
+ * the compiled MIME database to `db_file`.
+ * Among imported globs the one with the higher weight wins a shared extension; the
+ * hand-maintained FOLDER_MAP still wins over all of them when the database is loaded.
+ * @throws std::runtime_error if a file cannot be read or written, or the XML is malformed.
+ */
+void import_mime_database(const fs::path& xml_file, const MimeCategoryMap& categories, const fs::path& db_file) {
+    std::ifstream xml_in(xml_file, std::ios::binary);
+    if (!xml_in) {
+        throw std::runtime_error("Cannot open MIME XML: '" + xml_file.string() + "'");
+    }
+    XmlTags tags(read_small_file(xml_file));
+
+    struct Glob {
+        std::uint32_t weight;
+        CategoryId category;
+    };
+    std::unordered_map<std::string, Glob> globs;
+    std::vector<MagicRule> rules;
+    std::size_t types = 0;
+    std::size_t mapped = 0;
+    std::size_t skipped_globs = 0;
+    std::size_t skipped_matches = 0;
+
+    CategoryId category = kNoCategory;
+    std::uint32_t priority = 50;
+    // Open <match> elements; a rule is emitted for every leaf, ANDing its ancestors.
+    struct Open {
+        bool usable;
+        bool has_children;
+        MagicRule::Part part;
+    };
+    std::vector<Open> matches;
+
+    auto emit_leaf = [&]() {
+        bool usable = std::all_of(matches.begin(), matches.end(), [](const Open& m) { return m.usable; });
+        if (!usable) {
+            ++skipped_matches;
+            return;
+        }
+        MagicRule rule{priority, category, {}};
+        for (const Open& m : matches) rule.parts.push_back(m.part);
+        rules.push_back(std::move(rule));
+    };
+
+    XmlTags::Tag tag;
+    while (tags.next(tag)) {
+        if (tag.name == "mime-type") {
+            if (tag.closing) {
+                category = kNoCategory;
+                continue;
+            }
+            const std::string* type = tag.attribute("type");
+            category = type ? categories.lookup(*type) : kNoCategory;
+            ++types;
+            if (category != kNoCategory) ++mapped;
+        } else if (category == kNoCategory) {
+            continue;
+        } else if (tag.name == "glob" && !tag.closing) {
+            const std::string* pattern = tag.attribute("pattern");
+            const std::string* weight = tag.attribute("weight");
+            if (!pattern || pattern->size() < 3 || pattern->compare(0, 2, "*.") != 0 ||
+                pattern->find_first_of("*?[", 1) != std::string::npos || pattern->size() - 1 > ExtensionTable::kMaxKey) {
+                ++skipped_globs;
+                continue;
+            }
+            std::string ext = pattern->substr(1);
+            std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+            Glob glob{weight ? static_cast<std::uint32_t>(std::stoul(*weight)) : 50u, category};
+            auto [it, inserted] = globs.emplace(ext, glob);
+            if (!inserted && glob.weight > it->second.weight) it->second = glob;
+        } else if (tag.name == "magic" && !tag.closing) {
+            const std::string* p = tag.attribute("priority");
+            priority = p ? static_cast<std::uint32_t>(std::stoul(*p)) : 50u;
+            matches.clear();
+        } else if (tag.name == "match") {
+            if (tag.closing) {
+                if (matches.empty()) continue;
+                if (!matches.back().has_children) emit_leaf();
+                matches.pop_back();
+                continue;
             }
+            if (!matches.empty()) matches.back().has_children = true;
+            Open open{false, false, {}};
+            const std::string* type = tag.attribute("type");
+            const std::string* value = tag.attribute("value");
+            const std::string* offset = tag.attribute("offset");
+            if (type && value && offset && !tag.attribute("mask") && offset->find(':') == std::string::npos &&
+                decode_magic_value(*type, *value, open.part.bytes)) {
+                unsigned long at = std::stoul(*offset);
+                open.part.offset = static_cast<std::uint32_t>(std::min<unsigned long>(at, kMaxMagicHeader));
+                open.usable = at + open.part.bytes.size() <= kMaxMagicHeader;
+            }
+            matches.push_back(std::move(open));
+            if (tag.self_closing) {
+                emit_leaf();
+                matches.pop_back();
+            }
+        }
+    }
+
+    // Sorting by key keeps the database byte-identical across runs of the importer.
+    std::vector<std::pair<std::string, Glob>> sorted_globs(globs.begin(), globs.end());
+    std::sort(sorted_globs.begin(), sorted_globs.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::string out(MIME_DB_MAGIC, sizeof(MIME_DB_MAGIC) - 1);
+    put_varint(out, g_categories.size());
+    for (const std::string& name : g_categories) {
+        put_varint(out, name.size());
+        out += name;
+    }
+    put_varint(out, sorted_globs.size());
+    for (const auto& [ext, glob] : sorted_globs) {
+        put_varint(out, ext.size());
+        out += ext;
+        out += static_cast<char>(glob.category);
+    }
+    put_varint(out, rules.size());
+    for (const MagicRule& rule : rules) {
+        put_varint(out, rule.priority);
+        out += static_cast<char>(rule.category);
+        put_varint(out, rule.parts.size());
+        for (const MagicRule::Part& part : rule.parts) {
+            put_varint(out, part.offset);
+            put_varint(out, part.bytes.size());
+            out += part.bytes;
         }
     }
+    std::ofstream db(db_file, std::ios::binary | std::ios::trunc);
+    if (!db.write(out.data(), static_cast<std::streamsize>(out.size())) || !db.flush()) {
+        throw std::runtime_error("Cannot write MIME database: '" + db_file.string() + "'");
+    }
+    std::cout << "Imported " << mapped << " of " << types << " MIME types: " << sorted_globs.size() << " extensions, "
+              << rules.size() << " magic rules (" << skipped_globs << " globs and " << skipped_matches
+              << " magic matches not expressible) into '" << db_file.string() << "' (" << out.size() << " bytes)."
+              << std::endl;
+}
+
+/**
+ * @brief Loads a compiled MIME database into the classifier tables. Extensions already in
+ * FOLDER_MAP keep their hand-maintained category.
+ * @throws std::runtime_error if the file cannot be read or is not a valid database.
+ */
+void load_mime_database(const fs::path& db_file) {
+    std::ifstream in(db_file, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open MIME database: '" + db_file.string() + "'");
+    }
+    auto corrupt = [&]() { return std::runtime_error("Corrupt MIME database: '" + db_file.string() + "'"); };
+    char magic[sizeof(MIME_DB_MAGIC) - 1];
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, MIME_DB_MAGIC, sizeof(magic)) != 0) throw corrupt();
+
+    auto read_bytes = [&](std::string& s, std::uint64_t limit) {
+        std::uint64_t len;
+        if (!get_varint(in, len) || len > limit) throw corrupt();
+        s.resize(static_cast<std::size_t>(len));
+        if (!in.read(s.data(), static_cast<std::streamsize>(len))) throw corrupt();
+    };
+    auto read_category = [&](const std::vector<CategoryId>& ids) {
+        int c = in.get();
+        if (c == EOF || static_cast<std::size_t>(c) >= ids.size()) throw corrupt();
+        return ids[static_cast<std::size_t>(c)];
+    };
+
+    std::uint64_t count;
+    std::string text;
+    // Map the database's category indexes onto this build's; unknown folders are dropped.
+    std::vector<CategoryId> ids;
+    if (!get_varint(in, count) || count >= kNoCategory) throw corrupt();
+    for (std::uint64_t i = 0; i < count; ++i) {
+        read_bytes(text, 256);
+        ids.push_back(category_id(text));
+    }
+    if (!get_varint(in, count)) throw corrupt();
+    for (std::uint64_t i = 0; i < count; ++i) {
+        read_bytes(text, ExtensionTable::kMaxKey);
+        CategoryId id = read_category(ids);
+        if (id != kNoCategory) g_extension_table.insert(text, id, false);
+    }
+    if (!get_varint(in, count)) throw corrupt();
+    std::vector<MagicRule> rules;
+    for (std::uint64_t i = 0; i < count; ++i) {
+        MagicRule rule;
+        std::uint64_t value;
+        if (!get_varint(in, value)) throw corrupt();
+        rule.priority = static_cast<std::uint32_t>(value);
+        rule.category = read_category(ids);
+        if (!get_varint(in, value) || value == 0) throw corrupt();
+        rule.parts.resize(static_cast<std::size_t>(value));
+        for (MagicRule::Part& part : rule.parts) {
+            std::uint64_t offset;
+            if (!get_varint(in, offset) || offset > kMaxMagicHeader) throw corrupt();
+            part.offset = static_cast<std::uint32_t>(offset);
+            read_bytes(part.bytes, kMaxMagicHeader - offset);
+        }
+        if (rule.category != kNoCategory) rules.push_back(std::move(rule));
+    }
+    g_magic_table.build(std::move(rules));
 }
 
 /**
@@ -157,11 +8851,340 @@ std::string_view trim_path(std::string_view str) {
  */
 
 void show_help() {
-    std::cout << "Usage: organize <folder_path> OR organize -c" << std::endl;
+    std::cout << "Usage: organize <folder_path> [options] OR organize -c [options]" << std::endl;
+    std::cout << "       organize top [<pid>] [--once] [--interval <s>]" << std::endl;
     std::cout << "Organizes files in the specified folder into subdirectories based on file type." << std::endl;
+    std::cout << "'organize top' shows what a running organize is doing (a folder named top is given as ./top)." << std::endl;
     std::cout << "\nOptions/Flags:\n";
-    std::cout << "  --help, -h, -H   :   Show this help message." << std::endl;
-    std::cout << "  --current, -c, -C:   Organize files in the current working directory." << std::endl;
+    std::cout << "  --help, -h, -H       :   Show this help message." << std::endl;
+    std::cout << "  --current, -c, -C    :   Organize files in the current working directory." << std::endl;
+    std::cout << "  --jobs, -j <n>       :   Number of worker threads used to scan and move files." << std::endl;
+    std::cout << "  --stat-prefetch <n>  :   Threads that stat files ahead of the scan (default 4, 0 to stat inline)." << std::endl;
+    std::cout << "  --dest <dir>         :   Create the category folders in <dir> instead; moves across devices are copied." << std::endl;
+    std::cout << "                           Given again, every file is also replicated below each further <dir>." << std::endl;
+    std::cout << "  --mirror             :   With --dest: copy instead of move, only what is new or changed since the last run." << std::endl;
+    std::cout << "  --mirror-state <f>   :   Where --mirror keeps its state (default <dest>/.organize-mirror)." << std::endl;
+    std::cout << "  --recursive, -r      :   Also organize files in subfolders (category folders excluded)." << std::endl;
+    std::cout << "  --du                 :   Report per-directory and per-category sizes gathered during the scan." << std::endl;
+    std::cout << "  --group-series <n>   :   Move name series of at least <n> files (IMG_0001...) into subfolders," << std::endl;
+    std::cout << "                           counting the files already in the category folders." << std::endl;
+    std::cout << "  --time-budget <s>    :   Stop starting moves after <s> seconds and report what remains." << std::endl;
+    std::cout << "  --max-ops <n>        :   Move at most <n> files, the most important first." << std::endl;
+    std::cout << "  --priority <p>       :   Order for limited runs: 'oldest' (default), 'largest' or 'category:Images,...'." << std::endl;
+    std::cout << "  --from-list <file>   :   Organize only the NUL-delimited paths in <file> ('-' for stdin), no scan." << std::endl;
+    std::cout << "  --perf               :   Report time and hardware counters per phase and per file (Linux)." << std::endl;
+    std::cout << "  --snapshot <file>    :   After the run, write a compact sorted catalog of the category folders." << std::endl;
+    std::cout << "  --diff <old> <new>   :   Show what arrived, moved or disappeared between two snapshots." << std::endl;
+    std::cout << "  --mime-db <file>     :   Also classify by a compiled MIME database (globs and content magic)." << std::endl;
+    std::cout << "  --import-mime <xml>  :   Compile a shared-mime-info XML into the --mime-db file and exit." << std::endl;
+    std::cout << "  --mime-map <file>    :   With --import-mime: '<type> <Category>' lines overriding the mapping." << std::endl;
+    std::cout << "  --conflict-stats <f> :   Count name conflicts across runs in <f> and report the most frequent." << std::endl;
+    std::cout << "  --suffix-hot <n>     :   Move names with at least <n> recorded conflicts in as 'name (2).ext'." << std::endl;
+    std::cout << "  --hash-db <file>     :   Record content hashes of the files a run moves (watch and mirror runs:" << std::endl;
+    std::cout << "                           of new or changed files in the category folders)." << std::endl;
+    std::cout << "  --scrub              :   Re-hash recorded files against --hash-db (resumes where it stopped)." << std::endl;
+    std::cout << "  --scrub-rate <MB/s>  :   Cap the read bandwidth used for hashing." << std::endl;
+    std::cout << "  --plan-out <file>    :   Write the move plan as NDJSON instead of moving anything." << std::endl;
+    std::cout << "  --apply-plan <file>  :   Validate and apply a previously written plan to the folder." << std::endl;
+    std::cout << "  --s3 <s3://b/prefix> :   Upload files into bucket <b> under <prefix>/<Category>/ instead of moving them." << std::endl;
+    std::cout << "  --s3-endpoint <url>  :   S3-compatible endpoint, http://host[:port] (credentials from AWS_* variables)." << std::endl;
+    std::cout << "  --s3-region <r>      :   Signing region (default $AWS_REGION or us-east-1)." << std::endl;
+    std::cout << "  --s3-part-size <MiB> :   Upload files larger than this in parts of this size (default 8, minimum 5)." << std::endl;
+    std::cout << "  --s3-parallel <n>    :   Parts uploaded at once, and part buffers kept (default 8)." << std::endl;
+    std::cout << "  --min-free <n|p%>    :   Defer copies that would leave a destination below <n> bytes (K/M/G/T) or <p>%." << std::endl;
+    std::cout << "  --min-free-inodes <n>:   Defer copies that would leave a destination with <n> free inodes or fewer." << std::endl;
+    std::cout << "  --trace <file>       :   Record every filesystem operation with its result and latency." << std::endl;
+    std::cout << "  --replay <file>      :   Rebuild a trace's files in the (empty) folder and re-issue its operations." << std::endl;
+    std::cout << "  --replay-mode <m>    :   'parallel' (default) keeps the recorded threads, 'sync' uses one." << std::endl;
+    std::cout << "  --replay-timing <t>  :   'fast' (default) or 'original' to keep the recorded start offsets." << std::endl;
+    std::cout << "  --inject <spec>      :   Inject faults, e.g. 'rename:EXDEV=0.3,copy:ENOSPC=0.05,rename:latency=200'." << std::endl;
+    std::cout << "  --stress <runs>      :   Run randomized organize passes under faults in the (empty) folder." << std::endl;
+    std::cout << "  --seed <n>           :   Seed for --inject and --stress." << std::endl;
+    std::cout << "  --quiet, -q          :   Do not print per-file messages." << std::endl;
+    std::cout << "  --no-live-stats      :   Do not publish live stats for 'organize top'." << std::endl;
+    std::cout << "  --watch, -w          :   Keep running and organize files as they arrive (Linux)." << std::endl;
+    std::cout << "  --slo-ms <ms>        :   End-to-end latency target counted in watch stats (default 1000)." << std::endl;
+    std::cout << "  --stats-interval <s> :   Print watch stats every <s> seconds as well as on exit." << std::endl;
+    std::cout << "  --max-batch-ms <ms>  :   Longest watch mode waits to batch events (default 20, capped at SLO/4)." << std::endl;
+    std::cout << "  --simulate-batching  :   Run the batch controller against synthetic arrival patterns." << std::endl;
+    std::cout << "  --bench <name>       :   Run a benchmark in the (empty) folder: 'engine', 'tree', 'series', 'classify', 'prefetch' or 'copy'." << std::endl;
+    std::cout << "  --bench-files <n>    :   Number of files the benchmark creates (default 20000)." << std::endl;
+}
+
+/**
+ * @brief Command-line options collected by parse_args().
+ */
+struct Options {
+    std::string folder;
+    std::string dest;
+    std::vector<std::string> replicas;
+    bool mirror = false;
+    std::string mirror_state;
+    bool use_current = false;
+    bool show_help = false;
+    unsigned jobs = std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+    unsigned stat_prefetch = 4;
+    bool recursive = false;
+    bool du = false;
+    std::size_t group_series = 0;
+    double time_budget = 0.0;
+    std::size_t max_ops = 0;
+    PriorityOrder priority = PriorityOrder::Oldest;
+    std::vector<std::string> category_order;
+    bool perf = false;
+    std::string from_list;
+    std::string snapshot;
+    std::string diff_old;
+    std::string diff_new;
+    std::string mime_db;
+    std::string import_mime;
+    std::string mime_map;
+    std::string conflict_stats;
+    std::uint32_t suffix_hot = 0;
+    std::string hash_db;
+    bool scrub = false;
+    double scrub_rate = 0.0;
+    std::string plan_out;
+    std::string apply_plan;
+    std::string trace;
+    std::string replay;
+    bool replay_parallel = true;
+    bool replay_original_timing = false;
+    std::string inject;
+    Watermark watermark;
+    bool admission = false;
+    std::string s3;
+    std::string s3_endpoint;
+    std::string s3_region;
+    std::size_t s3_part_mib = 8;
+    unsigned s3_parallel = 8;
+    std::size_t stress_runs = 0;
+    std::uint64_t seed = std::random_device{}();
+    bool watch = false;
+    bool live_stats = true;
+    double slo_ms = 1000.0;
+    unsigned stats_interval = 0;
+    double max_batch_ms = 20.0;
+    bool simulate_batching = false;
+    std::string bench;
+    std::size_t bench_files = 20000;
+};
+
+/**
+ * @brief Parses the command line into an Options structure.
+ * @throws std::runtime_error on unknown flags or missing values.
+ */
+Options parse_args(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        auto value = [&]() -> std::string_view {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("Option '" + std::string(arg) + "' requires a value.");
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--help" || arg == "-h" || arg == "-H") {
+            opts.show_help = true;
+        } else if (arg == "-c" || arg == "--current" || arg == "-C") {
+            opts.use_current = true;
+        } else if (arg == "--jobs" || arg == "-j") {
+            int jobs = std::stoi(std::string(value()));
+            opts.jobs = jobs < 1 ? 1u : static_cast<unsigned>(jobs);
+        } else if (arg == "--stat-prefetch") {
+            opts.stat_prefetch = static_cast<unsigned>(std::min(std::stoul(std::string(value())), 64ul));
+        } else if (arg == "--dest") {
+            (opts.dest.empty() ? opts.dest : opts.replicas.emplace_back()) = trim_path(value());
+        } else if (arg == "--mirror") {
+            opts.mirror = true;
+        } else if (arg == "--mirror-state") {
+            opts.mirror_state = trim_path(value());
+        } else if (arg == "--recursive" || arg == "-r") {
+            opts.recursive = true;
+        } else if (arg == "--du") {
+            opts.du = true;
+        } else if (arg == "--perf") {
+            opts.perf = true;
+        } else if (arg == "--group-series") {
+            opts.group_series = std::max<std::size_t>(2, std::stoull(std::string(value())));
+        } else if (arg == "--time-budget") {
+            opts.time_budget = std::stod(std::string(value()));
+            if (!(opts.time_budget > 0)) {
+                throw std::runtime_error("--time-budget must be a positive number of seconds.");
+            }
+        } else if (arg == "--max-ops") {
+            opts.max_ops = std::max<std::size_t>(1, std::stoull(std::string(value())));
+        } else if (arg == "--priority") {
+            std::string_view order = value();
+            if (order == "oldest") {
+                opts.priority = PriorityOrder::Oldest;
+            } else if (order == "largest") {
+                opts.priority = PriorityOrder::Largest;
+            } else if (order.substr(0, 9) == "category:") {
+                opts.priority = PriorityOrder::Category;
+                opts.category_order.clear();
+                for (std::string_view list = order.substr(9); !list.empty();) {
+                    std::string_view name = list.substr(0, list.find(','));
+                    list.remove_prefix(std::min(list.size(), name.size() + 1));
+                    if (category_id(name) == kNoCategory) {
+                        throw std::runtime_error("Unknown category '" + std::string(name) + "' in --priority.");
+                    }
+                    opts.category_order.emplace_back(name);
+                }
+            } else {
+                throw std::runtime_error("--priority must be 'oldest', 'largest' or 'category:<name>,...'.");
+            }
+        } else if (arg == "--from-list") {
+            opts.from_list = trim_path(value());
+        } else if (arg == "--snapshot") {
+            opts.snapshot = trim_path(value());
+        } else if (arg == "--diff") {
+            opts.diff_old = trim_path(value());
+            opts.diff_new = trim_path(value());
+        } else if (arg == "--mime-db") {
+            opts.mime_db = trim_path(value());
+        } else if (arg == "--import-mime") {
+            opts.import_mime = trim_path(value());
+        } else if (arg == "--mime-map") {
+            opts.mime_map = trim_path(value());
+        } else if (arg == "--conflict-stats") {
+            opts.conflict_stats = trim_path(value());
+        } else if (arg == "--suffix-hot") {
+            opts.suffix_hot = static_cast<std::uint32_t>(std::clamp(std::stoull(std::string(value())), 1ull, 0xFFFFFFFFull));
+        } else if (arg == "--hash-db") {
+            opts.hash_db = trim_path(value());
+        } else if (arg == "--scrub") {
+            opts.scrub = true;
+        } else if (arg == "--scrub-rate") {
+            opts.scrub_rate = std::stod(std::string(value()));
+        } else if (arg == "--plan-out") {
+            opts.plan_out = trim_path(value());
+        } else if (arg == "--apply-plan") {
+            opts.apply_plan = trim_path(value());
+        } else if (arg == "--trace") {
+            opts.trace = trim_path(value());
+        } else if (arg == "--replay") {
+            opts.replay = trim_path(value());
+        } else if (arg == "--replay-mode") {
+            std::string_view mode = value();
+            if (mode != "sync" && mode != "parallel") {
+                throw std::runtime_error("--replay-mode must be 'sync' or 'parallel'.");
+            }
+            opts.replay_parallel = mode == "parallel";
+        } else if (arg == "--replay-timing") {
+            std::string_view timing = value();
+            if (timing != "fast" && timing != "original") {
+                throw std::runtime_error("--replay-timing must be 'fast' or 'original'.");
+            }
+            opts.replay_original_timing = timing == "original";
+        } else if (arg == "--s3") {
+            opts.s3 = std::string(value());
+        } else if (arg == "--s3-endpoint") {
+            opts.s3_endpoint = std::string(value());
+        } else if (arg == "--s3-region") {
+            opts.s3_region = std::string(value());
+        } else if (arg == "--s3-part-size") {
+            opts.s3_part_mib = std::clamp<std::size_t>(std::stoull(std::string(value())), 5, 5120);
+        } else if (arg == "--s3-parallel") {
+            opts.s3_parallel = static_cast<unsigned>(std::clamp(std::stoul(std::string(value())), 1ul, 64ul));
+        } else if (arg == "--min-free") {
+            parse_watermark(value(), opts.watermark);
+            opts.admission = true;
+        } else if (arg == "--min-free-inodes") {
+            opts.watermark.inodes = std::stoull(std::string(value()));
+            opts.admission = true;
+        } else if (arg == "--inject") {
+            opts.inject = std::string(value());
+        } else if (arg == "--stress") {
+            opts.stress_runs = std::stoull(std::string(value()));
+        } else if (arg == "--seed") {
+            opts.seed = std::stoull(std::string(value()));
+        } else if (arg == "--watch" || arg == "-w") {
+            opts.watch = true;
+        } else if (arg == "--slo-ms") {
+            opts.slo_ms = std::stod(std::string(value()));
+        } else if (arg == "--stats-interval") {
+            opts.stats_interval = static_cast<unsigned>(std::stoul(std::string(value())));
+        } else if (arg == "--max-batch-ms") {
+            opts.max_batch_ms = std::stod(std::string(value()));
+        } else if (arg == "--simulate-batching") {
+            opts.simulate_batching = true;
+        } else if (arg == "--bench") {
+            opts.bench = std::string(value());
+        } else if (arg == "--bench-files") {
+            opts.bench_files = std::max<std::size_t>(1, std::stoull(std::string(value())));
+        } else if (arg == "--quiet" || arg == "-q") {
+            g_quiet = true;
+        } else if (arg == "--no-live-stats") {
+            opts.live_stats = false;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            throw std::runtime_error("Unknown option '" + std::string(arg) + "'.");
+        } else if (opts.folder.empty()) {
+            opts.folder = trim_path(arg);
+        } else {
+            throw std::runtime_error("Unexpected argument '" + std::string(arg) + "'.");
+        }
+    }
+    if (!opts.import_mime.empty() && opts.mime_db.empty()) {
+        throw std::runtime_error("--import-mime needs --mime-db <file> to write the database to.");
+    }
+    if ((opts.time_budget > 0 || opts.max_ops > 0) &&
+        (opts.watch || !opts.plan_out.empty() || !opts.apply_plan.empty() || opts.stress_runs > 0 ||
+         (opts.scrub && opts.max_ops > 0))) {
+        throw std::runtime_error("--time-budget and --max-ops only apply to organize runs (and --time-budget to --scrub).");
+    }
+    if (opts.scrub && opts.hash_db.empty()) {
+        throw std::runtime_error("--scrub needs --hash-db <file>.");
+    }
+    if (opts.suffix_hot > 0 && opts.conflict_stats.empty()) {
+        throw std::runtime_error("--suffix-hot needs --conflict-stats <file>.");
+    }
+    if (!opts.conflict_stats.empty() && (!opts.plan_out.empty() || opts.scrub || opts.stress_runs > 0 ||
+                                         !opts.replay.empty() || !opts.bench.empty())) {
+        throw std::runtime_error("--conflict-stats only applies to runs that move files.");
+    }
+    if (!opts.dest.empty() && (opts.du || !opts.plan_out.empty() || !opts.apply_plan.empty() || !opts.s3.empty() ||
+                               opts.stress_runs > 0 || !opts.replay.empty() || !opts.bench.empty())) {
+        throw std::runtime_error("--dest cannot be combined with --du, --plan-out, --apply-plan, --s3, --stress, --replay or --bench.");
+    }
+    if (!opts.replicas.empty() && (opts.mirror || opts.admission || opts.perf)) {
+        throw std::runtime_error("Several --dest roots cannot be combined with --mirror, --min-free or --perf.");
+    }
+    if ((opts.mirror || !opts.mirror_state.empty()) && opts.dest.empty()) {
+        throw std::runtime_error("--mirror needs --dest <dir> to mirror into.");
+    }
+    if (opts.mirror) {
+        // The source is never to be written: the mirror may not be the folder or inside it.
+        std::error_code ec;
+        fs::path source = fs::weakly_canonical(opts.folder.empty() ? fs::current_path(ec) : fs::path(opts.folder), ec);
+        fs::path inside = fs::weakly_canonical(opts.dest, ec).lexically_relative(source);
+        if (!ec && !inside.empty() && *inside.begin() != "..") {
+            throw std::runtime_error("--mirror needs a --dest outside the folder it mirrors.");
+        }
+    }
+    if (opts.mirror && (opts.watch || opts.scrub || !opts.from_list.empty() || opts.admission || opts.perf ||
+                        opts.time_budget > 0 || opts.max_ops > 0 || !opts.conflict_stats.empty())) {
+        throw std::runtime_error("--mirror cannot be combined with --watch, --scrub, --from-list, --min-free, --perf, "
+                                 "--time-budget, --max-ops or --conflict-stats.");
+    }
+    if (!opts.s3.empty() && opts.s3_endpoint.empty()) {
+        throw std::runtime_error("--s3 needs --s3-endpoint http://host[:port].");
+    }
+    if (!opts.s3.empty() && (opts.admission || !opts.snapshot.empty() || !opts.hash_db.empty() ||
+                             opts.stress_runs > 0 || !opts.replay.empty() || !opts.bench.empty())) {
+        throw std::runtime_error("--s3 cannot be combined with --min-free, --snapshot, --hash-db, --stress, --replay or --bench.");
+    }
+    if (!opts.snapshot.empty() && (opts.watch || !opts.apply_plan.empty() || !opts.plan_out.empty())) {
+        throw std::runtime_error("--snapshot cannot be combined with --watch, --apply-plan or --plan-out.");
+    }
+    if (opts.group_series > 0 && opts.watch) {
+        throw std::runtime_error("--group-series cannot be combined with --watch.");
+    }
+    if (!opts.from_list.empty() && (opts.perf || opts.recursive || opts.watch)) {
+        throw std::runtime_error("--from-list cannot be combined with --perf, --recursive or --watch.");
+    }
+    return opts;
 }
 
 int main(int argc, char* argv[]) {
@@ -171,18 +9194,62 @@ int main(int argc, char* argv[]) {
         show_help();
         return 0;
     }
+#ifndef _WIN32
+    if (std::string_view(argv[1]) == "top") {
+        return run_top(argc - 2, argv + 2);
+    }
+#endif
 
-    std::string_view arg1 = argv[1];
-    if (arg1 == "--help" || arg1 == "-h" || arg1 == "-H") {
+    Options opts;
+    try {
+        opts = parse_args(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    if (opts.show_help) {
         show_help();
         return 0;
     }
+    if (!opts.diff_old.empty()) {
+        try {
+            diff_snapshots(opts.diff_old, opts.diff_new, std::cout);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (!opts.import_mime.empty()) {
+        try {
+            MimeCategoryMap categories;
+            if (!opts.mime_map.empty()) {
+                categories.load_overrides(opts.mime_map);
+            }
+            import_mime_database(opts.import_mime, categories, opts.mime_db);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (!opts.mime_db.empty()) {
+        try {
+            load_mime_database(opts.mime_db);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    if (opts.simulate_batching) {
+        return simulate_batching(std::chrono::nanoseconds(static_cast<std::int64_t>(opts.max_batch_ms * 1e6))) ? 0 : 1;
+    }
 
     fs::path folder_path;
-    if (arg1 == "-c" || arg1 == "--current" || arg1 == "-C") {
+    if (opts.use_current) {
         folder_path = fs::current_path();
     } else {
-        folder_path = fs::path(trim_path(arg1));
+        folder_path = fs::path(opts.folder);
     }
 
     if (!fs::exists(folder_path)) {
@@ -194,13 +9261,308 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    for (const std::string& dest : opts.replicas) {
+        if (!fs::is_directory(dest)) {
+            std::cerr << "Error: The destination is not a directory: '" << dest << "'" << std::endl;
+            return 1;
+        }
+    }
+    if (!opts.dest.empty() && !fs::is_directory(opts.dest)) {
+        std::cerr << "Error: The destination is not a directory: '" << opts.dest << "'" << std::endl;
+        return 1;
+    }
+
     try {
         folder_path = fs::canonical(folder_path);
         fs::path self_path = fs::weakly_canonical(fs::path(argv[0]));
+        // The category folders live here: the folder itself, or the --dest root.
+        fs::path library_path = opts.dest.empty() ? folder_path : fs::canonical(opts.dest);
+
+        SyncBackend sync_backend;
+        std::unique_ptr<FaultInjectingBackend> faults;
+        std::unique_ptr<TracingBackend> tracer;
+        FsBackend* backend = &sync_backend;
+        if (!opts.inject.empty()) {
+            faults = std::make_unique<FaultInjectingBackend>(*backend, parse_fault_spec(opts.inject), opts.seed);
+            backend = faults.get();
+        }
+        if (!opts.trace.empty()) {
+            tracer = std::make_unique<TracingBackend>(*backend, folder_path);
+            backend = tracer.get();
+        }
+        std::unique_ptr<DeviceRoutingBackend> router;
+#ifndef _WIN32
+        std::unique_ptr<ReplicatingBackend> replicator;
+        if (!opts.replicas.empty()) {
+            std::vector<fs::path> roots{library_path};
+            for (const std::string& dest : opts.replicas) {
+                fs::path root = fs::canonical(dest);
+                if (std::find(roots.begin(), roots.end(), root) != roots.end() || root == folder_path) {
+                    std::cerr << "Error: Every --dest must be a different folder: '" << dest << "'" << std::endl;
+                    return 1;
+                }
+                roots.push_back(std::move(root));
+            }
+            replicator = std::make_unique<ReplicatingBackend>(*backend, std::move(roots));
+            backend = replicator.get();
+        }
+#endif
+        if (library_path != folder_path && opts.replicas.empty()) {
+            router = std::make_unique<DeviceRoutingBackend>(*backend);
+            backend = router.get();
+        }
+#ifndef _WIN32
+        std::unique_ptr<S3Backend> s3;
+        if (!opts.s3.empty()) {
+            S3Config config;
+            parse_s3_target(opts.s3, opts.s3_endpoint, config);
+            if (!opts.s3_region.empty()) config.region = opts.s3_region;
+            config.part_size = opts.s3_part_mib << 20;
+            config.parallel = opts.s3_parallel;
+            s3 = std::make_unique<S3Backend>(*backend, folder_path, std::move(config));
+            backend = s3.get();
+        }
+#endif
+        std::unique_ptr<AdmissionBackend> admission;
+        if (opts.admission) {
+            admission = std::make_unique<AdmissionBackend>(*backend, opts.watermark);
+            backend = admission.get();
+        }
+
+        ConflictSketch conflicts;
+        if (!opts.conflict_stats.empty()) {
+            conflicts.load(opts.conflict_stats);
+            conflicts.begin_run();
+            g_conflict_sketch = &conflicts;
+            g_suffix_hot = opts.suffix_hot;
+        }
+
+#ifndef _WIN32
+        // Runs that move or copy files publish what they are doing for `organize top`.
+        std::unique_ptr<LiveCounters> live;
+        std::unique_ptr<LivePublisher> publisher;
+        if (opts.live_stats && opts.bench.empty() && opts.stress_runs == 0 && opts.replay.empty() && !opts.scrub &&
+            opts.plan_out.empty()) {
+            const char* mode = opts.mirror ? "mirror" : !opts.apply_plan.empty() ? "apply-plan" : opts.watch ? "watch" : "organize";
+            live = std::make_unique<LiveCounters>();
+            try {
+                publisher = std::make_unique<LivePublisher>(*live, mode, folder_path);
+                g_live = live.get();
+            } catch (const std::exception& e) {
+                std::cerr << "Live stats are off: " << e.what() << std::endl;
+            }
+        }
+#endif
+
+        std::ifstream list_file;
+        std::istream* list = nullptr;
+        if (opts.from_list == "-") {
+            list = &std::cin;
+        } else if (!opts.from_list.empty()) {
+            list_file.open(opts.from_list, std::ios::binary);
+            if (!list_file) {
+                std::cerr << "Error: Cannot open file list: '" << opts.from_list << "'" << std::endl;
+                return 1;
+            }
+            list = &list_file;
+        }
+
+        // Where the files moved by an organize or apply-plan run ended up, for --hash-db.
+        std::vector<fs::path> placed;
+        bool placed_known = false;
+
+        if (!opts.bench.empty()) {
+            if (!fs::is_empty(folder_path)) {
+                std::cerr << "Error: Benchmarks need an empty folder: '" << folder_path.string() << "'" << std::endl;
+                return 1;
+            }
+            g_quiet = true;
+            if (opts.bench == "engine") {
+                if (!bench_engine(folder_path, opts.bench_files, opts.jobs)) return 1;
+            } else if (opts.bench == "tree") {
+                bench_tree(folder_path, opts.bench_files);
+            } else if (opts.bench == "series") {
+                bench_series(folder_path, opts.bench_files);
+            } else if (opts.bench == "classify") {
+                bench_classify(folder_path, opts.bench_files);
+            } else if (opts.bench == "prefetch") {
+                bench_prefetch(folder_path, opts.bench_files);
+            } else if (opts.bench == "copy") {
+                bench_copy(folder_path, opts.bench_files);
+            } else {
+                std::cerr << "Error: Unknown benchmark '" << opts.bench << "'." << std::endl;
+                return 1;
+            }
+            return 0;
+        } else if (opts.stress_runs > 0) {
+            std::vector<FaultRule> rules = parse_fault_spec(opts.inject);
+            std::cout << "Running " << opts.stress_runs << " stress runs in '" << folder_path.string()
+                      << "' (seed " << opts.seed << ")..." << std::endl;
+            return run_stress(folder_path, opts.stress_runs, opts.seed, rules) == 0 ? 0 : 1;
+        } else if (!opts.replay.empty()) {
+            std::vector<TraceRecord> trace = read_trace(opts.replay);
+            if (!fs::is_empty(folder_path)) {
+                std::cerr << "Error: Replay needs an empty folder: '" << folder_path.string() << "'" << std::endl;
+                return 1;
+            }
+            replay_trace(*backend, trace, folder_path, opts.replay_parallel, opts.replay_original_timing);
+        } else if (opts.scrub) {
+            ScrubOptions scrub;
+            scrub.verify = true;
+            scrub.bytes_per_second = opts.scrub_rate * 1e6;
+            scrub.jobs = opts.jobs;
+            scrub.time_budget = std::chrono::nanoseconds(static_cast<std::int64_t>(opts.time_budget * 1e9));
+            std::cout << "Scrubbing '" << library_path.string() << "' against '" << opts.hash_db << "'..." << std::endl;
+            std::signal(SIGINT, request_stop);
+            std::signal(SIGTERM, request_stop);
+            ScrubReport report = scrub_library(library_path, opts.hash_db, scrub);
+            print_scrub_report(std::cout, report);
+            if (report.corrupt > 0) {
+                return 1;
+            }
+        } else if (opts.mirror) {
+            ScanOptions scan;
+            scan.recursive = opts.recursive;
+            scan.series_threshold = opts.group_series;
+            scan.stat_helpers = opts.stat_prefetch;
+            scan.dest = library_path;
+            fs::path state = opts.mirror_state.empty() ? library_path / ".organize-mirror" : fs::path(opts.mirror_state);
+            std::cout << "Mirroring '" << folder_path.string() << "' into '" << library_path.string() << "'..." << std::endl;
+            MirrorReport report = mirror_files(*backend, folder_path, self_path, state, opts.jobs, scan);
+            print_mirror_report(std::cout, report);
+            if (!opts.snapshot.empty()) {
+                std::size_t entries = write_snapshot(*backend, library_path, opts.snapshot);
+                std::cout << "Wrote snapshot of " << entries << " files to '" << opts.snapshot << "'." << std::endl;
+            }
+        } else if (!opts.plan_out.empty()) {
+            ScanOptions scan;
+            scan.recursive = opts.recursive;
+            scan.jobs = opts.jobs;
+            scan.list = list;
+            scan.series_threshold = opts.group_series;
+            scan.stat_helpers = opts.stat_prefetch;
+            OutcomeInstrumentation outcomes;
+            std::vector<PlanEntry> plan = list ? ListEngine(*backend, outcomes).plan(folder_path, self_path, scan)
+                                               : build_plan(*backend, folder_path, self_path, scan);
+            write_plan(plan, folder_path, opts.plan_out);
+            std::cout << "Wrote plan with " << plan.size() << " entries to '" << opts.plan_out << "'." << std::endl;
+        } else if (!opts.apply_plan.empty()) {
+            std::vector<PlanEntry> plan = read_plan(opts.apply_plan, folder_path);
+            std::cout << "Applying plan '" << opts.apply_plan << "' to '" << folder_path.string() << "'..." << std::endl;
+            ensure_folders(*backend, folder_path);
+            ensure_plan_folders(*backend, folder_path, plan);
+            ExecuteReport report = execute_plan(*backend, plan, opts.jobs, true, opts.hash_db.empty() ? nullptr : &placed);
+            placed_known = true;
+            std::cout << "Plan applied: " << report.moved << " moved, " << report.skipped << " skipped, "
+                      << report.stale << " stale, " << report.failed << " failed." << std::endl;
+        } else if (opts.watch) {
+            WatchStats stats;
+            stats.slo_ns = static_cast<std::uint64_t>(opts.slo_ms * 1e6);
+            std::cout << "Watching '" << folder_path.string() << "' (Ctrl+C to stop)..." << std::endl;
+            // Never let batching eat more than a quarter of the latency budget.
+            auto max_window = std::chrono::nanoseconds(
+                static_cast<std::int64_t>(std::min(opts.max_batch_ms * 1e6, static_cast<double>(stats.slo_ns) / 4)));
+            watch_folder(folder_path, library_path, self_path, *backend, opts.jobs, stats, max_window, opts.stats_interval);
+            print_watch_stats(std::cout, stats);
+        } else {
+            DiskUsage usage;
+            ScanOptions scan;
+            scan.recursive = opts.recursive;
+            scan.usage = opts.du ? &usage : nullptr;
+            scan.placed = opts.hash_db.empty() ? nullptr : &placed;
+            placed_known = true;
+            scan.list = list;
+            scan.series_threshold = opts.group_series;
+            if (library_path != folder_path) {
+                scan.dest = library_path;
+            }
+            // Helper threads would escape the per-phase counters.
+            scan.stat_helpers = opts.perf ? 0 : opts.stat_prefetch;
+            RunLimits limits;
+            limits.time_budget = std::chrono::nanoseconds(static_cast<std::int64_t>(opts.time_budget * 1e9));
+            limits.max_ops = opts.max_ops;
+            limits.order = opts.priority;
+            limits.category_order = opts.category_order;
+            std::cout << "Organizing files in '" << folder_path.string() << "'..." << std::endl;
+            ExecuteReport report;
+            if (opts.perf) {
+                g_perf.enable();
+                if (backend == &sync_backend) {
+                    ProfiledBackend<SyncBackend> profiled(sync_backend);
+                    report = organize_with<ProfiledFastEngine>(profiled, folder_path, self_path, opts.jobs, scan, &limits);
+                } else {
+                    ProfiledBackend<FsBackend> profiled(*backend);
+                    report = organize_with<ProfiledEngine>(profiled, folder_path, self_path, opts.jobs, scan, &limits);
+                }
+            } else if (list) {
+                report = organize_with<ListEngine>(*backend, folder_path, self_path, opts.jobs, scan, &limits);
+            } else if (backend == &sync_backend && !opts.recursive && !opts.du) {
+                report = organize_with<FastEngine>(sync_backend, folder_path, self_path, opts.jobs, scan, &limits);
+            } else {
+                report = organize_with<GenericEngine>(*backend, folder_path, self_path, opts.jobs, scan, &limits);
+            }
+            std::cout << "File organization complete." << std::endl;
+            if (limits.active()) {
+                print_remaining(std::cout, library_path, limits.remaining);
+            }
+            if (opts.perf) {
+                g_perf.print(std::cout, report.moved + report.skipped + report.failed);
+            }
+            if (!opts.snapshot.empty()) {
+                std::size_t entries = write_snapshot(*backend, library_path, opts.snapshot);
+                std::cout << "Wrote snapshot of " << entries << " files to '" << opts.snapshot << "'." << std::endl;
+            }
+            if (opts.du) {
+                print_disk_usage(std::cout, usage);
+            }
+        }
+        if (!opts.hash_db.empty() && !opts.scrub && opts.plan_out.empty() && opts.replay.empty()) {
+            ScrubOptions record;
+            record.bytes_per_second = opts.scrub_rate * 1e6;
+            record.jobs = opts.jobs;
+            // A run that moved a known set of files only needs those hashed.
+            ScrubReport report = placed_known ? record_hashes(library_path, opts.hash_db, placed, record)
+                                              : scrub_library(library_path, opts.hash_db, record);
+            std::cout << "Recorded hashes of " << report.recorded << " new or changed files ("
+                      << format_bytes(report.bytes) << ") in '" << opts.hash_db << "'." << std::endl;
+        }
+
+        if (g_conflict_sketch) {
+            conflicts.save(opts.conflict_stats);
+            print_conflict_stats(std::cout, conflicts);
+        }
 
-        std::cout << "Organizing files in '" << folder_path.string() << "'..." << std::endl;
-        organize_files(folder_path, self_path);
-        std::cout << "File organization complete." << std::endl;
+        if (faults) {
+            std::cout << "Injected " << faults->injected() << " faults." << std::endl;
+        }
+        if (g_metadata_losses > 0) {
+            std::cout << "Could not preserve extended attributes, ACLs or timestamps of " << g_metadata_losses
+                      << " copied files." << std::endl;
+        }
+#ifndef _WIN32
+        if (replicator) {
+            replicator->print(std::cout);
+        }
+#endif
+        if (router && !opts.mirror) {
+            std::cout << "Renamed " << router->renamed() << " files and copied " << router->copied()
+                      << " across devices into '" << library_path.string() << "'." << std::endl;
+        }
+#ifndef _WIN32
+        if (s3) {
+            std::cout << "Uploaded " << s3->uploaded() << " files (" << format_bytes(s3->uploaded_bytes()) << ") to "
+                      << opts.s3 << (s3->retries() > 0 ? " after " + std::to_string(s3->retries()) + " retried requests" : "")
+                      << "." << std::endl;
+        }
+#endif
+        if (admission && admission->deferred() > 0) {
+            std::cout << "Deferred " << admission->deferred() << " copies (" << format_bytes(admission->deferred_bytes())
+                      << ") to keep destinations above the free-space watermark." << std::endl;
+        }
+        if (tracer) {
+            tracer->write(opts.trace);
+            std::cout << "Recorded " << tracer->size() << " operations to '" << opts.trace << "'." << std::endl;
+        }
 
     } catch (const std::exception& e) {
         std::cerr << "An unexpected error occurred: " << e.what() << std::endl;